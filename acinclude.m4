@@ -33,4 +33,23 @@
 #
 
 
+# AC_AKCOM_ENABLE_PROFILE()
+# -----------------------------------
+AC_DEFUN([AC_AKCOM_ENABLE_PROFILE],[dnl
+   enableval=""
+   AC_ARG_ENABLE(
+      profile,
+      [AS_HELP_STRING([--enable-profile], [record per stage worker timings, logged on SIGUSR1])],
+      [ EPROFILE=$enableval ],
+      [ EPROFILE=$enableval ]
+   )
+   if test "x${EPROFILE}" = "xyes";then
+      USE_PROFILE=yes
+      AC_DEFINE_UNQUOTED(MY_PROFILE, 1, [Record per stage worker timings.])
+   else
+      USE_PROFILE=no
+   fi
+])dnl
+
+
 # end of M4 file
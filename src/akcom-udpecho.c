@@ -84,6 +84,10 @@
 #include <poll.h>
 #include <string.h>
 #include <strings.h>
+#include <endian.h>
+#include <sys/timex.h>
+
+#include "akcom-udpecho.h"
 
 
 ///////////////////
@@ -103,6 +107,13 @@
 #define PACKAGE_VERSION "0.0"
 #endif
 
+#define MY_PROBES                4096    // outstanding requests tracked (power of 2)
+#define MY_NS(ts)                (((uint64_t)(ts).tv_sec * 1000000000) + (uint64_t)(ts).tv_nsec)
+#define MY_MS(ns)                ((double)(ns) / 1000000.0)
+
+#define MY_MODE_ECHO             0
+#define MY_MODE_STAMP            1
+
 
 /////////////////
 //             //
@@ -120,20 +131,20 @@ union my_sa
 };
 
 
-struct udp_echo_plus
+union udp_buffer
 {
-   uint32_t  req_sn;
-   uint32_t  res_sn;
-   uint32_t  recv_time;
-   uint32_t  reply_time;
-   uint32_t  failures;
+   uint8_t                * data;
+   struct udp_echo_plus   * echoplus;
+   struct udp_echo_plus2  * echoplus2;
+   struct stamp_sender    * sender;
+   struct stamp_reflector * reflector;
 };
 
 
-union udp_buffer
+struct my_probe
 {
-   uint8_t              * data;
-   struct udp_echo_plus * echoplus;
+   uint32_t                seq;        // zero once answered
+   uint64_t                sent;       // CLOCK_MONOTONIC_RAW nanoseconds
 };
 
 
@@ -147,14 +158,17 @@ union udp_buffer
 static const char        * prog_name        = PROGRAM_NAME;
 static uint32_t            cnf_count        = 0;
 static int                 cnf_echoplus     = 0;
+static int                 cnf_version      = UDP_ECHO_PLUS_VERSION;
+static int                 cnf_mode         = MY_MODE_ECHO;
 static int                 cnf_verbose      = 0;
 static int                 cnf_silent       = 0;
 static unsigned long       cnf_timeout      = 5;
-static const char        * cnf_port         = "30006";
+static const char        * cnf_port         = NULL;
 static const char        * cnf_host         = NULL;
 static unsigned long       cnf_interval     = 1;
 static size_t              cnf_packetsize   = sizeof(struct udp_echo_plus);
 static int                 should_stop      = 0;
+static struct my_probe     probes[MY_PROBES];
 
 
 //////////////////
@@ -167,6 +181,9 @@ static int                 should_stop      = 0;
 // main statement
 int main(int argc, char * argv[]);
 
+// difference between two NTP timestamps in nanoseconds
+int64_t my_ntp_diff(uint64_t a, uint64_t b);
+
 // signal system stop
 void my_stop(int signum);
 
@@ -192,11 +209,15 @@ int main(int argc, char * argv[])
    int                       fd;
    int                       rc;
    int                       opt_index;
+   int                       version;
    uint32_t                  count;
    uint32_t                  rcvd;
+   uint32_t                  samples;
+   uint32_t                  seq;
    uint64_t                  epoch;
-   uint64_t                  epoch_adj;
    uint64_t                  epoch_max;
+   uint64_t                  rtt;
+   uint64_t                  adj;
    uint64_t                  delay;
    uint64_t                  max;
    uint64_t                  max_adj;
@@ -204,6 +225,13 @@ int main(int argc, char * argv[])
    uint64_t                  min_adj;
    uint64_t                  avg;
    uint64_t                  avg_adj;
+   int64_t                   fwd;
+   int64_t                   rev;
+   uint64_t                  ntp;
+   uint64_t                  t1;
+   uint64_t                  t2;
+   uint64_t                  t3;
+   size_t                    hdrsize;
    ssize_t                   size;
    unsigned short            port;
    char                    * ptr;
@@ -216,16 +244,20 @@ int main(int argc, char * argv[])
    struct addrinfo           hints;
    struct timespec           start;
    struct timespec           now;
+   struct timespec           wall;
    struct pollfd             fds[2];
+   struct my_probe         * probe;
    union udp_buffer          sndbuff;
    union udp_buffer          rcvbuff;
 
    // getopt options
-   static char   short_opt[] = "46c:ehi:qrs:t:vV";
+   static char   short_opt[] = "146c:ehi:m:qrs:t:vV";
    static struct option long_opt[] =
    {
+      {"v1",            no_argument,       0, '1'},
       {"echoplus",      no_argument,       0, 'e'},
       {"help",          no_argument,       0, 'h'},
+      {"mode",          required_argument, 0, 'm'},
       {"quiet",         no_argument,       0, 'q'},
       {"silent",        no_argument,       0, 'q'},
       {"rfc",           no_argument,       0, 'r'},
@@ -255,6 +287,10 @@ int main(int argc, char * argv[])
          case 0:        // long options toggles
          break;
 
+         case '1':
+         cnf_version = 1;
+         break;
+
          case '4':
          hints.ai_family = PF_INET;
          break;
@@ -271,7 +307,7 @@ int main(int argc, char * argv[])
          cnf_echoplus = 1;
          break;
 
-         case 'E':
+         case 'r':
          cnf_echoplus = 0;
          break;
 
@@ -283,6 +319,16 @@ int main(int argc, char * argv[])
          cnf_interval = (unsigned)strtoul(optarg, NULL, 10);
          break;
 
+         case 'm':
+         if      (!(strcasecmp(optarg, "echo")))  { cnf_mode = MY_MODE_ECHO; }
+         else if (!(strcasecmp(optarg, "stamp"))) { cnf_mode = MY_MODE_STAMP; }
+         else
+         {
+            my_usage_error("invalid or unsupported mode -- `%s'", optarg);
+            return(1);
+         };
+         break;
+
          case 'q':
          cnf_silent = 1;
          break;
@@ -292,7 +338,7 @@ int main(int argc, char * argv[])
          break;
 
          case 't':
-         cnf_interval = (unsigned)strtoul(optarg, NULL, 10);
+         cnf_timeout = (unsigned)strtoul(optarg, NULL, 10);
          break;
 
          case 'v':
@@ -329,14 +375,28 @@ int main(int argc, char * argv[])
    };
 
 
+   // STAMP reflectors listen on the well known port and do not speak echo plus
+   if (cnf_port == NULL)
+      cnf_port = (cnf_mode == MY_MODE_STAMP) ? "862" : "30006";
+   if (cnf_mode == MY_MODE_STAMP)
+      cnf_echoplus = 0;
+
+
+   // RFC echo carries the sequence number in the v1 header position
+   version = ((cnf_echoplus)) ? cnf_version : 1;
+   hdrsize = (version == 2) ? sizeof(struct udp_echo_plus2) : sizeof(struct udp_echo_plus);
+   if (cnf_mode == MY_MODE_STAMP)
+      hdrsize = sizeof(struct stamp_sender);
+
+
    // allocate buffer
    if ((fd = open("/dev/urandom", O_RDONLY)) == -1)
    {
       fprintf(stderr, "%s: open(/dev/urandom): %s\n", prog_name, strerror(errno));
       return(1);
    };
-   if (cnf_packetsize < sizeof(struct udp_echo_plus))
-      cnf_packetsize = sizeof(struct udp_echo_plus);
+   if (cnf_packetsize < hdrsize)
+      cnf_packetsize = hdrsize;
    if ((sndbuff.data = malloc(cnf_packetsize)) == NULL)
    {
       fprintf(stderr, "%s: out of virtual memory\n", prog_name);
@@ -358,7 +418,18 @@ int main(int argc, char * argv[])
       return(1);
    };
    close(fd);
-   bzero(sndbuff.data, sizeof(struct udp_echo_plus));
+   bzero(sndbuff.data, hdrsize);
+   if (cnf_mode == MY_MODE_STAMP)
+   {
+      // test packet padding must be zero for compliant reflectors
+      bzero(sndbuff.data, cnf_packetsize);
+      sndbuff.sender->error = htons(my_stamp_error());
+   }
+   else if (version == 2)
+   {
+      sndbuff.echoplus2->magic   = htonl(UDP_ECHO_PLUS_MAGIC);
+      sndbuff.echoplus2->version = UDP_ECHO_PLUS_VERSION;
+   };
 
 
    // resolve host
@@ -429,9 +500,10 @@ int main(int argc, char * argv[])
    signal(SIGTERM, my_stop);
 
 
-   // initialize statistics
+   // initialize statistics, times are in nanoseconds
    count   = 0;
    rcvd    = 0;
+   samples = 0;
    min     = 0;
    min_adj = 0;
    max     = 0;
@@ -463,49 +535,147 @@ int main(int argc, char * argv[])
             should_stop = 1;
       };
 
-      // send UDP echo request
+      // send UDP echo request, round trip is measured from the local send time
       if ((count < (epoch/(10000*cnf_interval))) && ((count < cnf_count) || (!(cnf_count))) )
       {
          count++;
-         sndbuff.echoplus->req_sn = count;
+         probe       = &probes[count & (MY_PROBES - 1)];
+         probe->seq  = count;
+         probe->sent = MY_NS(now);
+         if (cnf_mode == MY_MODE_STAMP)
+         {
+            // STAMP sequence numbers start at zero
+            clock_gettime(CLOCK_REALTIME, &wall);
+            ntp                      = my_ntp_time(&wall);
+            sndbuff.sender->seq      = htonl(count - 1);
+            sndbuff.sender->ts_sec   = htonl((uint32_t)(ntp >> 32));
+            sndbuff.sender->ts_frac  = htonl((uint32_t)ntp);
+         }
+         else if (version == 2)
+         {
+            clock_gettime(CLOCK_REALTIME, &wall);
+            sndbuff.echoplus2->req_sn    = htonl(count);
+            sndbuff.echoplus2->send_time = htobe64(MY_NS(wall));
+         } else
+         {
+            sndbuff.echoplus->req_sn = htonl(count);
+         };
          send(s, sndbuff.data, cnf_packetsize, 0);
       };
 
       // receive UDP echo response
       if ((rc = poll(fds, 1, 0)) > 0)
       {
-         if ((size = recv(s, rcvbuff.data, cnf_packetsize, 0)) == (ssize_t)cnf_packetsize)
+         // STAMP reflectors may pad or truncate replies to the base packet
+         size = recv(s, rcvbuff.data, cnf_packetsize, 0);
+         if ( (cnf_mode == MY_MODE_STAMP) && (size < (ssize_t)sizeof(struct stamp_reflector)) )
+            continue;
+         if ( (cnf_mode != MY_MODE_STAMP) && (size != (ssize_t)cnf_packetsize) )
+            continue;
+         clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+         clock_gettime(CLOCK_REALTIME,      &wall);
+
+         // servers without v2 support rewrite the v2 header as v1, which
+         // also destroys the sequence number of this reply
+         if ( (version == 2) && ( (rcvbuff.echoplus2->magic != htonl(UDP_ECHO_PLUS_MAGIC)) ||
+              (rcvbuff.echoplus2->version != UDP_ECHO_PLUS_VERSION) ||
+              (!(rcvbuff.echoplus2->flags & UDP_ECHO_PLUS_F_REPLY)) ) )
          {
+            if (!(cnf_silent))
+               printf("server does not support echo plus v2, falling back to v1\n");
+            version = 1;
+            bzero(sndbuff.data, sizeof(struct udp_echo_plus2));
             rcvd++;
-            delay      = rcvbuff.echoplus->reply_time - rcvbuff.echoplus->recv_time;
-            delay     /= 100000000;
-            epoch     -= (rcvbuff.echoplus->req_sn * 10000);
-            epoch_adj  = epoch - delay;
-            avg       += epoch;
-            avg_adj   += epoch_adj;
-            if ( (!(min)) || (epoch < min) )
-               min = epoch;
-            if ( (!(max)) || (epoch > max) )
-               max = epoch;
-            if ( (!(min_adj)) || (epoch_adj < min_adj) )
-               min_adj = epoch_adj;
-            if ( (!(max_adj)) || (epoch_adj > max_adj) )
-               max_adj = epoch_adj;
-            if ((cnf_echoplus))
-            {
-               printf("udpecho_seq=%u time=%" PRIu64 ".%" PRIu64 " ms delay=%" PRIu64 ".%" PRIu64 " ms adj_time=%" PRIu64 ".%" PRIu64 " ms\n",
-                      rcvbuff.echoplus->req_sn,
-                      epoch/10, epoch%10,
-                      delay/10, delay%10,
-                      epoch_adj/10, epoch_adj%10
-                     );
-            } else
-            {
-               printf("udpecho_seq=%u time=%" PRIu64 ".%" PRIu64 " ms\n",
-                      rcvbuff.echoplus->req_sn,
-                      epoch/10, epoch%10
-                     );
-            };
+            continue;
+         };
+
+         // match reply to request, ignoring duplicates and unknown replies
+         if (cnf_mode == MY_MODE_STAMP)
+            seq = ntohl(rcvbuff.reflector->sender_seq) + 1;
+         else
+            seq = (version == 2) ? ntohl(rcvbuff.echoplus2->req_sn) : ntohl(rcvbuff.echoplus->req_sn);
+         probe = &probes[seq & (MY_PROBES - 1)];
+         if ( (!(seq)) || (probe->seq != seq) )
+            continue;
+         probe->seq = 0;
+         rcvd++;
+         samples++;
+
+         // server delay is removed from the round trip for the adjusted time
+         rtt   = MY_NS(now) - probe->sent;
+         delay = 0;
+         fwd   = 0;
+         rev   = 0;
+         if (cnf_mode == MY_MODE_STAMP)
+         {
+            // T1 is reflected by the session-reflector, T4 is local receive time
+            t1    = ((uint64_t)ntohl(rcvbuff.reflector->sender_sec) << 32) | ntohl(rcvbuff.reflector->sender_frac);
+            t2    = ((uint64_t)ntohl(rcvbuff.reflector->rx_sec)     << 32) | ntohl(rcvbuff.reflector->rx_frac);
+            t3    = ((uint64_t)ntohl(rcvbuff.reflector->ts_sec)     << 32) | ntohl(rcvbuff.reflector->ts_frac);
+            ntp   = my_ntp_time(&wall);
+            delay = (t3 > t2) ? (uint64_t)my_ntp_diff(t3, t2) : 0;
+            fwd   = my_ntp_diff(t2, t1);
+            rev   = my_ntp_diff(ntp, t3);
+         }
+         else if ( ((cnf_echoplus)) && (version == 2) )
+         {
+            delay = be64toh(rcvbuff.echoplus2->reply_time) - be64toh(rcvbuff.echoplus2->recv_time);
+            fwd   = (int64_t)(be64toh(rcvbuff.echoplus2->recv_time) - be64toh(rcvbuff.echoplus2->send_time));
+            rev   = (int64_t)(MY_NS(wall) - be64toh(rcvbuff.echoplus2->reply_time));
+         }
+         else if ((cnf_echoplus))
+            delay = (uint64_t)(uint32_t)(ntohl(rcvbuff.echoplus->reply_time) - ntohl(rcvbuff.echoplus->recv_time)) * 1000;
+         adj      = (rtt > delay) ? (rtt - delay) : 0;
+         avg     += rtt;
+         avg_adj += adj;
+         if ( (samples == 1) || (rtt < min) )
+            min = rtt;
+         if ( (samples == 1) || (rtt > max) )
+            max = rtt;
+         if ( (samples == 1) || (adj < min_adj) )
+            min_adj = adj;
+         if ( (samples == 1) || (adj > max_adj) )
+            max_adj = adj;
+
+         // one way delays assume synchronized clocks
+         if (cnf_mode == MY_MODE_STAMP)
+         {
+            printf("stamp_seq=%u time=%.3f ms residence=%.3f ms adj_time=%.3f ms fwd=%.3f ms rev=%.3f ms ttl=%u%s\n",
+                   seq - 1,
+                   MY_MS(rtt),
+                   MY_MS(delay),
+                   MY_MS(adj),
+                   MY_MS(fwd),
+                   MY_MS(rev),
+                   rcvbuff.reflector->sender_ttl,
+                   ((ntohs(rcvbuff.reflector->error) & STAMP_ERR_S)) ? "" : " (unsynchronized)"
+                  );
+         }
+         else if ( ((cnf_echoplus)) && (version == 2) )
+         {
+            printf("udpecho_seq=%u time=%.3f ms delay=%.3f ms adj_time=%.3f ms fwd=%.3f ms rev=%.3f ms server=%hu\n",
+                   seq,
+                   MY_MS(rtt),
+                   MY_MS(delay),
+                   MY_MS(adj),
+                   MY_MS(fwd),
+                   MY_MS(rev),
+                   ntohs(rcvbuff.echoplus2->server_id)
+                  );
+         } else if ((cnf_echoplus))
+         {
+            printf("udpecho_seq=%u time=%.3f ms delay=%.3f ms adj_time=%.3f ms\n",
+                   seq,
+                   MY_MS(rtt),
+                   MY_MS(delay),
+                   MY_MS(adj)
+                  );
+         } else
+         {
+            printf("udpecho_seq=%u time=%.3f ms\n",
+                   seq,
+                   MY_MS(rtt)
+                  );
          };
       } else
       {
@@ -514,7 +684,7 @@ int main(int argc, char * argv[])
    };
 
 
-   if (!(cnf_silent))
+   if ( (!(cnf_silent)) && ((count)) )
    {
       printf("\n");
       printf("--- %s udpecho statistics ---\n", cnf_host);
@@ -524,17 +694,20 @@ int main(int argc, char * argv[])
              ((count - rcvd) * 100) / count,
              (((count - rcvd) * 1000) / count) % 10
             );
-      printf("round-trip min/avg/max = %" PRIu64 ".%" PRIu64 "/%" PRIu64 ".%" PRIu64 "/%" PRIu64 ".%" PRIu64 " ms\n",
-             min/10,        min%10,
-             (avg/rcvd)/10, (avg/rcvd)%10,
-             max/10,        max%10
-            );
-      if ((cnf_echoplus))
+      if ((samples))
+      {
+         printf("round-trip min/avg/max = %.3f/%.3f/%.3f ms\n",
+                MY_MS(min),
+                MY_MS(avg / samples),
+                MY_MS(max)
+               );
+      };
+      if ( ( ((cnf_echoplus)) || (cnf_mode == MY_MODE_STAMP) ) && ((samples)) )
       {
-         printf("adjusted round-trip min/avg/max = %" PRIu64 ".%" PRIu64 "/%" PRIu64 ".%" PRIu64 "/%" PRIu64 ".%" PRIu64 " ms\n",
-                min_adj/10,        min_adj%10,
-                (avg_adj/rcvd)/10, (avg_adj/rcvd)%10,
-                max_adj/10,        max_adj%10
+         printf("adjusted round-trip min/avg/max = %.3f/%.3f/%.3f ms\n",
+                MY_MS(min_adj),
+                MY_MS(avg_adj / samples),
+                MY_MS(max_adj)
                );
       };
    };
@@ -550,6 +723,17 @@ int main(int argc, char * argv[])
 }
 
 
+// difference between two NTP timestamps in nanoseconds
+int64_t my_ntp_diff(uint64_t a, uint64_t b)
+{
+   int64_t                   diff;
+
+   // arithmetic shift keeps the fraction positive for negative differences
+   diff = (int64_t)(a - b);
+   return(((diff >> 32) * 1000000000) + (int64_t)(((uint64_t)(diff & 0xffffffff) * 1000000000) >> 32));
+}
+
+
 // signal system stop
 void my_stop(int signum)
 {
@@ -564,12 +748,14 @@ void my_usage(void)
 {
    printf("Usage: %s [options] host [port]\n", prog_name);
    printf("OPTIONS:\n");
+   printf("  -1, --v1                  send echo plus v1 requests instead of negotiating v2\n");
    printf("  -4                        connect via IPv4 only\n");
    printf("  -6                        connect via IPv6 only\n");
    printf("  -c count                  stop after sending count packets\n");
-   printf("  -e, --echoplus            expect echo plus response%s\n", ((cnf_echoplus)) ? " (default)" : "");
+   printf("  -e, --echoplus            expect echo plus response, falls back to v1 if v2 is unsupported%s\n", ((cnf_echoplus)) ? " (default)" : "");
    printf("  -h, --help                print this help and exit\n");
    printf("  -i interval               interval between packet (default: %lu sec)\n", cnf_interval);
+   printf("  -m mode, --mode=mode      protocol: echo, stamp (default: echo, port 30006 or 862 for stamp)\n");
    printf("  -r, --rfc                 expect RFC compliant echo response%s\n", (!(cnf_echoplus)) ? " (default)" : "");
    printf("  -q, --quiet, --silent     do not print messages\n");
    printf("  -s packetsize             size of data bytes to be sent. (default: %zu bytes)\n", cnf_packetsize);
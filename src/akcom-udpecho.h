@@ -0,0 +1,332 @@
+/*
+ *  Alaska Communications UDP Echo Tools
+ *  Copyright (C) 2020 Alaska Communications
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ *  @file akcom-udpecho.h UDP echo wire formats and file layouts shared by the tools
+ */
+#ifndef _AKCOM_UDP_ECHO_H
+#define _AKCOM_UDP_ECHO_H 1
+
+///////////////
+//           //
+//  Headers  //
+//           //
+///////////////
+#pragma mark - Headers
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/timex.h>
+
+
+///////////////////
+//               //
+//  Definitions  //
+//               //
+///////////////////
+#pragma mark - Definitions
+
+#define UDP_ECHO_PLUS_MAGIC      0x414b4532    // "AKE2"
+#define UDP_ECHO_PLUS_VERSION    2
+
+#define UDP_ECHO_PLUS_F_REPLY    0x01          // server filled in reply fields
+#define UDP_ECHO_PLUS_F_KERNEL   0x02          // recv_time taken from kernel timestamp
+
+#define STAMP_PORT               862           // RFC 8762 well known port
+#define STAMP_NTP_OFFSET         2208988800ULL // seconds from 1900 to 1970
+#define STAMP_ERR_S              0x8000        // error estimate: clock is synchronized
+#define STAMP_ERR_Z              0x4000        // error estimate: PTP timestamp format
+
+#define UDP_ECHO_STATS_MAGIC     0x414b5331    // "AKS1"
+#define UDP_ECHO_STATS_VERSION   1
+#define UDP_ECHO_STATS_COUNTERS  16            // counter slots per worker
+#define UDP_ECHO_STATS_HISTS     2             // histograms per worker
+#define UDP_ECHO_STATS_BUCKETS   32            // bucket slots per histogram
+
+#define UDP_ECHO_STAT_RX_PKTS    0             // echo requests received
+#define UDP_ECHO_STAT_RX_BYTES   1
+#define UDP_ECHO_STAT_TX_PKTS    2             // echo replies sent
+#define UDP_ECHO_STAT_TX_BYTES   3
+#define UDP_ECHO_STAT_DROPS      4             // dropped by impairments or a full delay pool
+#define UDP_ECHO_STAT_DENIES     5             // refused by policy rules
+#define UDP_ECHO_STAT_TRUNCATED  6             // larger than the receive buffer
+#define UDP_ECHO_STAT_RX_ERRORS  7
+#define UDP_ECHO_STAT_TX_ERRORS  8
+#define UDP_ECHO_STAT_ZC_PKTS    9             // replies sent with zero copy transmit
+#define UDP_ECHO_STAT_ZC_COPIED  10            // zero copy replies the kernel copied anyway
+#define UDP_ECHO_STAT_RXQ_DROPS  11            // dropped by the kernel on a full receive queue
+
+#define UDP_ECHO_HIST_SERVICE    0             // receive to reply, excluding injected delay
+#define UDP_ECHO_HIST_RESIDENCE  1             // receive to transmit timestamp, including delay
+
+#define UDP_ECHO_JOURNAL_MAGIC   0x414b4a31    // "AKJ1"
+#define UDP_ECHO_JOURNAL_VERSION 1
+#define UDP_ECHO_JOURNAL_LISTENERS 64          // listener slots in journal header
+
+#define UDP_ECHO_JOURNAL_SENT    0             // reply transmitted
+#define UDP_ECHO_JOURNAL_RECV    1             // request received
+#define UDP_ECHO_JOURNAL_DROP    2             // request dropped by impairment or full delay pool
+#define UDP_ECHO_JOURNAL_DENY    4             // request refused by policy rules
+
+#define UDP_ECHO_JOURNAL_FMT_NONE  0           // datagram echoed unmodified
+#define UDP_ECHO_JOURNAL_FMT_V1    1           // echo plus v1
+#define UDP_ECHO_JOURNAL_FMT_V2    2           // echo plus v2
+#define UDP_ECHO_JOURNAL_FMT_STAMP 3           // STAMP / TWAMP-Light
+
+#define PCAP_MAGIC_NSEC          0xa1b23c4d    // pcap file with nanosecond timestamps
+#define PCAP_LINKTYPE_RAW        101           // packets begin with IPv4 or IPv6 header
+
+
+/////////////////
+//             //
+//  Datatypes  //
+//             //
+/////////////////
+#pragma mark - Datatypes
+
+// echo plus v1, timestamps are microseconds truncated to 32 bits
+struct udp_echo_plus
+{
+   uint32_t  req_sn;
+   uint32_t  res_sn;
+   uint32_t  recv_time;
+   uint32_t  reply_time;
+   uint32_t  failures;
+};
+
+
+// echo plus v2, all fields in network byte order and timestamps in
+// nanoseconds since the Unix epoch
+struct udp_echo_plus2
+{
+   uint32_t  magic;        // UDP_ECHO_PLUS_MAGIC
+   uint8_t   version;      // UDP_ECHO_PLUS_VERSION
+   uint8_t   flags;        // UDP_ECHO_PLUS_F_*
+   uint16_t  server_id;    // identifies replying server
+   uint32_t  req_sn;
+   uint32_t  res_sn;
+   uint64_t  send_time;    // client transmit time
+   uint64_t  recv_time;    // server receive time
+   uint64_t  reply_time;   // server transmit time
+   uint32_t  failures;     // replies withheld from client
+   uint32_t  reserved;
+};
+
+
+// STAMP (RFC 8762) and TWAMP-Light unauthenticated session-sender test
+// packet, timestamps are NTP format in network byte order
+struct stamp_sender
+{
+   uint32_t  seq;
+   uint32_t  ts_sec;       // transmit time, seconds since 1900
+   uint32_t  ts_frac;      // transmit time, 2^-32 seconds
+   uint16_t  error;        // error estimate (RFC 4656)
+   uint8_t   mbz[30];
+};
+
+
+// STAMP and TWAMP-Light unauthenticated session-reflector test packet
+struct stamp_reflector
+{
+   uint32_t  seq;
+   uint32_t  ts_sec;       // reflector transmit time
+   uint32_t  ts_frac;
+   uint16_t  error;
+   uint16_t  mbz1;
+   uint32_t  rx_sec;       // reflector receive time
+   uint32_t  rx_frac;
+   uint32_t  sender_seq;
+   uint32_t  sender_sec;
+   uint32_t  sender_frac;
+   uint16_t  sender_error;
+   uint16_t  mbz2;
+   uint8_t   sender_ttl;   // TTL or hop limit of received test packet
+   uint8_t   mbz3[3];
+};
+
+
+// statistics of one worker in the shared memory segment, in host byte
+// order. The worker makes seq odd while updating the record, so readers
+// retry until seq is even and unchanged across their copy.
+struct udp_echo_stats_worker
+{
+   uint32_t  seq;
+   uint32_t  id;
+   uint64_t  updated;      // CLOCK_MONOTONIC nanoseconds of last update
+   uint64_t  delayed;      // replies held in the delay queue
+   uint64_t  flows;        // flow table slots in use
+   uint64_t  counters[UDP_ECHO_STATS_COUNTERS];
+   uint64_t  hist_count[UDP_ECHO_STATS_HISTS];
+   uint64_t  hist_sum[UDP_ECHO_STATS_HISTS];     // nanoseconds
+   uint64_t  hist[UDP_ECHO_STATS_HISTS][UDP_ECHO_STATS_BUCKETS];
+};
+
+
+// shared memory statistics segment, magic is written last once the
+// segment is ready
+struct udp_echo_stats
+{
+   uint32_t  magic;        // UDP_ECHO_STATS_MAGIC
+   uint16_t  version;      // UDP_ECHO_STATS_VERSION
+   uint16_t  hist_shift;   // first bucket holds up to 2^hist_shift nanoseconds
+   uint32_t  workers;      // worker records following header
+   uint32_t  hist_buckets; // bucket slots in use
+   uint64_t  pid;
+   uint64_t  started;      // CLOCK_REALTIME seconds
+   uint8_t   reserved[32];
+   struct udp_echo_stats_worker worker[];
+};
+
+
+// listener of the instance writing the journal
+struct udp_echo_journal_listener
+{
+   uint8_t   addr[16];     // IPv4 in first 4 bytes
+   uint16_t  port;
+   uint8_t   family;       // 4 or 6
+   uint8_t   reserved;
+};
+
+
+// packet journal record, in host byte order
+struct udp_echo_journal_rec
+{
+   uint64_t  time;         // nanoseconds since the Unix epoch
+   uint64_t  conn;         // connection number of request
+   uint8_t   addr[16];     // client address, IPv4 in first 4 bytes
+   uint32_t  size;         // datagram bytes
+   uint32_t  seq;          // echo plus or STAMP sequence number
+   uint32_t  delay;        // injected delay in microseconds
+   uint32_t  delta;        // echo plus reply time - receive time in microseconds
+   uint16_t  port;         // client port
+   uint16_t  worker;
+   uint8_t   family;       // 4 or 6
+   uint8_t   action;       // UDP_ECHO_JOURNAL_SENT, _RECV, _DROP or _DENY
+   uint8_t   format;       // UDP_ECHO_JOURNAL_FMT_*
+   uint8_t   listener;     // index into journal listener table
+   uint8_t   reserved[8];
+};
+
+
+// memory-mapped packet journal, a ring of records following a 2 KiB
+// header. head counts every record written, so the ring holds records
+// max(0, head - records) through head - 1.
+struct udp_echo_journal
+{
+   uint32_t  magic;        // UDP_ECHO_JOURNAL_MAGIC
+   uint16_t  version;      // UDP_ECHO_JOURNAL_VERSION
+   uint16_t  rec_size;     // sizeof(struct udp_echo_journal_rec)
+   uint64_t  records;      // ring capacity
+   uint64_t  head;         // records written, next goes to slot head % records
+   uint64_t  dropped;      // records lost while the writer fell behind
+   uint64_t  pid;          // instance writing the journal
+   uint64_t  created;      // CLOCK_REALTIME seconds
+   uint32_t  listeners;
+   uint8_t   reserved[12];
+   struct udp_echo_journal_listener listener[UDP_ECHO_JOURNAL_LISTENERS];
+   uint8_t   pad[704];
+   struct udp_echo_journal_rec rec[];
+};
+
+
+// pcap file header
+struct pcap_file_hdr
+{
+   uint32_t  magic;        // PCAP_MAGIC_NSEC
+   uint16_t  version_major;
+   uint16_t  version_minor;
+   int32_t   thiszone;
+   uint32_t  sigfigs;
+   uint32_t  snaplen;
+   uint32_t  linktype;
+};
+
+
+// pcap packet record header
+struct pcap_rec_hdr
+{
+   uint32_t  ts_sec;
+   uint32_t  ts_nsec;
+   uint32_t  incl_len;     // bytes captured
+   uint32_t  orig_len;     // bytes on the wire
+};
+
+
+///////////////
+//           //
+//  Helpers  //
+//           //
+///////////////
+#pragma mark - Helpers
+
+// convert time to 64 bit NTP timestamp
+static inline uint64_t my_ntp_time(const struct timespec * tsp)
+{
+   uint64_t                  ntp;
+
+   ntp  = ((uint64_t)tsp->tv_sec + STAMP_NTP_OFFSET) << 32;
+   ntp |= ((uint64_t)tsp->tv_nsec << 32) / 1000000000;
+
+   return(ntp);
+}
+
+
+// STAMP error estimate of local clock from kernel clock discipline
+static inline uint16_t my_stamp_error(void)
+{
+   int                       state;
+   unsigned                  scale;
+   uint64_t                  mult;
+   uint16_t                  err;
+   struct timex              tx;
+
+   memset(&tx, 0, sizeof(tx));
+   if ((state = ntp_adjtime(&tx)) == -1)
+      return(0);
+
+   // error is multiplier * 2^(scale - 32) seconds, rounded up so the
+   // estimate is never smaller than the kernel's estimated error
+   mult = (((uint64_t)((tx.esterror > 0) ? tx.esterror : 1) << 32) + 999999) / 1000000;
+   for(scale = 0; ( (mult > 0xff) && (scale < 0x3f) ); scale++)
+      mult = (mult + 1) >> 1;
+   if (mult > 0xff)
+      mult = 0xff;
+
+   err  = (uint16_t)((scale << 8) | mult);
+   if ( (state != TIME_ERROR) && (!(tx.status & STA_UNSYNC)) )
+      err |= STAMP_ERR_S;
+
+   return(err);
+}
+
+
+#endif /* end of header */
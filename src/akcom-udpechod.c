@@ -46,6 +46,10 @@
  *
  *  Libtool Clean:
  *     libtool --mode=clean rm -f akcom-udpechod.lo akcom-udpechod
+ *
+ *  Profiling Build:
+ *     add -DMY_PROFILE=1 to CFLAGS (or configure --enable-profile), SIGUSR1
+ *     then logs time spent in each stage of the worker loops
  */
 #define _AKCOM_UDP_ECHO_SERVER_C 1
 
@@ -59,9 +63,13 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
 
 #include <stdint.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -73,7 +81,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/file.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <time.h>
@@ -84,6 +95,25 @@
 #include <poll.h>
 #include <pwd.h>
 #include <grp.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <endian.h>
+#include <sys/timex.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#endif
+#if defined(MY_PROFILE) && ( defined(__x86_64__) || defined(__i386__) )
+#include <x86intrin.h>
+#endif
+
+#include "akcom-udpecho.h"
 
 
 ///////////////////
@@ -93,7 +123,56 @@
 ///////////////////
 #pragma mark - Definitions
 
-#define MY_BUFF_SIZE             4096    // default buffer size
+#define MY_BUFF_SIZE             65536   // largest datagram or GRO coalesced train
+#define MY_TRAIN_SEGS            64      // most segments the kernel coalesces into one GRO train
+#define MY_BATCH_MAX             1024    // maximum datagrams per batch
+#define MY_WORKERS_MAX           256     // maximum number of worker threads
+#define MY_LISTEN_MAX            16      // maximum addresses given with -l
+#define MY_PORTS_MAX             16      // maximum ports given with -p
+#define MY_LISTENERS_MAX         64      // maximum address and port combinations
+#define MY_EPOLL_EVENTS          16      // epoll events per wakeup
+#define MY_EPOLL_READS           16      // receive calls per ready socket before serving the next
+#define MY_DELAY_POOL            4096    // default delayed replies per worker
+#define MY_DELAY_POOL_MAX        1048576 // maximum delayed replies per worker
+#define MY_DELAY_SLOT            2048    // delay pool slot, holds an Ethernet MTU datagram
+#define MY_DELAY_LARGE           16      // maximum delay pool slots of MY_BUFF_SIZE per worker
+#define MY_DELAY_MAX             60000000 // maximum reply delay in microseconds
+#define MY_REORDER_GAP           1000    // default reorder hold back in microseconds
+#define MY_FLOWS                 4096    // default flow table slots per worker
+#define MY_FLOWS_MAX             16777216 // maximum flow table slots per worker
+#define MY_FLOW_PROBE            8       // flow table probe window
+#define MY_HIST_BUCKETS          24      // latency histogram buckets
+#define MY_HIST_SHIFT            8       // first bucket holds up to 2^8 ns
+#define MY_METRICS_BUFF          16384   // metrics response buffer excluding listener series
+#define MY_METRICS_SERIES        192     // metrics bytes per listener series
+#define MY_METRICS_TIMEOUT       1000    // metrics request read timeout in milliseconds
+#define MY_CONTROL_TIMEOUT       10000   // takeover wait for the other instance in milliseconds
+#define MY_HANDOFF_FDS           64      // sockets passed per takeover message
+#define MY_JOURNAL_MB            64      // default journal size in megabytes
+#define MY_JOURNAL_MB_MAX        65536   // maximum journal size in megabytes
+#define MY_SHM_INTERVAL          1000000 // nanoseconds between statistics segment updates of a busy worker
+#define MY_CMSG_SIZE             256     // ancillary data buffer per datagram
+#define MY_TSQ                   1024    // replies awaiting transmit timestamps per worker (power of 2)
+#define MY_LOG_RING              4096    // log records per worker (power of 2)
+#define MY_LOG_INTERVAL          10000000 // logger idle sleep in nanoseconds
+#define MY_CAPTURE_RING          1048576 // captured bytes buffered per worker (power of 2)
+#define MY_CAPTURE_SNAPLEN       65535   // largest captured packet including synthesized headers
+#define MY_URING_ENTRIES         512     // io_uring submission queue entries
+#define MY_URING_BUFFERS         256     // io_uring provided buffers (power of 2)
+#define MY_URING_BGID            1       // io_uring provided buffer group
+#define MY_URING_BUFSZ           (16 + sizeof(struct sockaddr_storage) + MY_CMSG_SIZE + MY_BUFF_SIZE)
+#define MY_BURST                 10000   // default burst absorbed by socket buffers in microseconds
+#define MY_BUSY_DRAIN            64      // busy poll or drain spins between error queue reads (power of 2)
+#define MY_ZC_POOL               256     // zero copy replies awaiting completion per worker (power of 2)
+#define MY_ZC_NONE               0xffffffffU // no pool slot
+
+#ifdef SO_RCVBUFFORCE
+#define MY_SO_RCVBUFFORCE        SO_RCVBUFFORCE
+#define MY_SO_SNDBUFFORCE        SO_SNDBUFFORCE
+#else
+#define MY_SO_RCVBUFFORCE        -1
+#define MY_SO_SNDBUFFORCE        -1
+#endif
 
 
 #ifndef PROGRAM_NAME
@@ -109,6 +188,115 @@
 #define MY_SENT 0
 #define MY_RECV 1
 #define MY_DROP 2
+#define MY_DELAY 3
+#define MY_DENY 4
+
+#define MY_DIST_UNIFORM          0
+#define MY_DIST_NORMAL           1
+#define MY_DIST_PARETO           2
+
+#define MY_OPT_DELAY_DIST        256     // long only options
+#define MY_OPT_LOSS_GE           257
+#define MY_OPT_REORDER           258
+#define MY_OPT_DUPLICATE         259
+#define MY_OPT_CORRUPT           260
+#define MY_OPT_FLOWS             261
+#define MY_OPT_METRICS           262
+#define MY_OPT_SERVER_ID         263
+#define MY_OPT_MODE              264
+#define MY_OPT_GRO               265
+#define MY_OPT_ZEROCOPY          266
+#define MY_OPT_RATE              267
+#define MY_OPT_BURST             268
+#define MY_OPT_BUSY_POLL         269
+#define MY_OPT_CPUS              270
+#define MY_OPT_FIFO              271
+#define MY_OPT_CONTROL           272
+#define MY_OPT_TAKEOVER          273
+#define MY_OPT_SHM               274
+#define MY_OPT_JOURNAL           275
+#define MY_OPT_CAPTURE           276
+#define MY_OPT_CAPTURE_SAMPLE    277
+
+#define MY_MODE_ECHO             0
+#define MY_MODE_STAMP            1
+
+#define MY_FMT_NONE              0       // datagram echoed unmodified
+#define MY_FMT_V1                1       // echo plus v1
+#define MY_FMT_V2                2       // echo plus v2
+#define MY_FMT_STAMP             3       // STAMP / TWAMP-Light test packet
+
+#define MY_RULE_DROP             0x01    // settings overridden by a rule, others follow the defaults
+#define MY_RULE_REORDER          0x02
+#define MY_RULE_DUPLICATE        0x04
+#define MY_RULE_CORRUPT          0x08
+#define MY_RULE_DELAY            0x10
+#define MY_RULE_JITTER           0x20
+
+#define MY_TS_NONE               0
+#define MY_TS_SOFTWARE           1
+#define MY_TS_HARDWARE           2
+
+#define MY_STAT_RX_PKTS          UDP_ECHO_STAT_RX_PKTS
+#define MY_STAT_RX_BYTES         UDP_ECHO_STAT_RX_BYTES
+#define MY_STAT_TX_PKTS          UDP_ECHO_STAT_TX_PKTS
+#define MY_STAT_TX_BYTES         UDP_ECHO_STAT_TX_BYTES
+#define MY_STAT_DROPS            UDP_ECHO_STAT_DROPS
+#define MY_STAT_DENIES           UDP_ECHO_STAT_DENIES
+#define MY_STAT_TRUNCATED        UDP_ECHO_STAT_TRUNCATED
+#define MY_STAT_RX_ERRORS        UDP_ECHO_STAT_RX_ERRORS
+#define MY_STAT_TX_ERRORS        UDP_ECHO_STAT_TX_ERRORS
+#define MY_STAT_ZC_PKTS          UDP_ECHO_STAT_ZC_PKTS
+#define MY_STAT_ZC_COPIED        UDP_ECHO_STAT_ZC_COPIED
+#define MY_STAT_RXQ_DROPS        UDP_ECHO_STAT_RXQ_DROPS
+#define MY_STAT_COUNTERS         12
+
+#define MY_HIST_SERVICE          UDP_ECHO_HIST_SERVICE
+#define MY_HIST_RESIDENCE        UDP_ECHO_HIST_RESIDENCE
+#define MY_HIST_COUNT            2
+
+// worker is the only writer of its shard and its sockets, so relaxed load and
+// store avoids a locked read-modify-write while scrapes never observe torn values
+#define MY_COUNTER_ADD(p, n)     atomic_store_explicit((p), atomic_load_explicit((p), memory_order_relaxed) + (uint64_t)(n), \
+                                    memory_order_relaxed)
+#define MY_STAT_INC(wp, idx, n)  do { MY_COUNTER_ADD(&(wp)->stats->counters[idx], n); \
+                                      MY_COUNTER_ADD(&(wp)->sock->counters[idx], n); } while(0)
+
+#ifdef MY_PROFILE
+#define MY_PROF_WAIT             0       // blocked in poll(), epoll_wait() or io_uring_enter()
+#define MY_PROF_RECV             1       // recvmsg() or recvmmsg()
+#define MY_PROF_STAMP            2       // receive timestamp and ancillary data
+#define MY_PROF_LOG              3       // request logging and counters
+#define MY_PROF_IMPAIR           4       // policy, impairments and reply preparation
+#define MY_PROF_SEND             5       // reply timestamp and transmit
+#define MY_PROF_LOG_SENT         6       // reply logging
+#define MY_PROF_STAGES           7
+#define MY_PROF_SUB_BITS         2       // linear sub-buckets per power of 2 as log2
+#define MY_PROF_BUCKETS          (64 << MY_PROF_SUB_BITS)
+#define MY_PROF_BEGIN(wp)        ((wp)->prof->last = my_prof_clock())
+#define MY_PROF(wp, stage)       my_prof_mark((wp), (stage))
+#else
+#define MY_PROF_BEGIN(wp)        do { } while(0)
+#define MY_PROF(wp, stage)       do { } while(0)
+#endif
+
+#define MY_PERCT(thresh)         ((double)(thresh) * 100.0 / 4294967296.0)
+
+#define MY_ENGINE_POLL           0
+#define MY_ENGINE_URING          1
+#define MY_ENGINE_EPOLL          2
+
+#ifdef EPOLLET
+#define MY_ENGINE_DEFAULT        MY_ENGINE_EPOLL
+#else
+#define MY_ENGINE_DEFAULT        MY_ENGINE_POLL
+#endif
+
+#define MY_URING_RECV            (1ULL << 32)
+#define MY_URING_SEND            (2ULL << 32)
+#define MY_URING_SEND_ZC         (3ULL << 32)
+#define MY_URING_CANCEL          (4ULL << 32)
+#define MY_URING_TAG_MASK        (0xffffffffULL << 32)
 
 
 /////////////////
@@ -127,13 +315,337 @@ union my_sa
 };
 
 
-struct udp_echo_plus
+// local address a request arrived on, replies are sent from the same address
+struct my_pktinfo
+{
+   int                     family;     // zero when unknown
+   unsigned                ifindex;
+   uint8_t                 addr[16];
+};
+
+
+struct my_listener
+{
+   union my_sa             sa;         // bound address
+   socklen_t               salen;
+   uint64_t                reported;   // receive queue drops already logged
+   char                    name[INET6_ADDRSTRLEN + 8]; // [address]:port
+};
+
+
+#ifdef MSG_WAITFORONE
+struct my_zcpool
+{
+   unsigned                nfree;      // slots available for receiving
+   unsigned              * free;       // stack of free slots
+};
+
+
+// kernel numbers zero copy transmits per socket
+struct my_zcq
+{
+   uint32_t                next;       // kernel identifier of next zero copy transmit
+   unsigned                pending[MY_ZC_POOL]; // slot of each identifier awaiting completion
+};
+
+
+struct my_batch
+{
+   unsigned                size;       // number of datagrams per batch
+   struct mmsghdr        * msgs;       // receive message headers
+   struct mmsghdr        * replies;    // transmit message headers
+   struct iovec          * iovs;
+   union my_sa           * sas;
+   useconds_t            * delays;
+   struct timespec       * stamps;     // receive timestamp of each reply
+   unsigned              * segs;       // GSO segment size of each reply, 0 if not segmented
+   uint8_t               * fmts;       // header format of each reply segment, MY_TRAIN_SEGS per reply
+   size_t                * conns;      // connection number of each reply
+   struct my_pktinfo     * dsts;       // local address of each reply
+   uint8_t               * ctrls;      // ancillary data buffers
+   uint8_t               * buffs;
+   unsigned              * slots;      // buffer slot of each datagram
+   unsigned              * origins;    // datagram of each reply
+   unsigned              * spares;     // slot replacing each zero copy reply, or MY_ZC_NONE
+   struct my_zcpool      * zc;         // zero copy buffer pool, NULL if disabled
+};
+#endif
+
+
+#ifdef IORING_RECV_MULTISHOT
+struct my_uring
+{
+   int                       fd;
+   int                       unsupported;   // kernel rejected multishot receive
+   int                       zc_unsupported; // kernel rejected zero copy transmit
+   unsigned                  sq_entries;
+   unsigned                  sq_mask;
+   unsigned                  sq_pending;    // local submission queue tail
+   unsigned                  cq_mask;
+   unsigned                * sq_head;
+   unsigned                * sq_tail;
+   unsigned                * cq_head;
+   unsigned                * cq_tail;
+   struct io_uring_sqe     * sqes;
+   struct io_uring_cqe     * cqes;
+   void                    * ring;
+   size_t                    ring_sz;
+   size_t                    sqes_sz;
+   struct io_uring_buf_ring * br;           // provided buffer ring
+   size_t                    br_sz;
+   uint16_t                  br_tail;
+   uint8_t                 * bufs;          // provided buffers
+   struct msghdr             recvmsg;       // multishot receive template
+   struct msghdr           * sendmsgs;      // transmit header per buffer
+   struct iovec            * sendiovs;
+   unsigned                * replies;       // buffers queued for transmit
+   useconds_t              * delays;
+   struct timespec         * stamps;        // receive timestamp per buffer
+   unsigned                * segs;          // GSO segment size per buffer
+   uint8_t                 * fmts;          // header format per segment, MY_TRAIN_SEGS per buffer
+   unsigned                * socks;         // socket index per buffer
+   size_t                  * conns;         // connection number per buffer
+   struct my_pktinfo       * dsts;          // local address per buffer
+};
+#endif
+
+
+struct my_policy
+{
+   int                     deny;       // refuse to echo
+   int                     echoplus;   // fill in echo plus v1 and v2 replies
+   int                     gemodel;    // use Gilbert-Elliott loss model
+   uint64_t                drop;
+   uint64_t                reorder;
+   uint64_t                duplicate;
+   uint64_t                corrupt;
+   uint64_t                ge_p;       // Gilbert-Elliott good to bad transition
+   uint64_t                ge_r;       // Gilbert-Elliott bad to good transition
+   uint64_t                ge_h;       // Gilbert-Elliott loss in bad state
+   uint64_t                ge_k;       // Gilbert-Elliott loss in good state
+   useconds_t              delay;
+   useconds_t              jitter;
+   unsigned                overrides;  // MY_RULE_* settings given by rule
+};
+
+
+struct my_trie_node
+{
+   uint32_t                child[2];   // node index, 0 when absent
+   int32_t                 policy;     // policy index, -1 if no prefix ends here
+};
+
+
+struct my_trie
+{
+   unsigned                len;        // nodes in use
+   unsigned                size;       // nodes allocated
+   struct my_trie_node   * nodes;      // node 0 is the root
+};
+
+
+struct my_rules
+{
+   struct my_trie          tries[2];   // IPv4 and IPv6 prefixes
+   unsigned                policies_len;
+   unsigned                policies_size;
+   struct my_policy      * policies;
+};
+
+
+struct my_delayed
+{
+   uint64_t                deadline;   // CLOCK_MONOTONIC nanoseconds
+   size_t                  conn;       // connection number of request
+   useconds_t              delay;
+   socklen_t               salen;
+   size_t                  len;
+   int                     fmt;        // header format of request
+   struct timespec         rx;         // receive timestamp of request
+   union my_sa             sa;
+   unsigned                sock;       // socket index of request
+   struct my_pktinfo       dst;        // local address of request
+   uint8_t               * buff;       // MY_DELAY_SLOT or MY_BUFF_SIZE bytes of arena
+};
+
+
+struct my_delayq
+{
+   unsigned                size;       // number of pooled packets
+   unsigned                small;      // slots of MY_DELAY_SLOT bytes, the rest hold MY_BUFF_SIZE
+   unsigned                count;      // packets waiting in heap
+   unsigned                nfree;      // small slots available in pool
+   unsigned                nlarge;     // large slots available in pool
+   unsigned              * heap;       // min-heap of pool indexes by deadline
+   unsigned              * free;       // stack of free small slot indexes
+   unsigned              * large;      // stack of free large slot indexes
+   struct my_delayed     * pool;
+   uint8_t               * arena;      // slot buffers, allocated once
+};
+
+
+struct my_flow
+{
+   uint8_t                 addr[16];
+   uint16_t                family;     // zero when slot is unused
+   uint16_t                port;
+   uint32_t                seq;        // highest echo plus sequence number
+   uint64_t                pkts;
+   uint64_t                bytes;
+   uint64_t                drops;
+   uint64_t                gaps;       // sequence numbers skipped
+   uint64_t                reorders;   // sequence numbers received late
+   uint64_t                dups;       // sequence numbers received twice
+   struct timespec         first;
+   struct timespec         last;
+};
+
+
+struct my_flows
+{
+   unsigned                size;       // number of slots (power of 2)
+   unsigned                count;      // slots in use
+   uint64_t                evictions;
+   struct my_flow        * slots;
+};
+
+
+struct my_logrec
+{
+   struct timespec         ts;
+   size_t                  conn;
+   ssize_t                 ssize;
+   useconds_t              delay;
+   uint32_t                seq;        // echo plus request sequence number
+   uint32_t                delta;      // echo plus reply time - recv time
+   uint16_t                port;
+   uint8_t                 mode;
+   uint8_t                 family;
+   uint8_t                 echoplus;
+   uint8_t                 listener;   // listener index of request
+   uint8_t                 addr[16];
+};
+
+
+struct my_logring
+{
+   _Atomic size_t          head;       // advanced by worker
+   _Atomic size_t          tail;       // advanced by logger thread
+   _Atomic uint64_t        dropped;    // records discarded on overflow
+   uint64_t                reported;   // drops already reported by logger
+   struct my_logrec        recs[MY_LOG_RING];
+};
+
+
+// pcap records of sampled packets, each a pcap_rec_hdr followed by its
+// captured bytes, which may wrap past the end of the buffer
+struct my_capring
+{
+   _Atomic size_t          head;       // bytes written by worker
+   _Atomic size_t          tail;       // bytes consumed by capture thread
+   _Atomic uint64_t        dropped;    // packets discarded on overflow
+   uint64_t                reported;   // drops already reported by capture thread
+   uint8_t                 buff[MY_CAPTURE_RING];
+};
+
+
+struct my_hist
+{
+   _Atomic uint64_t        buckets[MY_HIST_BUCKETS];
+   _Atomic uint64_t        count;
+   _Atomic uint64_t        sum;        // nanoseconds
+};
+
+
+struct my_stats
+{
+   _Atomic uint64_t        counters[MY_STAT_COUNTERS];
+   struct my_hist          hists[MY_HIST_COUNT];
+   uint8_t                 pad[64];    // keep shards on separate cache lines
+};
+
+
+#ifdef MY_PROFILE
+// log-linear histograms of clock ticks spent in each worker loop stage
+struct my_prof
+{
+   uint64_t                last;       // clock ticks at end of previous stage
+   _Atomic uint64_t        buckets[MY_PROF_STAGES][MY_PROF_BUCKETS];
+   _Atomic uint64_t        count[MY_PROF_STAGES];
+   _Atomic uint64_t        sum[MY_PROF_STAGES];
+   _Atomic uint64_t        max[MY_PROF_STAGES];
+};
+#endif
+
+
+// merged worker statistics, fields are all counters so a baseline can be
+// subtracted element by element
+struct my_totals
+{
+   uint64_t                counters[MY_STAT_COUNTERS];
+   uint64_t                listeners[MY_LISTENERS_MAX][MY_STAT_COUNTERS];
+   uint64_t                hist[MY_HIST_COUNT][MY_HIST_BUCKETS];
+   uint64_t                hist_count[MY_HIST_COUNT];
+   uint64_t                hist_sum[MY_HIST_COUNT];
+   uint64_t                log_dropped;
+};
+
+
+struct my_tsq
+{
+   uint32_t                head;       // local identifier of next transmitted reply
+   uint32_t                tail;       // oldest reply awaiting its transmit timestamp
+   uint32_t                skew;       // kernel identifier minus local identifier
+   struct timespec         rx[MY_TSQ]; // receive timestamp of each reply
+};
+
+
+struct my_sock
+{
+   int                     s;          // UDP socket
+   unsigned                listener;   // index of bound listener
+   int                     armed;      // io_uring multishot receive is armed, 2 once cancelled
+   int                     ready;      // queued on epoll ready list of worker
+   uint32_t                rxq_ovfl;   // last receive queue drop count reported by kernel
+   struct my_tsq         * tsq;        // replies awaiting transmit timestamps
+   struct my_zcq         * zcq;        // zero copy replies awaiting completion
+   _Atomic uint64_t        counters[MY_STAT_COUNTERS]; // merged per listener at scrape time
+};
+
+
+struct my_worker
 {
-   uint32_t  req_sn;
-   uint32_t  res_sn;
-   uint32_t  recv_time;
-   uint32_t  reply_time;
-   uint32_t  failures;
+   unsigned                id;         // worker index
+   struct my_sock        * socks;      // one UDP socket per listener
+   struct my_sock        * sock;       // socket of request being processed
+   int                     epfd;       // persistent epoll instance
+   unsigned                ready[MY_LISTENERS_MAX]; // sockets edge triggered epoll left with unread datagrams
+   unsigned                ready_len;
+   pthread_t               tid;
+   size_t                  conn;       // connection counter
+   uint64_t                rng[4];     // xoshiro256** state
+   int                     ge_bad;     // Gilbert-Elliott channel is in bad state
+   uint8_t                 ttl;        // TTL of request being processed, 0 if unknown
+   int                     kstamp;     // request being processed has a kernel receive timestamp
+   struct my_pktinfo       dst;        // local address of request being processed
+   struct my_logring     * log;        // connection log records
+   struct my_capring     * cap;        // sampled packets, NULL if capture is disabled
+   struct my_delayq      * delayq;     // delayed replies
+   _Atomic uint64_t        qgen;       // rules and policy generation seen at quiescent point
+   unsigned                dump_seen;  // flow dump requests serviced
+   struct my_flows       * flows;      // per client statistics
+   struct my_stats       * stats;      // counters merged at scrape time
+   struct udp_echo_stats_worker * shm; // record in statistics segment, NULL if disabled
+   uint64_t                shm_last;   // CLOCK_MONOTONIC_COARSE nanoseconds of last record update
+#ifdef MY_PROFILE
+   struct my_prof        * prof;       // per stage timings
+#endif
+#ifdef MSG_WAITFORONE
+   struct my_batch       * batch;
+#endif
+#ifdef IORING_RECV_MULTISHOT
+   struct my_uring       * uring;
+#endif
 };
 
 
@@ -144,20 +656,71 @@ struct udp_echo_plus
 /////////////////
 #pragma mark - Variables
 
-static int should_stop = 0;
+static volatile int should_stop = 0;
+static volatile int logger_stop = 0;
+static volatile int capture_stop = 0;
+static volatile int should_reload = 0;
+static volatile int should_dump = 0;
+#ifdef MY_PROFILE
+static volatile int should_profile = 0;
+static uint64_t prof_ticks = 0;         // clock ticks at startup
+static uint64_t prof_ns = 0;            // CLOCK_MONOTONIC nanoseconds at startup
+static const char * prof_names[] = { "wait", "recv", "stamp", "log", "impair", "send", "log-sent" };
+#endif
+static FILE * logfs = NULL;
 
 struct app_config
 {
    const char  * prog_name;
    const char  * pidfile;
-   uint16_t      port;         // UDP port number
-   uint16_t      echoplus;     // enable echo plus
-   int           drop_perct;   // drop percentage
+   uint16_t      port;         // UDP port number used when -p is not given
+   unsigned      ports_len;
+   uint16_t      ports[MY_PORTS_MAX]; // UDP port numbers
+   uint16_t      echoplus;     // enable echo plus, published to workers by default policy
+   uint16_t      server_id;    // echo plus v2 server identifier
+   int           mode;         // reflector protocol
+   int           gro;          // coalesce received trains and segment replies
+   size_t        zerocopy;     // smallest reply sent with zero copy, 0 disables
+   uint64_t      rate;         // target rate in bits per second for buffer sizing, 0 keeps defaults
+   unsigned      burst;        // microseconds of target rate socket buffers absorb
+   unsigned      busy_poll;    // SO_BUSY_POLL microseconds, 0 sleeps in the event engine
+   int           fifo;         // SCHED_FIFO priority of workers, 0 keeps default policy
+   unsigned      cpus_len;     // number of CPUs workers are pinned to, 0 disables pinning
+   unsigned      cpus[MY_WORKERS_MAX];
+   unsigned      batch;        // datagrams per recvmmsg()/sendmmsg()
+   unsigned      workers;      // number of worker threads
+   int           engine;       // event engine
+   uint64_t      drop;         // drop probability (2^32 fixed point)
+   uint64_t      ge_p;         // Gilbert-Elliott good to bad transition
+   uint64_t      ge_r;         // Gilbert-Elliott bad to good transition
+   uint64_t      ge_h;         // Gilbert-Elliott loss in bad state
+   uint64_t      ge_k;         // Gilbert-Elliott loss in good state
+   int           gemodel;      // use Gilbert-Elliott loss model
+   uint64_t      reorder;      // reorder probability
+   uint64_t      duplicate;    // duplicate probability
+   uint64_t      corrupt;      // corruption probability
+   useconds_t    reorder_gap;  // hold back of reordered replies
    useconds_t    delay;        // Delay range in microseconds
-   int32_t       verbose;      // runtime verbosity
+   useconds_t    jitter;       // delay jitter in microseconds
+   int           delay_dist;   // delay distribution
+   unsigned      delay_pool;   // delayed replies queued per worker
+   unsigned      flows;        // flow table slots per worker
+   int           timestamp;    // receive and transmit timestamp source
+   _Atomic int32_t verbose;    // runtime verbosity, changed at runtime by control socket
    int           facility;     // syslog facility
    int           dont_fork;
-   const char  * listen;       // IP address to listen for requests
+   unsigned      listen_len;   // number of addresses, 0 listens on all
+   const char  * listen[MY_LISTEN_MAX]; // IP addresses to listen for requests
+   const char  * logfile;      // write connection log to file
+   const char  * rules;        // per prefix policy rule file
+   const char  * metrics;      // metrics listener
+   const char  * control;      // UNIX control socket path
+   int           takeover;     // take sockets over from running instance
+   const char  * shm;          // shared memory statistics segment
+   const char  * journal;      // binary packet journal
+   unsigned      journal_mb;   // journal size in megabytes
+   const char  * capture;      // pcap file of sampled packets
+   _Atomic unsigned capture_sample; // capture one of every N requests, changed at runtime by control socket
    uid_t         uid;          // setuid
    gid_t         gid;          // setgid
 };
@@ -166,16 +729,85 @@ static struct app_config cnf =
    .prog_name    = "a.out",
    .pidfile      = "/var/run/" PROGRAM_NAME ".pid",
    .port         = 30006,
+   .ports_len    = 0,
    .echoplus     = 0,
-   .drop_perct   = 0,
+   .server_id    = 0,
+   .mode         = MY_MODE_ECHO,
+   .gro          = 0,
+   .zerocopy     = 0,
+   .rate         = 0,
+   .burst        = MY_BURST,
+   .busy_poll    = 0,
+   .fifo         = 0,
+   .cpus_len     = 0,
+   .batch        = 1,
+   .workers      = 1,
+   .engine       = MY_ENGINE_DEFAULT,
+   .drop         = 0,
+   .ge_p         = 0,
+   .ge_r         = 0,
+   .ge_h         = 0,
+   .ge_k         = 0,
+   .gemodel      = 0,
+   .reorder      = 0,
+   .duplicate    = 0,
+   .corrupt      = 0,
+   .reorder_gap  = MY_REORDER_GAP,
    .delay        = 0,
+   .jitter       = 0,
+   .delay_dist   = MY_DIST_UNIFORM,
+   .delay_pool   = MY_DELAY_POOL,
+   .flows        = MY_FLOWS,
+   .timestamp    = MY_TS_NONE,
    .verbose      = 0,
    .facility     = LOG_DAEMON,
    .dont_fork    = 0,
-   .listen       = NULL,
+   .listen_len   = 0,
+   .logfile      = NULL,
+   .rules        = NULL,
+   .metrics      = NULL,
+   .control      = NULL,
+   .takeover     = 0,
+   .shm          = NULL,
+   .journal      = NULL,
+   .journal_mb   = MY_JOURNAL_MB,
+   .capture      = NULL,
+   .capture_sample = 1,
    .uid          = 0,
    .gid          = 0,
 };
+static struct my_worker * workers = NULL;
+static struct my_listener listeners[MY_LISTENERS_MAX];
+static unsigned listeners_len = 0;
+static const char * engine_names[] = { "poll", "uring", "epoll" };
+static const char * dist_names[] = { "uniform", "normal", "pareto" };
+static const char * ts_names[] = { "none", "software", "hardware" };
+static const char * mode_names[] = { "echo", "stamp" };
+static _Atomic uint16_t stamp_error = 0;
+static _Atomic(struct my_policy *) policy = NULL;
+static struct my_policy * policy_retired = NULL;
+static _Atomic(struct my_rules *) rules = NULL;
+static _Atomic uint64_t rules_gen = 0;
+static struct my_rules * rules_retired = NULL;
+static _Atomic unsigned flows_dump = 0;
+static int metrics_s = -1;
+static const char * metrics_path = NULL;
+static int control_s = -1;
+static const char * control_path = NULL;
+static int takeover_s = -1;
+static volatile int handed_over = 0;
+static int * handoff_fds = NULL;
+static unsigned handoff_len = 0;
+static struct udp_echo_stats * shm = NULL;
+static size_t shm_size = 0;
+static const char * shm_path = NULL;
+static struct udp_echo_journal * journal = NULL;
+static size_t journal_size = 0;
+static int journal_fd = -1;
+static FILE * capture_fs = NULL;
+static char * metrics_buff = NULL;
+static size_t metrics_size = 0;
+static struct my_totals stats_base;
 
 
 //////////////////
@@ -188,32 +820,376 @@ static struct app_config cnf =
 // main statement
 int main(int argc, char * argv[]);
 
+#ifdef MSG_WAITFORONE
+// allocate buffers for batched I/O
+struct my_batch * my_batch_alloc(unsigned size);
+
+// free buffers for batched I/O
+void my_batch_free(struct my_batch * bp);
+#endif
+
+// determine if any feature requires ancillary data from received datagrams
+int my_cmsg_enabled(void);
+
+// close worker sockets
+void my_close_sockets(void);
+
+// hand sockets to new instance, then drain and stop once it runs
+void my_control_handoff(int c);
+
+// create UNIX control socket
+int my_control_open(const char * path);
+
+// execute control command, returns -1 when the connection is done
+int my_control_cmd(int c, char * line);
+
+// send formatted reply to control connection
+void my_control_reply(int c, const char * fmt, ...);
+
+// serve control connection
+void my_control_serve(void);
+
+// send takeover record with attached sockets
+int my_control_sendfds(int c, const int * fds, unsigned count);
+
+// change runtime setting, returns NULL or reason the value was rejected
+const char * my_control_set(const char * name, const char * val);
+
+// report runtime settings
+void my_control_show(int c);
+
+// free worker resources
+void my_free_workers(void);
+
 // daemonize process
 int my_daemonize(void);
 
 // display debug message
 void my_debug(const char * fmt, ...);
 
+// allocate delayed reply scheduler
+struct my_delayq * my_delay_alloc(unsigned size);
+
+// determine if any impairment requires the delayed reply scheduler
+int my_delay_enabled(void);
+
+// read monotonic clock in nanoseconds
+uint64_t my_delay_clock(void);
+
+// free delayed reply scheduler
+void my_delay_free(struct my_delayq * dq);
+
+// copy request into packet pool and schedule reply
+int my_delay_push(struct my_worker * wp, union my_sa * sap,
+   struct udp_echo_plus * msgp, ssize_t ssize, int fmt, struct timespec * tsp,
+   useconds_t delay);
+
+// transmit expired replies, returns milliseconds until next deadline
+int my_delay_run(struct my_worker * wp, int timeout);
+
 // display error message
 void my_error(const char * fmt, ...);
 
-// log connection
-int my_log_conn(int mode, size_t * connp, union my_sa * sap,
-   struct udp_echo_plus * msgp, ssize_t ssize, struct timespec * tsp,
+// allocate flow table
+struct my_flows * my_flow_alloc(unsigned size);
+
+// log contents of worker's flow table
+void my_flow_dump(struct my_worker * wp);
+
+// free flow table
+void my_flow_free(struct my_flows * ft);
+
+// find or create flow of source address
+struct my_flow * my_flow_lookup(struct my_worker * wp, union my_sa * sap, struct timespec * tsp);
+
+// update flow statistics of received request
+void my_flow_update(struct my_flow * fp, struct udp_echo_plus * msgp, ssize_t ssize, int fmt, struct timespec * tsp);
+
+// record elapsed time in log2 histogram
+void my_hist_add(struct my_hist * hp, const struct timespec * start,
+   const struct timespec * end, unsigned count);
+
+// compute reply delay from configured distribution
+useconds_t my_impair_delay(struct my_worker * wp, const struct my_policy * pol);
+
+// determine if packet is lost, returns 1 when packet should be dropped
+int my_impair_loss(struct my_worker * wp, const struct my_policy * pol);
+
+// copy sampled packet with synthesized IP and UDP headers for capture thread
+int my_capture(struct my_worker * wp, int mode, const union my_sa * sap,
+   const uint8_t * data, ssize_t ssize, const struct timespec * tsp);
+
+// copy bytes into capture ring, wrapping past the end of the buffer
+void my_capture_copy(struct my_capring * ring, size_t pos, const void * src, size_t len);
+
+// capture thread
+void * my_capture_main(void * arg);
+
+// create pcap file, returns -1 on error
+int my_capture_open(const char * path);
+
+// add 16 bit words to one's complement sum, odd trailing byte is padded with zero
+uint64_t my_ip_sum(uint64_t sum, const uint8_t * data, size_t len);
+
+// fold one's complement sum into IP checksum
+uint16_t my_ip_sum_fold(uint64_t sum);
+
+// queue connection log record for logger thread
+int my_log_conn(struct my_worker * wp, int mode, union my_sa * sap,
+   struct udp_echo_plus * msgp, ssize_t ssize, int fmt, struct timespec * tsp,
    useconds_t delay);
 
+// format connection log record
+void my_log_format(struct my_logrec * rec);
+
+// open or create packet journal, returns -1 on error
+int my_journal_open(const char * path, unsigned mb);
+
+// append connection log record to packet journal
+void my_journal_write(const struct my_logrec * rec, unsigned worker);
+
+// write log message to syslog or log file
+void my_log_write(int priority, const char * fmt, ...);
+
+// logger thread
+void * my_logger_main(void * arg);
+
+// process received echo request
+int my_echo(struct my_worker * wp, union my_sa * sap, struct udp_echo_plus * msgp,
+   ssize_t ssize, struct timespec * tsp, useconds_t * delayp, uint8_t * fmtp);
+
+// set echo plus reply timestamp of each segment immediately before transmit
+void my_echo_reply_time(struct udp_echo_plus * msgp, ssize_t ssize, size_t seg,
+   const uint8_t * fmts, const struct timespec * tsp);
+
+// echo each segment of GRO coalesced datagram, compacting surviving replies
+int my_echo_train(struct my_worker * wp, union my_sa * sap, uint8_t * buff,
+   ssize_t * sizep, size_t seg, struct timespec * tsp, useconds_t * delayp,
+   uint8_t * fmts);
+
+// determine header format of request, returns MY_FMT_NONE if echoed unmodified
+int my_echo_format(struct udp_echo_plus * msgp, ssize_t ssize, int echoplus);
+
+#ifdef EPOLLET
+// register socket with worker's epoll instance
+int my_epoll_add(struct my_worker * wp, struct my_sock * sp, uint32_t events);
+
+// initialize epoll engine
+int my_epoll_init(struct my_worker * wp);
+#endif
+
+// extract GRO segment size from ancillary data, returns 0 if not coalesced
+size_t my_gro_rx(struct msghdr * hdr);
+
+// resolve listen addresses and ports into listeners
+int my_listeners_init(void);
+
+// log each segment of reply train
+void my_log_train(struct my_worker * wp, int mode, union my_sa * sap,
+   uint8_t * buff, ssize_t ssize, size_t seg, const uint8_t * fmts,
+   struct timespec * tsp, useconds_t delay);
+
 // main loop
-int my_loop(int s, size_t * connp);
+int my_loop(struct my_worker * wp);
+
+// main loop spinning on non-blocking receives
+int my_loop_busy(struct my_worker * wp);
+
+// create metrics listener on address:port or UNIX socket path
+int my_metrics_open(const char * spec);
+
+// serve metrics request
+void my_metrics_serve(void);
+
+// merge worker statistics into Prometheus text format
+ssize_t my_metrics_render(char * buff, size_t size);
+
+#ifdef EPOLLET
+// main loop using edge triggered epoll
+int my_loop_epoll(struct my_worker * wp);
+#endif
+
+// parse CPU list such as 0,2,4-7 into worker CPU assignments
+int my_parse_cpus(const char * str);
+
+// parse probability in percent to fixed point threshold
+int my_parse_prob(const char * str, uint64_t * threshp, char ** endp);
+
+// extract local address of request from ancillary data
+void my_pktinfo_rx(struct msghdr * hdr, struct my_pktinfo * pip);
+
+// remove PID file unless a newer instance has replaced it
+void my_pidfile_release(void);
+
+// initialize policy from global impairment settings
+void my_policy_init(struct my_policy * pol);
+
+// publish default policy from global impairment settings, together with
+// rules resolved against it
+int my_policy_publish(void);
+
+#ifdef MY_PROFILE
+// read cycle counter, or CLOCK_MONOTONIC nanoseconds where none is available
+uint64_t my_prof_clock(void);
+
+// log per stage timings merged over all workers
+void my_prof_dump(void);
+
+// record ticks since previous stage ended
+void my_prof_mark(struct my_worker * wp, unsigned stage);
+#endif
+
+// wait for every worker to pass a quiescent point, returns -1 if workers stop first
+int my_quiesce_wait(void);
+
+// xoshiro256** pseudo random number generator
+uint64_t my_rand(struct my_worker * wp);
+
+// returns 1 with probability of threshold / 2^32
+int my_rand_chance(struct my_worker * wp, uint64_t thresh);
+
+// seed generator state using splitmix64
+void my_rand_seed(struct my_worker * wp, uint64_t seed);
+
+// returns uniform double in the open interval (0, 1)
+double my_rand_unit(struct my_worker * wp);
+
+// receive and echo one datagram
+int my_recv(struct my_worker * wp, struct my_sock * sp);
+
+#ifdef MSG_WAITFORONE
+// receive and echo one batch of datagrams
+int my_recv_batch(struct my_worker * wp, struct my_sock * sp);
+#endif
+
+// set reply source address, and UDP_SEGMENT if reply train holds more than one segment
+void my_reply_ctrl(struct msghdr * hdr, void * ctrl, const struct my_pktinfo * pip,
+   size_t seg, ssize_t ssize);
+
+// free compiled rules
+void my_rules_free(struct my_rules * rp);
+
+// add prefix to trie
+int my_rules_insert(struct my_trie * tp, const uint8_t * addr, unsigned plen, int32_t pol_idx);
+
+// copy compiled rules, resolving settings they do not override against the defaults
+struct my_rules * my_rules_inherit(const struct my_rules * rp);
+
+// compile rule file into prefix tries
+struct my_rules * my_rules_load(const char * file, char * err, size_t errlen);
+
+// find policy of longest matching prefix, returns NULL if no prefix matches
+const struct my_policy * my_rules_lookup(const struct my_rules * rp, const union my_sa * sap);
+
+// reload rule file and retire previous rules once workers are quiescent
+int my_rules_reload(void);
 
 // signal handler
 void my_sighandler(int signum);
 
+// account requests the kernel dropped from the socket receive queue
+void my_rxq_ovfl(struct my_worker * wp, struct msghdr * hdr);
+
+// log growth of kernel receive queue drops of each listener
+void my_rxq_report(void);
+
+// set socket buffer, exceeding system limits when privileged, returns size applied by kernel
+int my_sockbuf(int s, int opt, int opt_force, size_t size);
+
+// compare socket addresses
+int my_sa_equal(const union my_sa * a, const union my_sa * b);
+
+// wait up to timeout milliseconds for metrics and control connections
+void my_service_poll(int timeout);
+
+// create shared memory statistics segment, returns -1 on error
+int my_shm_open(const char * path);
+
+// copy worker statistics into its segment record, at most every MY_SHM_INTERVAL unless forced
+void my_shm_publish(struct my_worker * wp, int force);
+
+// create and bind UDP socket
+int my_socket(union my_sa * sap, socklen_t socklen);
+
+// apply configured socket options, disabled features are switched off
+int my_socket_opts(int s, int family);
+
+// sum statistics of all workers
+void my_stats_merge(struct my_totals * tp);
+
+// account transmitted reply or send error
+void my_stats_sent(struct my_worker * wp, ssize_t ssize, size_t seg, const struct timespec * rxp);
+
+// read transmit timestamps and zero copy completions from socket error queues
+void my_errqueue_drain(struct my_worker * wp);
+
+// set receive and transmit timestamps on socket, disabled unless configured
+int my_ts_enable(int s);
+
+// extract receive timestamp from ancillary data, returns -1 if none present
+int my_ts_rx(struct msghdr * hdr, struct timespec * tsp);
+
+// remember receive timestamp of reply until its transmit timestamp arrives
+void my_ts_sent(struct my_worker * wp, const struct timespec * rxp);
+
+// extract TTL or hop limit from ancillary data, returns 0 if none present
+uint8_t my_ttl_rx(struct msghdr * hdr);
+
+// receive sockets from running instance, returns 1 if none is running
+int my_takeover(void);
+
+// claim socket taken over from previous instance bound to address, returns -1 if none
+int my_takeover_claim(const union my_sa * sap);
+
+// tell previous instance the new workers are running
+void my_takeover_ready(void);
+
 // display program usage
 void my_usage(void);
 
 // display program usage error
 void my_usage_error(const char * fmt, ...);
 
+#ifdef IORING_RECV_MULTISHOT
+// submit queued requests and optionally wait for a completion
+int my_uring_enter(struct my_uring * ur, int wait_ms);
+
+// release io_uring engine
+void my_uring_free(struct my_worker * wp);
+
+// initialize io_uring engine
+int my_uring_init(struct my_worker * wp);
+
+// main loop using io_uring
+int my_loop_uring(struct my_worker * wp);
+
+// return provided buffer to kernel
+void my_uring_recycle(struct my_uring * ur, unsigned bid);
+
+// retrieve next free submission queue entry
+struct io_uring_sqe * my_uring_sqe(struct my_uring * ur);
+#endif
+
+// worker thread
+void * my_worker_main(void * arg);
+
+// mark worker idle while blocked waiting for events
+void my_worker_idle(struct my_worker * wp);
+
+// mark worker quiescent and service requests from the main thread
+void my_worker_quiesce(struct my_worker * wp);
+
+// pin worker to its CPU and apply real time scheduling
+int my_worker_sched(struct my_worker * wp);
+
+#ifdef MSG_WAITFORONE
+// release buffer slots of completed zero copy transmits
+void my_zc_complete(struct my_worker * wp, struct my_sock * sp, uint32_t lo, uint32_t hi, int copied);
+
+// reserve slot replacing the buffer of a zero copy reply, returns MY_ZC_NONE if unavailable
+unsigned my_zc_reserve(struct my_zcpool * zc, struct my_zcq * zq, unsigned ahead);
+#endif
+
 
 /////////////////
 //             //
@@ -226,33 +1202,74 @@ void my_usage_error(const char * fmt, ...);
 int main(int argc, char * argv[])
 {
    char                    * ptr;
+   char                    * end;
    int                       c;
-   int                       s;
+   int                       rc;
    unsigned                  seed;
+   unsigned                  pos;
+   unsigned                  idx;
+   unsigned                  started;
+   unsigned long             ul;
+   double                    dbl;
    struct timespec           ts;
-   size_t                    conn;
    int                       opt_index;
    struct passwd           * pw;
    struct group            * gr;
+   sigset_t                  sigs;
+   sigset_t                  oldsigs;
+   pthread_t                 logger;
+   pthread_t                 capturer;
+   char                      errbuff[256];
+   struct my_rules         * rp;
 
    // getopt options
-   static char   short_opt[] = "d:D:efg:hl:np:P:ru:vV";
+   static char   short_opt[] = "b:d:D:eE:fg:hj:l:L:np:P:q:rR:t:u:vVw:";
    static struct option long_opt[] =
    {
+      {"batch",         required_argument, 0, 'b'},
       {"drop",          required_argument, 0, 'd'},
       {"delay",         required_argument, 0, 'D'},
       {"echoplus",      no_argument,       0, 'e'},
+      {"engine",        required_argument, 0, 'E'},
       {"facility",      required_argument, 0, 'f'},
       {"group",         required_argument, 0, 'g'},
       {"help",          no_argument,       0, 'h'},
+      {"jitter",        required_argument, 0, 'j'},
       {"listen",        required_argument, 0, 'l'},
+      {"logfile",       required_argument, 0, 'L'},
       {"foreground",    no_argument,       0, 'n'},
       {"port",          required_argument, 0, 'p'},
       {"pidfile",       required_argument, 0, 'P'},
+      {"delay-pool",    required_argument, 0, 'q'},
       {"rfc",           no_argument,       0, 'r'},
+      {"rules",         required_argument, 0, 'R'},
+      {"timestamp",     required_argument, 0, 't'},
       {"user",          required_argument, 0, 'u'},
       {"verbose",       no_argument,       0, 'v'},
       {"version",       no_argument,       0, 'V'},
+      {"workers",       required_argument, 0, 'w'},
+      {"delay-dist",    required_argument, 0, MY_OPT_DELAY_DIST},
+      {"loss-ge",       required_argument, 0, MY_OPT_LOSS_GE},
+      {"reorder",       required_argument, 0, MY_OPT_REORDER},
+      {"duplicate",     required_argument, 0, MY_OPT_DUPLICATE},
+      {"corrupt",       required_argument, 0, MY_OPT_CORRUPT},
+      {"flows",         required_argument, 0, MY_OPT_FLOWS},
+      {"metrics",       required_argument, 0, MY_OPT_METRICS},
+      {"server-id",     required_argument, 0, MY_OPT_SERVER_ID},
+      {"mode",          required_argument, 0, MY_OPT_MODE},
+      {"gro",           no_argument,       0, MY_OPT_GRO},
+      {"zerocopy",      required_argument, 0, MY_OPT_ZEROCOPY},
+      {"rate",          required_argument, 0, MY_OPT_RATE},
+      {"burst",         required_argument, 0, MY_OPT_BURST},
+      {"busy-poll",     required_argument, 0, MY_OPT_BUSY_POLL},
+      {"cpus",          required_argument, 0, MY_OPT_CPUS},
+      {"fifo",          required_argument, 0, MY_OPT_FIFO},
+      {"control",       required_argument, 0, MY_OPT_CONTROL},
+      {"takeover",      no_argument,       0, MY_OPT_TAKEOVER},
+      {"shm",           required_argument, 0, MY_OPT_SHM},
+      {"journal",       required_argument, 0, MY_OPT_JOURNAL},
+      {"capture",       required_argument, 0, MY_OPT_CAPTURE},
+      {"capture-sample",required_argument, 0, MY_OPT_CAPTURE_SAMPLE},
       {NULL,            0,                 0, 0  }
    };
 
@@ -271,9 +1288,24 @@ int main(int argc, char * argv[])
          case 0:        // long options toggles
          break;
 
+         case 'b':
+         cnf.batch = (unsigned)strtoul(optarg, NULL, 10);
+         if ((cnf.batch < 1) || (cnf.batch > MY_BATCH_MAX))
+         {
+            my_usage_error("invalid value for `-b'");
+            return(1);
+         };
+#ifndef MSG_WAITFORONE
+         if (cnf.batch > 1)
+         {
+            my_usage_error("batched I/O is not supported on this platform");
+            return(1);
+         };
+#endif
+         break;
+
          case 'd':
-         cnf.drop_perct = atoi(optarg);
-         if ((cnf.drop_perct < 0) || (cnf.drop_perct > 99))
+         if (my_parse_prob(optarg, &cnf.drop, NULL) == -1)
          {
             my_usage_error("invalid value for `-d'");
             return(1);
@@ -281,17 +1313,36 @@ int main(int argc, char * argv[])
          break;
 
          case 'D':
-         cnf.delay = (useconds_t)atoll(optarg);
+         ul = strtoul(optarg, &ptr, 10);
+         if ( (ptr[0] != '\0') || (ul > MY_DELAY_MAX) )
+         {
+            my_usage_error("invalid value for `-D'");
+            return(1);
+         };
+         cnf.delay = (useconds_t)ul;
          break;
 
          case 'e':
          cnf.echoplus = 1;
          break;
 
-         case 'f':
-         if      (!(strcasecmp(optarg, "auth")))   { cnf.facility = LOG_AUTH; }
-         else if (!(strcasecmp(optarg, "cron")))   { cnf.facility = LOG_CRON; }
-         else if (!(strcasecmp(optarg, "daemon"))) { cnf.facility = LOG_DAEMON; }
+         case 'E':
+         if      (!(strcasecmp(optarg, "poll")))  { cnf.engine = MY_ENGINE_POLL; }
+         else if (!(strcasecmp(optarg, "uring"))) { cnf.engine = MY_ENGINE_URING; }
+#ifdef EPOLLET
+         else if (!(strcasecmp(optarg, "epoll"))) { cnf.engine = MY_ENGINE_EPOLL; }
+#endif
+         else
+         {
+            my_usage_error("invalid or unsupported event engine -- `%s'", optarg);
+            return(1);
+         };
+         break;
+
+         case 'f':
+         if      (!(strcasecmp(optarg, "auth")))   { cnf.facility = LOG_AUTH; }
+         else if (!(strcasecmp(optarg, "cron")))   { cnf.facility = LOG_CRON; }
+         else if (!(strcasecmp(optarg, "daemon"))) { cnf.facility = LOG_DAEMON; }
          else if (!(strcasecmp(optarg, "ftp")))    { cnf.facility = LOG_FTP; }
          else if (!(strcasecmp(optarg, "local0"))) { cnf.facility = LOG_LOCAL0; }
          else if (!(strcasecmp(optarg, "local1"))) { cnf.facility = LOG_LOCAL1; }
@@ -330,8 +1381,26 @@ int main(int argc, char * argv[])
          my_usage();
          return(0);
 
+         case 'j':
+         cnf.jitter = (useconds_t)strtoul(optarg, NULL, 10);
+         if (cnf.jitter > MY_DELAY_MAX)
+         {
+            my_usage_error("invalid value for `-j'");
+            return(1);
+         };
+         break;
+
          case 'l':
-         cnf.listen = optarg;
+         if (cnf.listen_len >= MY_LISTEN_MAX)
+         {
+            my_usage_error("too many addresses specified with `-l'");
+            return(1);
+         };
+         cnf.listen[cnf.listen_len++] = optarg;
+         break;
+
+         case 'L':
+         cnf.logfile = optarg;
          break;
 
          case 'n':
@@ -339,17 +1408,50 @@ int main(int argc, char * argv[])
          break;
 
          case 'p':
-         cnf.port = (uint16_t)(atoi(optarg) & 0xffff);
+         if (cnf.ports_len >= MY_PORTS_MAX)
+         {
+            my_usage_error("too many ports specified with `-p'");
+            return(1);
+         };
+         cnf.ports[cnf.ports_len++] = (uint16_t)(atoi(optarg) & 0xffff);
          break;
 
          case 'P':
          cnf.pidfile = optarg;
          break;
 
+         case 'q':
+         cnf.delay_pool = (unsigned)strtoul(optarg, NULL, 10);
+         if ((cnf.delay_pool < 1) || (cnf.delay_pool > MY_DELAY_POOL_MAX))
+         {
+            my_usage_error("invalid value for `-q'");
+            return(1);
+         };
+         break;
+
          case 'r':
          cnf.echoplus = 0;
          break;
 
+         case 'R':
+         cnf.rules = optarg;
+         break;
+
+         case 't':
+         if      (!(strcasecmp(optarg, "none")))     { cnf.timestamp = MY_TS_NONE; }
+#if defined(SO_TIMESTAMPING) || defined(SO_TIMESTAMPNS)
+         else if (!(strcasecmp(optarg, "software"))) { cnf.timestamp = MY_TS_SOFTWARE; }
+#endif
+#ifdef SO_TIMESTAMPING
+         else if (!(strcasecmp(optarg, "hardware"))) { cnf.timestamp = MY_TS_HARDWARE; }
+#endif
+         else
+         {
+            my_usage_error("invalid or unsupported timestamp source -- `%s'", optarg);
+            return(1);
+         };
+         break;
+
          case 'u':
          errno = 0;
          if ((pw = getpwnam(optarg)) == NULL)
@@ -371,6 +1473,248 @@ int main(int argc, char * argv[])
          printf("%s (%s) %s\n", cnf.prog_name, PACKAGE_NAME, PACKAGE_VERSION);
          return(0);
 
+         case 'w':
+         cnf.workers = (unsigned)strtoul(optarg, NULL, 10);
+         if ((cnf.workers < 1) || (cnf.workers > MY_WORKERS_MAX))
+         {
+            my_usage_error("invalid value for `-w'");
+            return(1);
+         };
+#ifndef SO_REUSEPORT
+         if (cnf.workers > 1)
+         {
+            my_usage_error("multiple workers require SO_REUSEPORT");
+            return(1);
+         };
+#endif
+         break;
+
+         case MY_OPT_DELAY_DIST:
+         if      (!(strcasecmp(optarg, "uniform"))) { cnf.delay_dist = MY_DIST_UNIFORM; }
+         else if (!(strcasecmp(optarg, "normal")))  { cnf.delay_dist = MY_DIST_NORMAL; }
+         else if (!(strcasecmp(optarg, "pareto")))  { cnf.delay_dist = MY_DIST_PARETO; }
+         else
+         {
+            my_usage_error("invalid or unsupported delay distribution -- `%s'", optarg);
+            return(1);
+         };
+         break;
+
+         case MY_OPT_LOSS_GE:
+         cnf.gemodel = 1;
+         cnf.ge_h    = 4294967296ULL;
+         cnf.ge_k    = 0;
+         if ( (my_parse_prob(optarg, &cnf.ge_p, &ptr) == -1) || (ptr[0] != ',') ||
+              (my_parse_prob(&ptr[1], &cnf.ge_r, &ptr) == -1) ||
+              ( (ptr[0] == ',') && (my_parse_prob(&ptr[1], &cnf.ge_h, &ptr) == -1) ) ||
+              ( (ptr[0] == ',') && (my_parse_prob(&ptr[1], &cnf.ge_k, &ptr) == -1) ) ||
+              (ptr[0] != '\0') )
+         {
+            my_usage_error("invalid value for `--loss-ge'");
+            return(1);
+         };
+         break;
+
+         case MY_OPT_REORDER:
+         if ( (my_parse_prob(optarg, &cnf.reorder, &ptr) == -1) ||
+              ( (ptr[0] != '\0') && (ptr[0] != ',') ) )
+         {
+            my_usage_error("invalid value for `--reorder'");
+            return(1);
+         };
+         if (ptr[0] == ',')
+            cnf.reorder_gap = (useconds_t)strtoul(&ptr[1], NULL, 10);
+         if ((cnf.reorder_gap < 1) || (cnf.reorder_gap > MY_DELAY_MAX))
+         {
+            my_usage_error("invalid value for `--reorder'");
+            return(1);
+         };
+         break;
+
+         case MY_OPT_DUPLICATE:
+         if (my_parse_prob(optarg, &cnf.duplicate, NULL) == -1)
+         {
+            my_usage_error("invalid value for `--duplicate'");
+            return(1);
+         };
+         break;
+
+         case MY_OPT_FLOWS:
+         cnf.flows = (unsigned)strtoul(optarg, &ptr, 10);
+         if ( (ptr[0] != '\0') || (cnf.flows > MY_FLOWS_MAX) ||
+              ( (cnf.flows > 0) && (cnf.flows < MY_FLOW_PROBE) ) )
+         {
+            my_usage_error("invalid value for `--flows'");
+            return(1);
+         };
+         // round up to power of 2
+         for(pos = MY_FLOW_PROBE; ( (cnf.flows > 0) && (pos < cnf.flows) ); pos <<= 1);
+         cnf.flows = ((cnf.flows)) ? pos : 0;
+         break;
+
+         case MY_OPT_METRICS:
+         cnf.metrics = optarg;
+         break;
+
+         case MY_OPT_SERVER_ID:
+         ul = strtoul(optarg, &ptr, 0);
+         if ( (ptr[0] != '\0') || (ul > 0xffff) )
+         {
+            my_usage_error("invalid value for `--server-id'");
+            return(1);
+         };
+         cnf.server_id = (uint16_t)ul;
+         break;
+
+         case MY_OPT_GRO:
+#if defined(UDP_GRO) && defined(UDP_SEGMENT)
+         cnf.gro = 1;
+         break;
+#else
+         my_usage_error("UDP GRO/GSO is not supported on this platform");
+         return(1);
+#endif
+
+         case MY_OPT_ZEROCOPY:
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && defined(MSG_WAITFORONE)
+         ul = strtoul(optarg, &ptr, 10);
+         if ( (ptr[0] != '\0') || (ul < 1) || (ul > MY_BUFF_SIZE) )
+         {
+            my_usage_error("invalid value for `--zerocopy'");
+            return(1);
+         };
+         cnf.zerocopy = (size_t)ul;
+         break;
+#else
+         my_usage_error("zero copy transmit is not supported on this platform");
+         return(1);
+#endif
+
+         case MY_OPT_RATE:
+         dbl = strtod(optarg, &ptr);
+         switch(ptr[0])
+         {
+            case 'k': case 'K': dbl *= 1e3; ptr++; break;
+            case 'm': case 'M': dbl *= 1e6; ptr++; break;
+            case 'g': case 'G': dbl *= 1e9; ptr++; break;
+            default: break;
+         };
+         if ( (ptr[0] != '\0') || (!(dbl >= 0.0)) || (dbl > 1e12) )
+         {
+            my_usage_error("invalid value for `--rate'");
+            return(1);
+         };
+         cnf.rate = (uint64_t)dbl;
+         break;
+
+         case MY_OPT_BURST:
+         ul = strtoul(optarg, &ptr, 10);
+         if ( (ptr[0] != '\0') || (ul < 1) || (ul > MY_DELAY_MAX) )
+         {
+            my_usage_error("invalid value for `--burst'");
+            return(1);
+         };
+         cnf.burst = (unsigned)ul;
+         break;
+
+         case MY_OPT_BUSY_POLL:
+#ifdef SO_BUSY_POLL
+         ul = strtoul(optarg, &ptr, 10);
+         if ( (ptr[0] != '\0') || (ul < 1) || (ul > INT_MAX) )
+         {
+            my_usage_error("invalid value for `--busy-poll'");
+            return(1);
+         };
+         cnf.busy_poll = (unsigned)ul;
+         break;
+#else
+         my_usage_error("busy polling is not supported on this platform");
+         return(1);
+#endif
+
+         case MY_OPT_CPUS:
+         if (my_parse_cpus(optarg) == -1)
+         {
+            my_usage_error("invalid CPU list -- `%s'", optarg);
+            return(1);
+         };
+         break;
+
+         case MY_OPT_FIFO:
+         ul = strtoul(optarg, &ptr, 10);
+         if ( (ptr[0] != '\0') || ((int)ul < sched_get_priority_min(SCHED_FIFO)) || ((int)ul > sched_get_priority_max(SCHED_FIFO)) )
+         {
+            my_usage_error("invalid value for `--fifo'");
+            return(1);
+         };
+         cnf.fifo = (int)ul;
+         break;
+
+         case MY_OPT_CONTROL:
+         cnf.control = optarg;
+         break;
+
+         case MY_OPT_TAKEOVER:
+         cnf.takeover = 1;
+         break;
+
+         case MY_OPT_SHM:
+         cnf.shm = optarg;
+         break;
+
+         case MY_OPT_JOURNAL:
+         cnf.journal = optarg;
+         if ((ptr = strrchr(optarg, ',')) != NULL)
+         {
+            ul = strtoul(&ptr[1], &end, 10);
+            if ( (ptr[1] == '\0') || (end[0] != '\0') || (ul < 1) || (ul > MY_JOURNAL_MB_MAX) )
+            {
+               my_usage_error("invalid value for `--journal'");
+               return(1);
+            };
+            cnf.journal_mb = (unsigned)ul;
+            ptr[0]         = '\0';
+         };
+         if (!(cnf.journal[0]))
+         {
+            my_usage_error("invalid value for `--journal'");
+            return(1);
+         };
+         break;
+
+         case MY_OPT_CAPTURE:
+         cnf.capture = optarg;
+         break;
+
+         case MY_OPT_CAPTURE_SAMPLE:
+         ptr = (!(strncmp(optarg, "1/", 2))) ? &optarg[2] : optarg;
+         ul  = strtoul(ptr, &end, 10);
+         if ( (ptr[0] == '\0') || (end[0] != '\0') || (ul < 1) || (ul > UINT32_MAX) )
+         {
+            my_usage_error("invalid value for `--capture-sample'");
+            return(1);
+         };
+         cnf.capture_sample = (unsigned)ul;
+         break;
+
+         case MY_OPT_MODE:
+         if      (!(strcasecmp(optarg, "echo")))  { cnf.mode = MY_MODE_ECHO; }
+         else if (!(strcasecmp(optarg, "stamp"))) { cnf.mode = MY_MODE_STAMP; }
+         else
+         {
+            my_usage_error("invalid or unsupported reflector mode -- `%s'", optarg);
+            return(1);
+         };
+         break;
+
+         case MY_OPT_CORRUPT:
+         if (my_parse_prob(optarg, &cnf.corrupt, NULL) == -1)
+         {
+            my_usage_error("invalid value for `--corrupt'");
+            return(1);
+         };
+         break;
+
          case '?':
          fprintf(stderr, "Try `%s --help' for more information.\n", cnf.prog_name);
          return(1);
@@ -381,6 +1725,17 @@ int main(int argc, char * argv[])
       };
    };
 
+   // STAMP reflectors listen on the well known port unless told otherwise
+   if (cnf.mode == MY_MODE_STAMP)
+      cnf.port = STAMP_PORT;
+   if (!(cnf.ports_len))
+      cnf.ports[cnf.ports_len++] = cnf.port;
+   if ((cnf.listen_len * cnf.ports_len) > MY_LISTENERS_MAX)
+   {
+      my_usage_error("more than %u address and port combinations", MY_LISTENERS_MAX);
+      return(1);
+   };
+
    // set defaults for setuid/setgid
    cnf.gid = (cnf.gid == 0) ? getgid() : cnf.gid;
    cnf.uid = (cnf.uid == 0) ? getuid() : cnf.uid;
@@ -395,13 +1750,109 @@ int main(int argc, char * argv[])
       return(1);
    };
 
+   // compile per prefix rules
+   if (my_policy_publish() == -1)
+   {
+      fprintf(stderr, "%s: out of virtual memory\n", cnf.prog_name);
+      return(1);
+   };
+   if ((cnf.rules))
+   {
+      if ((rp = my_rules_load(cnf.rules, errbuff, sizeof(errbuff))) == NULL)
+      {
+         my_error("%s", errbuff);
+         return(1);
+      };
+      atomic_store(&rules, rp);
+   };
+
+   // takeover connects to the control socket of the running instance
+   if ( ((cnf.takeover)) && (!(cnf.control)) )
+   {
+      my_usage_error("`--takeover' requires `--control'");
+      return(1);
+   };
+
+   // resolve listen addresses
+   if (my_listeners_init() == -1)
+      return(1);
+
+   // allocate workers
+   if ((workers = calloc(cnf.workers, sizeof(struct my_worker))) == NULL)
+   {
+      fprintf(stderr, "%s: out of virtual memory\n", cnf.prog_name);
+      return(1);
+   };
+
+   // metrics and statistics responses grow with the listener series
+   metrics_size = MY_METRICS_BUFF + ((size_t)listeners_len * MY_STAT_COUNTERS * MY_METRICS_SERIES);
+   if ((metrics_buff = malloc(metrics_size)) == NULL)
+   {
+      fprintf(stderr, "%s: out of virtual memory\n", cnf.prog_name);
+      my_free_workers();
+      return(1);
+   };
+   for(pos = 0; (pos < cnf.workers); pos++)
+   {
+      workers[pos].id   = pos;
+      workers[pos].epfd = -1;
+      workers[pos].log   = calloc(1, sizeof(struct my_logring));
+      workers[pos].stats = calloc(1, sizeof(struct my_stats));
+      workers[pos].socks = calloc(listeners_len, sizeof(struct my_sock));
+      if ( (!(workers[pos].log)) || (!(workers[pos].stats)) || (!(workers[pos].socks)) )
+      {
+         fprintf(stderr, "%s: out of virtual memory\n", cnf.prog_name);
+         my_free_workers();
+         return(1);
+      };
+      if ( ((cnf.capture)) && ((workers[pos].cap = calloc(1, sizeof(struct my_capring))) == NULL) )
+      {
+         fprintf(stderr, "%s: out of virtual memory\n", cnf.prog_name);
+         my_free_workers();
+         return(1);
+      };
+#ifdef MY_PROFILE
+      if ((workers[pos].prof = calloc(1, sizeof(struct my_prof))) == NULL)
+      {
+         fprintf(stderr, "%s: out of virtual memory\n", cnf.prog_name);
+         my_free_workers();
+         return(1);
+      };
+#endif
+      for(idx = 0; (idx < listeners_len); idx++)
+      {
+         workers[pos].socks[idx].s        = -1;
+         workers[pos].socks[idx].listener = idx;
+      };
+      workers[pos].sock = &workers[pos].socks[0];
+   };
+
+   // open connection log file
+   if ( (cnf.logfile) && ((logfs = fopen(cnf.logfile, "a")) == NULL) )
+   {
+      fprintf(stderr, "%s: fopen(%s): %s\n", cnf.prog_name, cnf.logfile, strerror(errno));
+      my_free_workers();
+      return(1);
+   };
+
    // configure signals
    my_debug("configuring signal handling");
-   signal(SIGHUP,  SIG_IGN);
+   signal(SIGHUP,  my_sighandler);
    signal(SIGPIPE, SIG_IGN);
    signal(SIGINT,  my_sighandler);
    signal(SIGQUIT, my_sighandler);
    signal(SIGTERM, my_sighandler);
+   signal(SIGUSR2, my_sighandler);
+#ifdef MY_PROFILE
+   signal(SIGUSR1, my_sighandler);
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   prof_ticks = my_prof_clock();
+   prof_ns    = ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+#endif
+
+   // STAMP replies carry the error estimate of the local clock
+   if (cnf.mode == MY_MODE_STAMP)
+      atomic_store_explicit(&stamp_error, my_stamp_error(), memory_order_relaxed);
 
    // seed psuedo random number generator
    my_debug("seeding psuedo random number generator");
@@ -410,545 +1861,5732 @@ int main(int argc, char * argv[])
    seed += (unsigned)ts.tv_nsec;
    seed += (unsigned)getpid();
    seed += (unsigned)getppid();
-   srand(seed);
+   for(pos = 0; (pos < cnf.workers); pos++)
+      my_rand_seed(&workers[pos], ((uint64_t)seed << 32) ^ ((uint64_t)ts.tv_nsec) ^ pos);
 
    // starts daemon functions
-   switch(s = my_daemonize())
+   switch(my_daemonize())
    {
       case -1:
       syslog(LOG_NOTICE, "daemon stopping");
       closelog();
+      my_free_workers();
       return(1);
 
       case 0:
+      my_free_workers();
       return(0);
 
       default:
       break;
    };
 
-   // loops
-   conn = 0;
+   // start workers with termination signals blocked so main thread handles them
+   sigemptyset(&sigs);
+   sigaddset(&sigs, SIGHUP);
+   sigaddset(&sigs, SIGINT);
+   sigaddset(&sigs, SIGQUIT);
+   sigaddset(&sigs, SIGTERM);
+   sigaddset(&sigs, SIGUSR2);
+#ifdef MY_PROFILE
+   sigaddset(&sigs, SIGUSR1);
+#endif
+   pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+   if ( ((capture_fs)) && ((rc = pthread_create(&capturer, NULL, my_capture_main, NULL)) != 0) )
+   {
+      syslog(LOG_ERR, "pthread_create(): %s", strerror(rc));
+      syslog(LOG_NOTICE, "daemon stopping");
+      my_close_sockets();
+      my_free_workers();
+      my_pidfile_release();
+      closelog();
+      return(1);
+   };
+   if ((rc = pthread_create(&logger, NULL, my_logger_main, NULL)) != 0)
+   {
+      syslog(LOG_ERR, "pthread_create(): %s", strerror(rc));
+      if ((capture_fs))
+      {
+         capture_stop = 1;
+         pthread_join(capturer, NULL);
+      };
+      syslog(LOG_NOTICE, "daemon stopping");
+      my_close_sockets();
+      my_free_workers();
+      my_pidfile_release();
+      closelog();
+      return(1);
+   };
+   for(started = 0; (started < cnf.workers); started++)
+   {
+      if ((rc = pthread_create(&workers[started].tid, NULL, my_worker_main, &workers[started])) != 0)
+      {
+         syslog(LOG_ERR, "pthread_create(): %s", strerror(rc));
+         should_stop = 1;
+         break;
+      };
+   };
+   pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+   // previous instance drains and exits once the new workers run
+   if (!(should_stop))
+      my_takeover_ready();
+
+   // serve metrics until termination signal, reload rules on SIGHUP, and
+   // have workers dump flow tables on SIGUSR2
    while(!(should_stop))
-      my_loop(s, &conn);
+   {
+      my_service_poll(1000);
+      my_rxq_report();
+      if (cnf.mode == MY_MODE_STAMP)
+         atomic_store_explicit(&stamp_error, my_stamp_error(), memory_order_relaxed);
+      if ((should_reload))
+      {
+         should_reload = 0;
+         my_rules_reload();
+      };
+      if ((should_dump))
+      {
+         should_dump = 0;
+         atomic_fetch_add(&flows_dump, 1);
+      };
+#ifdef MY_PROFILE
+      if ((should_profile))
+      {
+         should_profile = 0;
+         my_prof_dump();
+      };
+#endif
+   };
+
+   // wait for workers, then let logger and capture drain remaining records
+   for(pos = 0; (pos < started); pos++)
+      pthread_join(workers[pos].tid, NULL);
+   if ((capture_fs))
+   {
+      capture_stop = 1;
+      pthread_join(capturer, NULL);
+   };
+   logger_stop = 1;
+   pthread_join(logger, NULL);
+   my_rules_free(atomic_exchange(&rules, NULL));
+   my_rules_free(rules_retired);
+   free(atomic_exchange(&policy, NULL));
+   free(policy_retired);
 
    // close syslog
    syslog(LOG_NOTICE, "daemon stopping");
-   close(s);
-   unlink(cnf.pidfile);
+   my_close_sockets();
+   my_free_workers();
+   my_pidfile_release();
    closelog();
 
    return(0);
 }
 
 
-// daemonize process
-int my_daemonize(void)
+#ifdef MSG_WAITFORONE
+// allocate buffers for batched I/O
+struct my_batch * my_batch_alloc(unsigned size)
 {
-   int                       s;
-   int                       rc;
-   int                       fd;
-   int                       opt;
-   socklen_t                 socklen;
-   char                      pidfile[512];
-   char                      buff[16];
-   char                      addr_str[512];
-   pid_t                     pid;
-   unsigned short            port;
-   FILE                    * fs;
-   struct stat               sb;
-   union
-   {
-      struct sockaddr         sa;
-      struct sockaddr_in      sin;
-      struct sockaddr_in6     sin6;
-      struct sockaddr_storage ss;
-   } sa;
+   unsigned                  pos;
+   unsigned                  slots;
+   struct my_batch         * bp;
 
-   // check for existing instance
-   fs = NULL;
-   my_debug("checking for existing PID file (%s)", cnf.pidfile);
-   if ((rc = stat(cnf.pidfile, &sb)) == -1)
+   if ((bp = calloc(1, sizeof(struct my_batch))) == NULL)
+      return(NULL);
+   bp->size = size;
+
+   // zero copy replies keep their buffer until the kernel releases it,
+   // spare slots replace the buffer of each datagram in flight
+   slots = ((cnf.zerocopy)) ? size + MY_ZC_POOL : size;
+
+   if ( ((bp->msgs    = calloc(size, sizeof(struct mmsghdr))) == NULL) ||
+        ((bp->replies = calloc(size, sizeof(struct mmsghdr))) == NULL) ||
+        ((bp->iovs    = calloc(size, sizeof(struct iovec)))   == NULL) ||
+        ((bp->sas     = calloc(size, sizeof(union my_sa)))    == NULL) ||
+        ((bp->delays  = calloc(size, sizeof(useconds_t)))     == NULL) ||
+        ((bp->stamps  = calloc(size, sizeof(struct timespec))) == NULL) ||
+        ((bp->segs    = calloc(size, sizeof(unsigned)))       == NULL) ||
+        ((bp->fmts    = calloc(size, MY_TRAIN_SEGS))          == NULL) ||
+        ((bp->conns   = calloc(size, sizeof(size_t)))         == NULL) ||
+        ((bp->dsts    = calloc(size, sizeof(struct my_pktinfo))) == NULL) ||
+        ((bp->ctrls   = calloc(size, MY_CMSG_SIZE))           == NULL) ||
+        ((bp->buffs   = calloc(slots, MY_BUFF_SIZE))          == NULL) ||
+        ((bp->slots   = calloc(size, sizeof(unsigned)))       == NULL) ||
+        ((bp->origins = calloc(size, sizeof(unsigned)))       == NULL) ||
+        ((bp->spares  = calloc(size, sizeof(unsigned)))       == NULL) )
    {
-      if (errno != ENOENT)
+      my_batch_free(bp);
+      return(NULL);
+   };
+   if ((cnf.zerocopy))
+   {
+      if ( ((bp->zc       = calloc(1, sizeof(struct my_zcpool))) == NULL) ||
+           ((bp->zc->free = calloc(MY_ZC_POOL, sizeof(unsigned))) == NULL) )
       {
-         my_error("stat(): %s", strerror(errno));
-         return(-1);
+         my_batch_free(bp);
+         return(NULL);
       };
-   } else if ((fs = fopen(cnf.pidfile, "r")) == NULL)
+      for(pos = 0; (pos < MY_ZC_POOL); pos++)
+         bp->zc->free[pos] = slots - pos - 1;
+      bp->zc->nfree = MY_ZC_POOL;
+   };
+
+   // each datagram slot points at its own buffer and address
+   for(pos = 0; (pos < size); pos++)
    {
-      if (errno != ENOENT)
-      {
-         my_error("fopen(): %s", strerror(errno));
-         return(-1);
-      };
+      bp->slots[pos]                      = pos;
+      bp->spares[pos]                     = MY_ZC_NONE;
+      bp->iovs[pos].iov_base              = &bp->buffs[pos * MY_BUFF_SIZE];
+      bp->iovs[pos].iov_len               = MY_BUFF_SIZE;
+      bp->msgs[pos].msg_hdr.msg_name      = &bp->sas[pos];
+      bp->msgs[pos].msg_hdr.msg_namelen   = sizeof(struct sockaddr_storage);
+      bp->msgs[pos].msg_hdr.msg_iov       = &bp->iovs[pos];
+      bp->msgs[pos].msg_hdr.msg_iovlen    = 1;
+      if ((my_cmsg_enabled()))
+         bp->msgs[pos].msg_hdr.msg_control = &bp->ctrls[pos * MY_CMSG_SIZE];
+   };
+
+   return(bp);
+}
+
+
+// free buffers for batched I/O
+void my_batch_free(struct my_batch * bp)
+{
+   if (!(bp))
+      return;
+   free(bp->msgs);
+   free(bp->replies);
+   free(bp->iovs);
+   free(bp->sas);
+   free(bp->delays);
+   free(bp->stamps);
+   free(bp->segs);
+   free(bp->fmts);
+   free(bp->conns);
+   free(bp->dsts);
+   free(bp->ctrls);
+   free(bp->buffs);
+   free(bp->slots);
+   free(bp->origins);
+   free(bp->spares);
+   if ((bp->zc))
+      free(bp->zc->free);
+   free(bp->zc);
+   free(bp);
+   return;
+}
+#endif
+
+
+// copy sampled packet with synthesized IP and UDP headers for capture thread
+int my_capture(struct my_worker * wp, int mode, const union my_sa * sap,
+   const uint8_t * data, ssize_t ssize, const struct timespec * tsp)
+{
+   int                        v4;
+   size_t                     head;
+   size_t                     hlen;
+   size_t                     caplen;
+   uint64_t                   sum;
+   uint16_t                   u16;
+   uint16_t                   port;
+   uint16_t                   local_port;
+   uint8_t                    client[16];
+   uint8_t                    local[16];
+   uint8_t                    pkt[sizeof(struct pcap_rec_hdr) + 48];
+   uint8_t                  * ip;
+   const uint8_t            * src;
+   const uint8_t            * dst;
+   struct pcap_rec_hdr        rh;
+   struct my_capring        * ring;
+   const struct my_listener * lp;
+
+   static const uint8_t       mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+   if (ssize < 0)
+      return(-1);
+
+   // addresses are kept as IPv6, with IPv4 as mapped addresses
+   switch(sap->ss.ss_family)
+   {
+      case AF_INET:
+      memcpy(client, mapped, 12);
+      memcpy(&client[12], &sap->sin.sin_addr, 4);
+      port = ntohs(sap->sin.sin_port);
+      break;
+
+      case AF_INET6:
+      memcpy(client, &sap->sin6.sin6_addr, 16);
+      port = ntohs(sap->sin6.sin6_port);
+      break;
+
+      default:
+      return(-1);
+   };
+
+   // local address of request, or bound address when it is unknown
+   lp = &listeners[wp->sock->listener];
+   if (wp->dst.family == AF_INET)
+   {
+      memcpy(local, mapped, 12);
+      memcpy(&local[12], wp->dst.addr, 4);
+   } else if (wp->dst.family == AF_INET6)
+   {
+      memcpy(local, wp->dst.addr, 16);
+   } else if (lp->sa.ss.ss_family == AF_INET)
+   {
+      memcpy(local, mapped, 12);
+      memcpy(&local[12], &lp->sa.sin.sin_addr, 4);
    } else
    {
-      fscanf(fs, "%u", &pid);
-      fclose(fs);
-      if ((rc = kill(pid, 0)) == -1)
+      memcpy(local, &lp->sa.sin6.sin6_addr, 16);
+   };
+   local_port = ntohs((lp->sa.ss.ss_family == AF_INET) ? lp->sa.sin.sin_port : lp->sa.sin6.sin6_port);
+
+   // requests travel from client to listener, replies the other way
+   src    = (mode == MY_RECV) ? client : local;
+   dst    = (mode == MY_RECV) ? local  : client;
+   v4     = (!(memcmp(client, mapped, 12)));
+   hlen   = ((v4)) ? 28 : 48;
+   caplen = ((size_t)ssize > (MY_CAPTURE_SNAPLEN - hlen)) ? (MY_CAPTURE_SNAPLEN - hlen) : (size_t)ssize;
+   ip     = &pkt[sizeof(struct pcap_rec_hdr)];
+   memset(ip, 0, 48);
+   if ((v4))
+   {
+      ip[0] = 0x45;
+      u16   = htons((uint16_t)(((ssize + 28) > 0xffff) ? 0xffff : (ssize + 28)));
+      memcpy(&ip[2], &u16, 2);
+      u16   = htons((uint16_t)wp->conn);
+      memcpy(&ip[4], &u16, 2);
+      ip[6] = 0x40;        // don't fragment
+      ip[8] = 64;
+      ip[9] = IPPROTO_UDP;
+      memcpy(&ip[12], &src[12], 4);
+      memcpy(&ip[16], &dst[12], 4);
+      u16   = htons(my_ip_sum_fold(my_ip_sum(0, ip, 20)));
+      memcpy(&ip[10], &u16, 2);
+   } else
+   {
+      ip[0] = 0x60;
+      u16   = htons((uint16_t)(((ssize + 8) > 0xffff) ? 0xffff : (ssize + 8)));
+      memcpy(&ip[4], &u16, 2);
+      ip[6] = IPPROTO_UDP;
+      ip[7] = 64;
+      memcpy(&ip[8],  src, 16);
+      memcpy(&ip[24], dst, 16);
+   };
+
+   u16 = htons((mode == MY_RECV) ? port : local_port);
+   memcpy(&ip[hlen - 8], &u16, 2);
+   u16 = htons((mode == MY_RECV) ? local_port : port);
+   memcpy(&ip[hlen - 6], &u16, 2);
+   u16 = htons((uint16_t)(((ssize + 8) > 0xffff) ? 0xffff : (ssize + 8)));
+   memcpy(&ip[hlen - 4], &u16, 2);
+
+   // UDP checksum covers pseudo header, UDP header and the whole payload,
+   // even when the capture is cut at the snap length
+   sum  = my_ip_sum(0, ((v4)) ? &ip[12] : &ip[8], ((v4)) ? 8 : 32);
+   sum += IPPROTO_UDP + (((ssize + 8) > 0xffff) ? 0xffff : (uint64_t)(ssize + 8));
+   sum  = my_ip_sum(sum, &ip[hlen - 8], 8);
+   sum  = my_ip_sum(sum, data, (size_t)ssize);
+   u16  = htons(my_ip_sum_fold(sum));
+   if (!(u16))
+      u16 = 0xffff;
+   memcpy(&ip[hlen - 2], &u16, 2);
+
+   rh.ts_sec   = (uint32_t)tsp->tv_sec;
+   rh.ts_nsec  = (uint32_t)tsp->tv_nsec;
+   rh.incl_len = (uint32_t)(hlen + caplen);
+   rh.orig_len = (uint32_t)(hlen + (size_t)ssize);
+   memcpy(pkt, &rh, sizeof(rh));
+
+   // never block the echo path, drop packet when capture thread falls behind
+   ring = wp->cap;
+   head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+   if ((head - atomic_load_explicit(&ring->tail, memory_order_acquire) + sizeof(rh) + hlen + caplen) > MY_CAPTURE_RING)
+   {
+      atomic_store_explicit(&ring->dropped, atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1, memory_order_relaxed);
+      return(-1);
+   };
+   my_capture_copy(ring, head, pkt, sizeof(rh) + hlen);
+   my_capture_copy(ring, head + sizeof(rh) + hlen, data, caplen);
+   atomic_store_explicit(&ring->head, head + sizeof(rh) + hlen + caplen, memory_order_release);
+
+   return(0);
+}
+
+
+// copy bytes into capture ring, wrapping past the end of the buffer
+void my_capture_copy(struct my_capring * ring, size_t pos, const void * src, size_t len)
+{
+   size_t                    off;
+   size_t                    first;
+
+   off   = pos & (MY_CAPTURE_RING - 1);
+   first = ((MY_CAPTURE_RING - off) < len) ? (MY_CAPTURE_RING - off) : len;
+   memcpy(&ring->buff[off], src, first);
+   if (first < len)
+      memcpy(ring->buff, (const uint8_t *)src + first, len - first);
+   return;
+}
+
+
+// capture thread
+void * my_capture_main(void * arg)
+{
+   int                        stop;
+   int                        failed;
+   unsigned                   pos;
+   size_t                     count;
+   size_t                     head;
+   size_t                     tail;
+   size_t                     off;
+   size_t                     len;
+   uint64_t                   dropped;
+   uint64_t                   written;
+   struct pcap_rec_hdr        rh;
+   struct my_capring        * ring;
+   struct timespec            ts;
+
+   (void)arg;
+
+   failed  = 0;
+   written = 0;
+   while(1)
+   {
+      // check stop flag first so packets queued before stopping are drained
+      stop  = capture_stop;
+      count = 0;
+
+      for(pos = 0; (pos < cnf.workers); pos++)
       {
-         if (errno == ESRCH)
+         ring = workers[pos].cap;
+         tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+         head = atomic_load_explicit(&ring->head, memory_order_acquire);
+         for(; (tail != head); tail += len, count++)
          {
-            my_debug("removing stale PID file");
-            unlink(cnf.pidfile);
-         } else
+            // record header and packet may each wrap past the end of the buffer
+            off = tail & (MY_CAPTURE_RING - 1);
+            len = MY_CAPTURE_RING - off;
+            if (len >= sizeof(rh))
+               memcpy(&rh, &ring->buff[off], sizeof(rh));
+            else
+            {
+               memcpy(&rh, &ring->buff[off], len);
+               memcpy((uint8_t *)&rh + len, ring->buff, sizeof(rh) - len);
+            };
+            len = sizeof(rh) + rh.incl_len;
+            if ((MY_CAPTURE_RING - off) >= len)
+               fwrite(&ring->buff[off], len, 1, capture_fs);
+            else
+            {
+               fwrite(&ring->buff[off], MY_CAPTURE_RING - off, 1, capture_fs);
+               fwrite(ring->buff, len - (MY_CAPTURE_RING - off), 1, capture_fs);
+            };
+         };
+         atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+         // report overflow
+         dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+         if (dropped != ring->reported)
          {
-            my_error("kill(): %s", strerror(errno));
-            return(-1);
+            my_log_write(LOG_WARNING, "worker %u: %" PRIu64 " captured packets dropped", pos, dropped - ring->reported);
+            ring->reported = dropped;
          };
-      } else
+      };
+      written += count;
+      if ( ((count)) && (fflush(capture_fs) == EOF) && (!(failed)) )
       {
-         my_error("daemon already running");
+         my_log_write(LOG_ERR, "capture: %s", strerror(errno));
+         failed = 1;
+      };
+
+      if ((stop))
+         break;
+      if (!(count))
+      {
+         ts.tv_sec  = 0;
+         ts.tv_nsec = MY_LOG_INTERVAL;
+         nanosleep(&ts, NULL);
+      };
+   };
+
+   my_log_write(LOG_NOTICE, "capture: %" PRIu64 " packets written to %s", written, cnf.capture);
+
+   return(NULL);
+}
+
+
+// create pcap file, returns -1 on error
+int my_capture_open(const char * path)
+{
+   int                       fd;
+   char                      rotated[512];
+   struct pcap_file_hdr      fh;
+
+   // a running instance being taken over keeps writing its capture, which
+   // moves aside so this instance starts a new one
+   if ((cnf.takeover))
+   {
+      snprintf(rotated, sizeof(rotated), "%s.1", path);
+      if ( (rename(path, rotated) == -1) && (errno != ENOENT) )
+      {
+         my_error("rename(%s): %s", rotated, strerror(errno));
          return(-1);
       };
    };
 
-   // create PID file
-   my_debug("creating PID file");
-   strncpy(pidfile, cnf.pidfile, sizeof(pidfile)-7);
-   strcat(pidfile, "XXXXXX");
-   if ((fd = mkstemp(pidfile)) == -1)
+   if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1)
    {
-      my_error("mkstemp(): %s", strerror(errno));
+      my_error("open(%s): %s", path, strerror(errno));
       return(-1);
    };
-   my_debug("temp pidfile: %s", pidfile);
-   if ((rc = link(pidfile, cnf.pidfile)) == -1)
+   if ( ((cnf.uid != getuid()) || (cnf.gid != getgid())) && (fchown(fd, cnf.uid, cnf.gid) == -1) )
    {
-      my_error("mkstemp(): %s", strerror(errno));
+      my_error("fchown(): %s", strerror(errno));
       close(fd);
-      unlink(pidfile);
       return(-1);
    };
-   unlink(pidfile);
-   if ((rc = fchmod(fd, 0644)) == -1)
+   if ((capture_fs = fdopen(fd, "w")) == NULL)
    {
-      my_error("fchmod(): %s", strerror(errno));
+      my_error("fdopen(): %s", strerror(errno));
       close(fd);
       return(-1);
    };
-   if ( (cnf.uid != getuid()) ||
-        (cnf.gid != getgid()) )
+
+   // header is flushed before forking so only the daemon writes packets
+   memset(&fh, 0, sizeof(fh));
+   fh.magic         = PCAP_MAGIC_NSEC;
+   fh.version_major = 2;
+   fh.version_minor = 4;
+   fh.snaplen       = MY_CAPTURE_SNAPLEN;
+   fh.linktype      = PCAP_LINKTYPE_RAW;
+   if ( (fwrite(&fh, sizeof(fh), 1, capture_fs) != 1) || (fflush(capture_fs) == EOF) )
    {
-      if ((rc = fchown(fd, cnf.uid, cnf.gid)) == -1)
+      my_error("capture %s: %s", path, strerror(errno));
+      fclose(capture_fs);
+      capture_fs = NULL;
+      return(-1);
+   };
+
+   return(0);
+}
+
+
+// determine if any feature requires ancillary data from received datagrams
+int my_cmsg_enabled(void)
+{
+   if (cnf.timestamp != MY_TS_NONE)
+      return(1);
+   if (cnf.mode == MY_MODE_STAMP)
+      return(1);
+   if ((cnf.gro))
+      return(1);
+#if defined(SO_RXQ_OVFL) || defined(IP_PKTINFO)
+   return(1);
+#else
+   return(0);
+#endif
+}
+
+
+// close worker sockets
+void my_close_sockets(void)
+{
+   unsigned                  pos;
+   unsigned                  idx;
+
+   for(pos = 0; (pos < cnf.workers); pos++)
+   {
+      for(idx = 0; (idx < listeners_len); idx++)
       {
-         my_error("fchown(): %s", strerror(errno));
-         close(fd);
-         return(-1);
+         if (workers[pos].socks[idx].s != -1)
+            close(workers[pos].socks[idx].s);
+         workers[pos].socks[idx].s = -1;
       };
    };
-   my_debug("pidfile: %s", cnf.pidfile);
 
-   // determines interface on which to listen
-   bzero(&sa, sizeof(sa));
-   if (!(cnf.listen))
-   {
-      sa.sin6.sin6_family = AF_INET6;
-      sa.sin6.sin6_addr   = in6addr_any;
-      sa.sin6.sin6_port   = htons(cnf.port);
-      socklen             = sizeof(struct sockaddr_in6);
-   } else
+   if (metrics_s != -1)
+      close(metrics_s);
+   metrics_s = -1;
+   if (control_s != -1)
+      close(control_s);
+   control_s = -1;
+
+   // paths belong to the new instance once sockets are handed over
+   if ( ((metrics_path)) && (!(handed_over)) )
+      unlink(metrics_path);
+   metrics_path = NULL;
+   if ( ((control_path)) && (!(handed_over)) )
+      unlink(control_path);
+   control_path = NULL;
+
+   if ((shm))
+      munmap(shm, shm_size);
+   shm = NULL;
+   if ((journal))
+      munmap(journal, journal_size);
+   journal = NULL;
+   if (journal_fd != -1)
+      close(journal_fd);
+   journal_fd = -1;
+   if ( ((shm_path)) && (!(handed_over)) )
+      unlink(shm_path);
+   shm_path = NULL;
+   if ((capture_fs))
+      fclose(capture_fs);
+   capture_fs = NULL;
+
+   return;
+}
+
+
+// hand sockets to new instance, then drain and stop once it runs
+void my_control_handoff(int c)
+{
+   int                       rc;
+   unsigned                  pos;
+   unsigned                  idx;
+   unsigned                  count;
+   ssize_t                   ssize;
+   char                      ack[16];
+   int                       fds[MY_HANDOFF_FDS];
+   struct pollfd             pfd[1];
+
+   syslog(LOG_NOTICE, "takeover: passing sockets to new instance");
+
+   // sockets are passed in chunks, an empty record ends the list
+   rc    = 0;
+   count = 0;
+   for(pos = 0; ( (rc != -1) && (pos < cnf.workers) ); pos++)
    {
-      if ((rc = inet_pton(AF_INET, cnf.listen, &sa.sin.sin_addr)) == 1)
+      for(idx = 0; ( (rc != -1) && (idx < listeners_len) ); idx++)
       {
-         sa.sin.sin_family   = AF_INET;
-         sa.sin.sin_port     = htons(cnf.port);
-         socklen             = sizeof(struct sockaddr_in);
-      } else if ((rc = inet_pton(AF_INET6, cnf.listen, &sa.sin6.sin6_addr)) == 1)
+         fds[count++] = workers[pos].socks[idx].s;
+         if (count == MY_HANDOFF_FDS)
+         {
+            rc    = my_control_sendfds(c, fds, count);
+            count = 0;
+         };
+      };
+   };
+   if ( (rc != -1) && ((count)) )
+      rc = my_control_sendfds(c, fds, count);
+   if (rc != -1)
+      rc = my_control_sendfds(c, NULL, 0);
+   if (rc == -1)
+   {
+      syslog(LOG_WARNING, "takeover: sendmsg(): %s", strerror(errno));
+      return;
+   };
+
+   // keep serving unless the new instance reports its workers are running
+   pfd[0].fd      = c;
+   pfd[0].events  = POLLIN;
+   pfd[0].revents = 0;
+   if ( (poll(pfd, 1, MY_CONTROL_TIMEOUT) < 1) || ((ssize = read(c, ack, sizeof(ack)-1)) < 1) )
+   {
+      syslog(LOG_WARNING, "takeover: new instance did not start, continuing");
+      return;
+   };
+   ack[ssize] = '\0';
+   if ((strncmp(ack, "ready", 5)))
+   {
+      syslog(LOG_WARNING, "takeover: unexpected reply from new instance, continuing");
+      return;
+   };
+
+   syslog(LOG_NOTICE, "takeover: sockets handed to new instance, draining");
+   handed_over = 1;
+   should_stop = 1;
+
+   return;
+}
+
+
+// execute control command, returns -1 when the connection is done
+int my_control_cmd(int c, char * line)
+{
+   ssize_t                   len;
+   char                    * cmd;
+   char                    * name;
+   char                    * val;
+   char                    * state;
+   const char              * err;
+
+   if ((cmd = strtok_r(line, " \t\r", &state)) == NULL)
+      return(0);
+
+   // hands the connection over to the socket transfer
+   if (!(strcasecmp(cmd, "takeover")))
+   {
+      my_control_handoff(c);
+      return(-1);
+   };
+
+   if (!(strcasecmp(cmd, "quit")))
+      return(-1);
+
+   if (!(strcasecmp(cmd, "set")))
+   {
+      name = strtok_r(NULL, " \t\r", &state);
+      val  = strtok_r(NULL, " \t\r", &state);
+      if ((err = my_control_set(((name)) ? name : "", val)) != NULL)
       {
-         sa.sin6.sin6_family = AF_INET6;
-         sa.sin6.sin6_port   = htons(cnf.port);
-         socklen             = sizeof(struct sockaddr_in6);
-      } else
+         my_control_reply(c, "error: %s\n", err);
+         return(0);
+      };
+      syslog(LOG_NOTICE, "control: %s set to %s", name, val);
+      my_control_reply(c, "ok\n");
+      return(0);
+   };
+
+   if (!(strcasecmp(cmd, "show")))
+   {
+      my_control_show(c);
+      return(0);
+   };
+
+   if (!(strcasecmp(cmd, "stats")))
+   {
+      if ((len = my_metrics_render(metrics_buff, metrics_size)) == -1)
       {
-         if (rc == -1)
-            my_error("inet_pton(): %s", strerror(errno));
-         else
-            my_error("invalid address specified with `-l'");
-         close(fd);
-         unlink(cnf.pidfile);
-         return(-1);
+         my_control_reply(c, "error: statistics exceed response buffer\n");
+         return(0);
       };
+      send(c, metrics_buff, (size_t)len, MSG_NOSIGNAL);
+      return(0);
+   };
+
+   // counters keep running, reports subtract their values at the reset
+   if (!(strcasecmp(cmd, "reset")))
+   {
+      my_stats_merge(&stats_base);
+      syslog(LOG_NOTICE, "control: statistics reset");
+      my_control_reply(c, "ok\n");
+      return(0);
+   };
+
+   if (!(strcasecmp(cmd, "flows")))
+   {
+      atomic_fetch_add(&flows_dump, 1);
+      my_control_reply(c, "ok\n");
+      return(0);
+   };
+
+   if (!(strcasecmp(cmd, "reload")))
+   {
+      if (!(cnf.rules))
+         my_control_reply(c, "error: no rule file configured\n");
+      else if (my_rules_reload() == -1)
+         my_control_reply(c, "error: rule file rejected, see log\n");
+      else
+         my_control_reply(c, "ok\n");
+      return(0);
+   };
+
+   my_control_reply(c, "error: unknown command `%s'\n", cmd);
+
+   return(0);
+}
+
+
+// create UNIX control socket
+int my_control_open(const char * path)
+{
+   int                       s;
+   struct stat               sb;
+   struct sockaddr_un        sun;
+
+   if (strlen(path) >= sizeof(sun.sun_path))
+   {
+      my_error("control socket path too long");
+      return(-1);
    };
+   memset(&sun, 0, sizeof(sun));
+   sun.sun_family = AF_UNIX;
+   strncpy(sun.sun_path, path, sizeof(sun.sun_path)-1);
 
-   // creates socket
-   my_debug("creating UDP socket");
-   if ((s = socket(sa.sa.sa_family, SOCK_DGRAM, 0)) == -1)
+   // a running instance being taken over keeps its bound socket, only the
+   // path moves to this instance
+   if ( (stat(path, &sb) == 0) && (S_ISSOCK(sb.st_mode)) )
+      unlink(path);
+   if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
    {
       my_error("socket(): %s", strerror(errno));
-      close(fd);
-      unlink(cnf.pidfile);
       return(-1);
    };
+   if (bind(s, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+   {
+      my_error("bind(%s): %s", path, strerror(errno));
+      close(s);
+      return(-1);
+   };
+   control_path = path;
+   chmod(path, 0600);
 
-   // set socket options
-   my_debug("setting socket options");
-   opt = 1;
-   if ((rc = setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (void *)&opt, sizeof(int))) == -1)
+   if (listen(s, 4) == -1)
    {
-      my_error("setsockopt(SO_REUSEADDR): %s", strerror(errno));
+      my_error("listen(): %s", strerror(errno));
       close(s);
-      close(fd);
-      unlink(cnf.pidfile);
       return(-1);
    };
+   fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+
+   return(s);
+}
+
+
+// send formatted reply to control connection
+void my_control_reply(int c, const char * fmt, ...)
+{
+   int                       len;
+   char                      buff[256];
+   va_list                   args;
+
+   va_start(args, fmt);
+   len = vsnprintf(buff, sizeof(buff), fmt, args);
+   va_end(args);
+
+   if (len > 0)
+      send(c, buff, ((size_t)len < sizeof(buff)) ? (size_t)len : (sizeof(buff) - 1), MSG_NOSIGNAL);
+
+   return;
+}
+
+
+// serve control connection
+void my_control_serve(void)
+{
+   int                       c;
+   size_t                    len;
+   ssize_t                   ssize;
+   char                    * eol;
+   char                      req[512];
+   struct pollfd             fds[1];
+
+   if ((c = accept(control_s, NULL, NULL)) == -1)
+      return;
+
+   // commands are newline terminated, a client may send several before
+   // closing, and a stalled client is bounded by the read timeout
+   fds[0].fd      = c;
+   fds[0].events  = POLLIN;
+   fds[0].revents = 0;
+   len            = 0;
+   while( (poll(fds, 1, MY_METRICS_TIMEOUT) > 0) && ((ssize = read(c, &req[len], sizeof(req) - len - 1)) > 0) )
+   {
+      len     += (size_t)ssize;
+      req[len] = '\0';
+      while((eol = strchr(req, '\n')) != NULL)
+      {
+         *eol = '\0';
+         if (my_control_cmd(c, req) == -1)
+         {
+            close(c);
+            return;
+         };
+         len -= (size_t)(&eol[1] - req);
+         memmove(req, &eol[1], len + 1);
+      };
+      if (len == (sizeof(req) - 1))
+      {
+         my_control_reply(c, "error: command too long\n");
+         break;
+      };
+   };
+   close(c);
+
+   return;
+}
+
+
+// send takeover record with attached sockets
+int my_control_sendfds(int c, const int * fds, unsigned count)
+{
+   uint32_t                  len;
+   struct iovec              iov;
+   struct msghdr             hdr;
+   struct cmsghdr          * cmsg;
+   union
+   {
+      char                   bytes[CMSG_SPACE(sizeof(int) * MY_HANDOFF_FDS)];
+      struct cmsghdr         align;
+   } ctrl;
+
+   len          = count;
+   iov.iov_base = &len;
+   iov.iov_len  = sizeof(len);
+   memset(&hdr, 0, sizeof(hdr));
+   hdr.msg_iov    = &iov;
+   hdr.msg_iovlen = 1;
+   if ((count))
+   {
+      hdr.msg_control    = ctrl.bytes;
+      hdr.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+      cmsg               = CMSG_FIRSTHDR(&hdr);
+      cmsg->cmsg_level   = SOL_SOCKET;
+      cmsg->cmsg_type    = SCM_RIGHTS;
+      cmsg->cmsg_len     = CMSG_LEN(sizeof(int) * count);
+      memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+   };
+
+   if (sendmsg(c, &hdr, MSG_NOSIGNAL) != (ssize_t)sizeof(len))
+      return(-1);
+
+   return(0);
+}
+
+
+// free worker resources
+void my_free_workers(void)
+{
+   unsigned                  pos;
+
+   for(pos = 0; (pos < cnf.workers); pos++)
+   {
+      free(workers[pos].log);
+      free(workers[pos].cap);
+      free(workers[pos].stats);
+      free(workers[pos].socks);
+#ifdef MY_PROFILE
+      free(workers[pos].prof);
+#endif
+   };
+   free(workers);
+   workers = NULL;
+   free(metrics_buff);
+   metrics_buff = NULL;
+
+   if (logfs)
+      fclose(logfs);
+   logfs = NULL;
+
+   return;
+}
+
+
+// change runtime setting, returns NULL or reason the value was rejected
+const char * my_control_set(const char * name, const char * val)
+{
+   unsigned long             ul;
+   uint64_t                  prob;
+   char                    * end;
+   const char              * ptr;
+
+   if (!(val))
+      return("usage: set <name> <value>");
+
+   // atomics read by workers for each request, no snapshot is needed
+   if (!(strcasecmp(name, "verbose")))
+   {
+      ul = strtoul(val, &end, 10);
+      if ( (end[0] != '\0') || (ul > 9) )
+         return("invalid value for verbose");
+      cnf.verbose = (int32_t)ul;
+      return(NULL);
+   };
+   if (!(strcasecmp(name, "capture-sample")))
+   {
+      ptr = (!(strncmp(val, "1/", 2))) ? &val[2] : val;
+      ul  = strtoul(ptr, &end, 10);
+      if ( (ptr[0] == '\0') || (end[0] != '\0') || (ul < 1) || (ul > UINT32_MAX) )
+         return("invalid value for capture-sample");
+      cnf.capture_sample = (unsigned)ul;
+      return(NULL);
+   };
+
+   // echo plus and impairments take effect through a new default policy
+   if (!(strcasecmp(name, "echoplus")))
+   {
+      if      ( (!(strcasecmp(val, "on")))  || (!(strcmp(val, "1"))) ) { cnf.echoplus = 1; }
+      else if ( (!(strcasecmp(val, "off"))) || (!(strcmp(val, "0"))) ) { cnf.echoplus = 0; }
+      else
+         return("invalid value for echoplus");
+   }
+   else if ( (!(strcasecmp(name, "drop")))    || (!(strcasecmp(name, "reorder"))) ||
+        (!(strcasecmp(name, "duplicate"))) || (!(strcasecmp(name, "corrupt"))) )
+   {
+      if (my_parse_prob(val, &prob, NULL) == -1)
+         return("invalid probability");
+      if (!(strcasecmp(name, "drop")))
+      {
+         cnf.drop    = prob;
+         cnf.gemodel = 0;
+      }
+      else if (!(strcasecmp(name, "reorder")))   { cnf.reorder   = prob; }
+      else if (!(strcasecmp(name, "duplicate"))) { cnf.duplicate = prob; }
+      else                                       { cnf.corrupt   = prob; }
+   }
+   else if ( (!(strcasecmp(name, "delay"))) || (!(strcasecmp(name, "jitter"))) )
+   {
+      ul = strtoul(val, &end, 10);
+      if ( (val[0] == '\0') || (end[0] != '\0') || (ul > MY_DELAY_MAX) )
+         return("invalid delay");
+      if (!(strcasecmp(name, "delay")))
+         cnf.delay  = (useconds_t)ul;
+      else
+         cnf.jitter = (useconds_t)ul;
+   }
+   else
+   {
+      return("unknown setting");
+   };
+
+   // rules inherit settings they do not override and are resolved again
+   // from their compiled form
+   if (my_policy_publish() == -1)
+      return("out of virtual memory");
+
+   return(NULL);
+}
+
+
+// report runtime settings
+void my_control_show(int c)
+{
+   my_control_reply(c, "echoplus %s\n", ((cnf.echoplus)) ? "on" : "off");
+   my_control_reply(c, "verbose %i\n", (int)atomic_load(&cnf.verbose));
+   if ((cnf.gemodel))
+      my_control_reply(c, "drop gilbert-elliott\n");
+   else
+      my_control_reply(c, "drop %g\n", MY_PERCT(cnf.drop));
+   my_control_reply(c, "reorder %g\n", MY_PERCT(cnf.reorder));
+   my_control_reply(c, "duplicate %g\n", MY_PERCT(cnf.duplicate));
+   my_control_reply(c, "corrupt %g\n", MY_PERCT(cnf.corrupt));
+   my_control_reply(c, "delay %u\n", cnf.delay);
+   my_control_reply(c, "jitter %u\n", cnf.jitter);
+   my_control_reply(c, "rules %s\n", ((cnf.rules)) ? cnf.rules : "none");
+   my_control_reply(c, "capture-sample 1/%u\n", atomic_load(&cnf.capture_sample));
+
+   return;
+}
+
+
+// daemonize process
+int my_daemonize(void)
+{
+   int                       rc;
+   int                       fd;
+   int                       s;
+   int                       takeover;
+   int                       opt;
+   unsigned                  pos;
+   unsigned                  idx;
+   unsigned                  adopted;
+   socklen_t                 socklen;
+   const char              * pidpath;
+   char                      pidfile[512];
+   char                      cpulist[512];
+   char                      buff[16];
+   char                      addr_str[INET6_ADDRSTRLEN];
+   pid_t                     pid;
+   FILE                    * fs;
+   struct stat               sb;
+   struct my_listener      * lp;
+
+   // take sockets over from running instance
+   takeover = 1;
+   if ( ((cnf.takeover)) && ((takeover = my_takeover()) == -1) )
+      return(-1);
+
+   // check for existing instance
+   fs = NULL;
+   my_debug("checking for existing PID file (%s)", cnf.pidfile);
+   if (takeover == 0)
+   {
+      my_debug("replacing running instance");
+   } else if ((rc = stat(cnf.pidfile, &sb)) == -1)
+   {
+      if (errno != ENOENT)
+      {
+         my_error("stat(): %s", strerror(errno));
+         return(-1);
+      };
+   } else if ((fs = fopen(cnf.pidfile, "r")) == NULL)
+   {
+      if (errno != ENOENT)
+      {
+         my_error("fopen(): %s", strerror(errno));
+         return(-1);
+      };
+   } else
+   {
+      fscanf(fs, "%u", &pid);
+      fclose(fs);
+      if ((rc = kill(pid, 0)) == -1)
+      {
+         if (errno == ESRCH)
+         {
+            my_debug("removing stale PID file");
+            unlink(cnf.pidfile);
+         } else
+         {
+            my_error("kill(): %s", strerror(errno));
+            return(-1);
+         };
+      } else
+      {
+         my_error("daemon already running");
+         return(-1);
+      };
+   };
+
+   // create PID file
+   my_debug("creating PID file");
+   strncpy(pidfile, cnf.pidfile, sizeof(pidfile)-7);
+   strcat(pidfile, "XXXXXX");
+   if ((fd = mkstemp(pidfile)) == -1)
+   {
+      my_error("mkstemp(): %s", strerror(errno));
+      return(-1);
+   };
+   my_debug("temp pidfile: %s", pidfile);
+   pidpath = cnf.pidfile;
+   if (takeover == 0)
+   {
+      // renamed over the running instance's PID file once the PID is recorded
+      pidpath = pidfile;
+   } else if ((rc = link(pidfile, cnf.pidfile)) == -1)
+   {
+      my_error("mkstemp(): %s", strerror(errno));
+      close(fd);
+      unlink(pidfile);
+      return(-1);
+   } else
+   {
+      unlink(pidfile);
+   };
+   if ((rc = fchmod(fd, 0644)) == -1)
+   {
+      my_error("fchmod(): %s", strerror(errno));
+      close(fd);
+      unlink(pidpath);
+      return(-1);
+   };
+   if ( (cnf.uid != getuid()) ||
+        (cnf.gid != getgid()) )
+   {
+      if ((rc = fchown(fd, cnf.uid, cnf.gid)) == -1)
+      {
+         my_error("fchown(): %s", strerror(errno));
+         close(fd);
+         unlink(pidpath);
+         return(-1);
+      };
+   };
+   my_debug("pidfile: %s", cnf.pidfile);
+
+   // creates sockets, one per worker for each listener, reusing sockets
+   // taken over from the running instance where the addresses match
+   adopted = 0;
+   for(idx = 0; (idx < listeners_len); idx++)
+   {
+      lp = &listeners[idx];
+      for(pos = 0; (pos < cnf.workers); pos++)
+      {
+         if ((s = my_takeover_claim(&lp->sa)) == -1)
+         {
+            my_debug("creating UDP socket %u for listener %u", pos, idx);
+            s = my_socket(&lp->sa, lp->salen);
+         } else
+         {
+            my_debug("adopting UDP socket %u for listener %u", pos, idx);
+            adopted++;
+            if (my_socket_opts(s, lp->sa.sa.sa_family) == -1)
+            {
+               close(s);
+               s = -1;
+            };
+         };
+         if ((workers[pos].socks[idx].s = s) == -1)
+         {
+            my_close_sockets();
+            close(fd);
+            unlink(pidpath);
+            return(-1);
+         };
+
+         // remaining sockets join the address assigned to the first socket
+         lp->salen = sizeof(struct sockaddr_storage);
+         if ((rc = getsockname(workers[pos].socks[idx].s, &lp->sa.sa, &lp->salen)) == -1)
+         {
+            my_error("getsockname(): %s", strerror(errno));
+            my_close_sockets();
+            close(fd);
+            unlink(pidpath);
+            return(-1);
+         };
+      };
+
+      // name listener after its bound address
+      switch(lp->sa.ss.ss_family)
+      {
+         case AF_INET:
+         inet_ntop(AF_INET, &lp->sa.sin.sin_addr, addr_str, sizeof(addr_str));
+         snprintf(lp->name, sizeof(lp->name), "[%s]:%hu", addr_str, ntohs(lp->sa.sin.sin_port));
+         break;
+
+         case AF_INET6:
+         inet_ntop(AF_INET6, &lp->sa.sin6.sin6_addr, addr_str, sizeof(addr_str));
+         snprintf(lp->name, sizeof(lp->name), "[%s]:%hu", addr_str, ntohs(lp->sa.sin6.sin6_port));
+         break;
+
+         default:
+         my_error("listening socket has invalid address family: %i\n", lp->sa.sa.sa_family);
+         my_close_sockets();
+         close(fd);
+         unlink(pidpath);
+         return(-1);
+      };
+   };
+
+   // sockets the new configuration no longer listens on stay with the
+   // running instance until it exits
+   for(pos = 0; (pos < handoff_len); pos++)
+   {
+      if (handoff_fds[pos] == -1)
+         continue;
+      my_debug("closing unused socket from running instance");
+      close(handoff_fds[pos]);
+   };
+   free(handoff_fds);
+   handoff_fds = NULL;
+   handoff_len = 0;
+
+   // creates metrics listener
+   if ( (cnf.metrics) && ((metrics_s = my_metrics_open(cnf.metrics)) == -1) )
+   {
+      my_close_sockets();
+      close(fd);
+      unlink(pidpath);
+      return(-1);
+   };
+
+   // creates control socket
+   if ( (cnf.control) && ((control_s = my_control_open(cnf.control)) == -1) )
+   {
+      my_close_sockets();
+      close(fd);
+      unlink(pidpath);
+      return(-1);
+   };
+
+   // creates statistics segment
+   if ( (cnf.shm) && (my_shm_open(cnf.shm) == -1) )
+   {
+      my_close_sockets();
+      close(fd);
+      unlink(pidpath);
+      return(-1);
+   };
+
+   // opens packet journal
+   if ( (cnf.journal) && (my_journal_open(cnf.journal, cnf.journal_mb) == -1) )
+   {
+      my_close_sockets();
+      close(fd);
+      unlink(pidpath);
+      return(-1);
+   };
+
+   // creates packet capture
+   if ( (cnf.capture) && (my_capture_open(cnf.capture) == -1) )
+   {
+      my_close_sockets();
+      close(fd);
+      unlink(pidpath);
+      return(-1);
+   };
+
+   // change ownership
+   if ( (getgid() != cnf.gid) && ((rc = setregid(cnf.gid, cnf.gid)) == -1) )
+   {
+      my_error("getgid(): %s", strerror(errno));
+      my_close_sockets();
+      close(fd);
+      unlink(pidpath);
+      return(-1);
+   };
+   if ( (getuid() != cnf.uid) && ((rc = setreuid(cnf.uid, cnf.uid)) == -1) )
+   {
+      my_error("getuid(): %s", strerror(errno));
+      my_close_sockets();
+      close(fd);
+      unlink(pidpath);
+      return(-1);
+   };
+
+   // fork process
+   if (!(cnf.dont_fork))
+   {
+      my_debug("forking process");
+      switch(pid = fork())
+      {
+         case -1:
+         my_error("fork(): %s", strerror(errno));
+         break;
+
+         case 0:
+         break;
+
+         default:
+         my_debug("forking to %i", pid);
+         closelog();
+         close(fd);
+         metrics_path = NULL;
+         control_path = NULL;
+         shm_path = NULL;
+         my_close_sockets();
+         return(0);
+      };
+   };
+
+   // record PID in pidfile
+   pid = getpid();
+   snprintf(buff, sizeof(buff), "%i", pid);
+   write(fd, buff, strlen(buff));
+   close(fd);
+   if ( (pidpath != cnf.pidfile) && (rename(pidpath, cnf.pidfile) == -1) )
+      my_debug("rename(): %s", strerror(errno));
+   if ((shm))
+   {
+      shm->pid = (uint64_t)pid;
+      __atomic_store_n(&shm->magic, UDP_ECHO_STATS_MAGIC, __ATOMIC_RELEASE);
+   };
+   if ((journal))
+      journal->pid = (uint64_t)pid;
+
+   // opens syslog
+   openlog(cnf.prog_name, LOG_PID | (((cnf.dont_fork)) ? LOG_PERROR : 0), cnf.facility);
+   syslog(LOG_NOTICE, "%s v%s", PROGRAM_NAME, PACKAGE_VERSION);
+   syslog(LOG_NOTICE, "reflector mode: %s", mode_names[cnf.mode]);
+   syslog(LOG_NOTICE, "echo plus enabled: %s", ((cnf.echoplus)) ? "yes" : "no");
+   if ((cnf.echoplus))
+      syslog(LOG_NOTICE, "echo plus v2 server id: %hu", cnf.server_id);
+   syslog(LOG_NOTICE, "datagrams per batch: %u", cnf.batch);
+   syslog(LOG_NOTICE, "worker threads: %u", cnf.workers);
+   syslog(LOG_NOTICE, "flow table: %u slots per worker", cnf.flows);
+   if ((cnf.metrics))
+      syslog(LOG_NOTICE, "metrics listener: %s", cnf.metrics);
+   if ((cnf.control))
+      syslog(LOG_NOTICE, "control socket: %s", cnf.control);
+   if (takeover == 0)
+      syslog(LOG_NOTICE, "takeover: adopted %u sockets from running instance", adopted);
+   if ((cnf.busy_poll))
+      syslog(LOG_NOTICE, "event engine: busy poll (%u us)", cnf.busy_poll);
+   else
+      syslog(LOG_NOTICE, "event engine: %s", engine_names[cnf.engine]);
+   if ((cnf.cpus_len))
+   {
+      for(pos = 0, rc = 0; ( (pos < cnf.cpus_len) && (rc < (int)sizeof(cpulist)) ); pos++)
+         rc += snprintf(&cpulist[rc], sizeof(cpulist) - (size_t)rc, "%s%u", ((pos)) ? "," : "", cnf.cpus[pos]);
+      syslog(LOG_NOTICE, "worker CPUs: %s", cpulist);
+   };
+   if ((cnf.fifo))
+      syslog(LOG_NOTICE, "worker scheduling: SCHED_FIFO priority %i", cnf.fifo);
+   syslog(LOG_NOTICE, "timestamps: %s", ts_names[cnf.timestamp]);
+   syslog(LOG_NOTICE, "UDP GRO/GSO: %s", ((cnf.gro)) ? "yes" : "no");
+   if ((cnf.zerocopy))
+      syslog(LOG_NOTICE, "zero copy transmit: replies of %zu bytes or more", cnf.zerocopy);
+   syslog(LOG_NOTICE, "random delay: %u us", cnf.delay);
+   syslog(LOG_NOTICE, "delay jitter: %u us (%s)", cnf.jitter, dist_names[cnf.delay_dist]);
+   if ((my_delay_enabled()))
+      syslog(LOG_NOTICE, "delay pool: %u packets per worker", cnf.delay_pool);
+   if ((cnf.gemodel))
+      syslog(LOG_NOTICE, "burst loss: p=%g%% r=%g%% 1-h=%g%% 1-k=%g%%", MY_PERCT(cnf.ge_p), MY_PERCT(cnf.ge_r), MY_PERCT(cnf.ge_h), MY_PERCT(cnf.ge_k));
+   else
+      syslog(LOG_NOTICE, "drop probability: %g%%", MY_PERCT(cnf.drop));
+   syslog(LOG_NOTICE, "reorder probability: %g%% (%u us)", MY_PERCT(cnf.reorder), cnf.reorder_gap);
+   syslog(LOG_NOTICE, "duplicate probability: %g%%", MY_PERCT(cnf.duplicate));
+   syslog(LOG_NOTICE, "corrupt probability: %g%%", MY_PERCT(cnf.corrupt));
+   if ((cnf.rules))
+      syslog(LOG_NOTICE, "policy rules: %s (%u prefixes)", cnf.rules, atomic_load(&rules)->policies_len);
+   if ((cnf.capture))
+      syslog(LOG_NOTICE, "packet capture: %s (1/%u requests)", cnf.capture, cnf.capture_sample);
+   syslog(LOG_NOTICE, "running as UID: %u", getuid());
+   syslog(LOG_NOTICE, "running as GID: %u", getgid());
+   for(idx = 0; (idx < listeners_len); idx++)
+      syslog(LOG_NOTICE, "listening on %s", listeners[idx].name);
+   socklen = sizeof(int);
+   if (getsockopt(workers[0].socks[0].s, SOL_SOCKET, SO_RCVBUF, &opt, &socklen) == 0)
+      syslog(LOG_NOTICE, "socket receive buffer: %i bytes", opt);
+   socklen = sizeof(int);
+   if (getsockopt(workers[0].socks[0].s, SOL_SOCKET, SO_SNDBUF, &opt, &socklen) == 0)
+      syslog(LOG_NOTICE, "socket send buffer: %i bytes", opt);
+
+   return(1);
+}
+
+
+// display debug message
+void my_debug(const char * fmt, ...)
+{
+   va_list args;
+
+   if (!(cnf.verbose))
+      return;
+
+   printf("%s: ", cnf.prog_name);
+
+   va_start(args, fmt);
+   vprintf(fmt, args);
+   va_end(args);
+
+   printf("\n");
+
+   return;
+}
+
+
+// allocate delayed reply scheduler
+struct my_delayq * my_delay_alloc(unsigned size)
+{
+   unsigned                  pos;
+   unsigned                  large;
+   struct my_delayq        * dq;
+
+   if ((dq = calloc(1, sizeof(struct my_delayq))) == NULL)
+      return(NULL);
+
+   // most slots are sized for a single MTU, a few hold the largest datagram
+   large     = ((size / 256) < MY_DELAY_LARGE) ? (size / 256) : MY_DELAY_LARGE;
+   large     = ((large)) ? large : 1;
+   dq->size  = size;
+   dq->small = size - large;
+
+   if ( ((dq->heap  = calloc(size, sizeof(unsigned)))          == NULL) ||
+        ((dq->free  = calloc(size, sizeof(unsigned)))          == NULL) ||
+        ((dq->large = calloc(large, sizeof(unsigned)))         == NULL) ||
+        ((dq->pool  = calloc(size, sizeof(struct my_delayed))) == NULL) ||
+        ((dq->arena = malloc(((size_t)dq->small * MY_DELAY_SLOT) + ((size_t)large * MY_BUFF_SIZE))) == NULL) )
+   {
+      my_delay_free(dq);
+      return(NULL);
+   };
+
+   for(pos = 0; (pos < size); pos++)
+      dq->pool[pos].buff = (pos < dq->small)
+                         ? &dq->arena[(size_t)pos * MY_DELAY_SLOT]
+                         : &dq->arena[((size_t)dq->small * MY_DELAY_SLOT) + ((size_t)(pos - dq->small) * MY_BUFF_SIZE)];
+   for(pos = 0; (pos < dq->small); pos++)
+      dq->free[pos] = dq->small - pos - 1;
+   dq->nfree = dq->small;
+   for(pos = 0; (pos < large); pos++)
+      dq->large[pos] = size - pos - 1;
+   dq->nlarge = large;
+
+   return(dq);
+}
+
+
+// read monotonic clock in nanoseconds
+uint64_t my_delay_clock(void)
+{
+   struct timespec           ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return(((uint64_t)ts.tv_sec * 1000000000) + (uint64_t)ts.tv_nsec);
+}
+
+
+// determine if any impairment requires the delayed reply scheduler
+int my_delay_enabled(void)
+{
+   if ( (cnf.delay > 0) || (cnf.jitter > 0) || (cnf.reorder > 0) || (cnf.duplicate > 0) )
+      return(1);
+   if ((cnf.rules))
+      return(1);
+   // delay may be raised at runtime through the control socket
+   if ((cnf.control))
+      return(1);
+   return(0);
+}
+
+
+// free delayed reply scheduler
+void my_delay_free(struct my_delayq * dq)
+{
+   if (!(dq))
+      return;
+   free(dq->heap);
+   free(dq->free);
+   free(dq->large);
+   free(dq->pool);
+   free(dq->arena);
+   free(dq);
+   return;
+}
+
+
+// copy request into packet pool and schedule reply
+int my_delay_push(struct my_worker * wp, union my_sa * sap,
+   struct udp_echo_plus * msgp, ssize_t ssize, int fmt, struct timespec * tsp,
+   useconds_t delay)
+{
+   unsigned                  pos;
+   unsigned                  parent;
+   unsigned                  idx;
+   struct my_delayq        * dq;
+   struct my_delayed       * dp;
+
+   // datagrams that fit take a small slot, larger ones and overflow once
+   // the small slots are exhausted take one of the large slots
+   dq = wp->delayq;
+   if ( ((size_t)ssize <= MY_DELAY_SLOT) && ((dq->nfree)) )
+      idx = dq->free[--dq->nfree];
+   else if ((dq->nlarge))
+      idx = dq->large[--dq->nlarge];
+   else
+      return(-1);
+
+   // copy datagram into free pool slot
+   dp              = &dq->pool[idx];
+   dp->deadline    = my_delay_clock() + ((uint64_t)delay * 1000);
+   dp->conn        = wp->conn;
+   dp->delay       = delay;
+   dp->len         = (size_t)ssize;
+   dp->fmt         = fmt;
+   dp->rx          = *tsp;
+   dp->salen       = (sap->sa.sa_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+   memcpy(&dp->sa, sap, dp->salen);
+   memcpy(dp->buff, msgp, dp->len);
+   dp->sock        = (unsigned)(wp->sock - wp->socks);
+   dp->dst         = wp->dst;
+
+   // sift up by deadline
+   for(pos = dq->count++; (pos > 0); pos = parent)
+   {
+      parent = (pos - 1) / 2;
+      if (dq->pool[dq->heap[parent]].deadline <= dp->deadline)
+         break;
+      dq->heap[pos] = dq->heap[parent];
+   };
+   dq->heap[pos] = idx;
+
+   return(0);
+}
+
+
+// transmit expired replies, returns milliseconds until next deadline
+int my_delay_run(struct my_worker * wp, int timeout)
+{
+   unsigned                  pos;
+   unsigned                  child;
+   unsigned                  idx;
+   size_t                    conn;
+   uint8_t                   fmt;
+   uint64_t                  now;
+   uint64_t                  wait;
+   struct timespec           ts;
+   struct my_pktinfo         dst;
+   struct iovec              iov;
+   struct msghdr             hdr;
+   struct my_delayq        * dq;
+   struct my_delayed       * dp;
+   struct my_delayed       * last;
+   union
+   {
+      char                    bytes[MY_CMSG_SIZE];
+      struct cmsghdr          align;
+   } ctrl;
+
+   if ( ((dq = wp->delayq) == NULL) || (!(dq->count)) )
+      return(timeout);
+
+   now = my_delay_clock();
+   while( (dq->count) && (dq->pool[dq->heap[0]].deadline <= now) )
+   {
+      // send response
+      dp = &dq->pool[dq->heap[0]];
+      clock_gettime(CLOCK_REALTIME, &ts);
+      fmt = (uint8_t)dp->fmt;
+      my_echo_reply_time((struct udp_echo_plus *)dp->buff, (ssize_t)dp->len, 0, &fmt, &ts);
+      wp->sock        = &wp->socks[dp->sock];
+      iov.iov_base    = dp->buff;
+      iov.iov_len     = dp->len;
+      memset(&hdr, 0, sizeof(hdr));
+      hdr.msg_name    = &dp->sa;
+      hdr.msg_namelen = dp->salen;
+      hdr.msg_iov     = &iov;
+      hdr.msg_iovlen  = 1;
+      my_reply_ctrl(&hdr, ctrl.bytes, &dp->dst, 0, (ssize_t)dp->len);
+      my_stats_sent(wp, sendmsg(wp->sock->s, &hdr, MSG_DONTWAIT), 0, &dp->rx);
+
+      // log response under the connection number and local address of its request
+      conn     = wp->conn;
+      dst      = wp->dst;
+      wp->conn = dp->conn;
+      wp->dst  = dp->dst;
+      my_log_conn(wp, MY_SENT, &dp->sa, (struct udp_echo_plus *)dp->buff, (ssize_t)dp->len, dp->fmt, &ts, dp->delay);
+      wp->conn = conn;
+      wp->dst  = dst;
+      if (dq->heap[0] < dq->small)
+         dq->free[dq->nfree++] = dq->heap[0];
+      else
+         dq->large[dq->nlarge++] = dq->heap[0];
+
+      // sift last entry down from root
+      idx  = dq->heap[--dq->count];
+      last = &dq->pool[idx];
+      for(pos = 0; ((child = (pos * 2) + 1) < dq->count); pos = child)
+      {
+         if ( ((child + 1) < dq->count) && (dq->pool[dq->heap[child + 1]].deadline < dq->pool[dq->heap[child]].deadline) )
+            child++;
+         if (last->deadline <= dq->pool[dq->heap[child]].deadline)
+            break;
+         dq->heap[pos] = dq->heap[child];
+      };
+      dq->heap[pos] = idx;
+   };
+   if (!(dq->count))
+      return(timeout);
+
+   // round up so the loop never wakes before the deadline
+   wait = (dq->pool[dq->heap[0]].deadline - now + 999999) / 1000000;
+   if ( (timeout >= 0) && (wait > (uint64_t)timeout) )
+      return(timeout);
+
+   return((int)wait);
+}
+
+
+// display error message
+void my_error(const char * fmt, ...)
+{
+   va_list args;
+
+   fprintf(stderr, "%s: error: ", cnf.prog_name);
+
+   va_start(args, fmt);
+   vfprintf(stderr, fmt, args);
+   va_end(args);
+
+   fprintf(stderr, "\n");
+
+   return;
+}
+
+
+#ifdef EPOLLET
+// register socket with worker's epoll instance
+int my_epoll_add(struct my_worker * wp, struct my_sock * sp, uint32_t events)
+{
+   int                        flags;
+   struct epoll_event         ev;
+
+   // edge triggered descriptors must never block
+   if ((flags = fcntl(sp->s, F_GETFL)) == -1)
+      return(-1);
+   if (fcntl(sp->s, F_SETFL, flags | O_NONBLOCK) == -1)
+      return(-1);
+
+   memset(&ev, 0, sizeof(ev));
+   ev.events   = events;
+   ev.data.ptr = sp;
+   return(epoll_ctl(wp->epfd, EPOLL_CTL_ADD, sp->s, &ev));
+}
+
+
+// initialize epoll engine
+int my_epoll_init(struct my_worker * wp)
+{
+   unsigned                   idx;
+
+   if ((wp->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+   {
+      syslog(LOG_ERR, "worker %u: epoll_create1(): %s", wp->id, strerror(errno));
+      return(-1);
+   };
+   for(idx = 0; (idx < listeners_len); idx++)
+   {
+      if (my_epoll_add(wp, &wp->socks[idx], EPOLLIN | EPOLLET) == -1)
+      {
+         syslog(LOG_ERR, "worker %u: epoll_ctl(): %s", wp->id, strerror(errno));
+         close(wp->epfd);
+         wp->epfd = -1;
+         return(-1);
+      };
+   };
+   return(0);
+}
+#endif
+
+
+// allocate flow table
+struct my_flows * my_flow_alloc(unsigned size)
+{
+   struct my_flows         * ft;
+
+   if ((ft = calloc(1, sizeof(struct my_flows))) == NULL)
+      return(NULL);
+   if ((ft->slots = calloc(size, sizeof(struct my_flow))) == NULL)
+   {
+      free(ft);
+      return(NULL);
+   };
+   ft->size = size;
+
+   return(ft);
+}
+
+
+// log contents of worker's flow table
+void my_flow_dump(struct my_worker * wp)
+{
+   unsigned                  pos;
+   char                      addr_str[INET6_ADDRSTRLEN];
+   struct my_flows         * ft;
+   struct my_flow          * fp;
+
+   if ((ft = wp->flows) == NULL)
+      return;
+
+   my_log_write(LOG_NOTICE, "worker %u: flows: %u active; %" PRIu64 " evicted;", wp->id, ft->count, ft->evictions);
+   for(pos = 0; (pos < ft->size); pos++)
+   {
+      fp = &ft->slots[pos];
+      if (!(fp->family))
+         continue;
+      inet_ntop(fp->family, fp->addr, addr_str, sizeof(addr_str));
+      my_log_write(LOG_NOTICE,
+         "worker %u: flow: [%s]:%hu; pkts: %" PRIu64 "; bytes: %" PRIu64 "; drops: %" PRIu64 "; first: %lu.%09lu; last: %lu.%09lu; seq: %u; gaps: %" PRIu64 "; reorders: %" PRIu64 "; dups: %" PRIu64 ";",
+         wp->id,
+         addr_str,
+         fp->port,
+         fp->pkts,
+         fp->bytes,
+         fp->drops,
+         fp->first.tv_sec,
+         fp->first.tv_nsec,
+         fp->last.tv_sec,
+         fp->last.tv_nsec,
+         fp->seq,
+         fp->gaps,
+         fp->reorders,
+         fp->dups
+      );
+   };
+
+   return;
+}
+
+
+// free flow table
+void my_flow_free(struct my_flows * ft)
+{
+   if (!(ft))
+      return;
+   free(ft->slots);
+   free(ft);
+   return;
+}
+
+
+// find or create flow of source address, evicts least recently seen flow
+// within the probe window when no slot is available
+struct my_flow * my_flow_lookup(struct my_worker * wp, union my_sa * sap, struct timespec * tsp)
+{
+   unsigned                  pos;
+   unsigned                  idx;
+   uint16_t                  port;
+   uint8_t                   addr[16];
+   uint32_t                  word;
+   uint64_t                  hash;
+   struct my_flows         * ft;
+   struct my_flow          * fp;
+   struct my_flow          * victim;
+
+   if ((ft = wp->flows) == NULL)
+      return(NULL);
+
+   // build key
+   memset(addr, 0, sizeof(addr));
+   switch(sap->ss.ss_family)
+   {
+      case AF_INET:
+      memcpy(addr, &sap->sin.sin_addr, 4);
+      port = sap->sin.sin_port;
+      break;
+
+      case AF_INET6:
+      memcpy(addr, &sap->sin6.sin6_addr, 16);
+      port = sap->sin6.sin6_port;
+      break;
+
+      default:
+      return(NULL);
+   };
+
+   // hash key
+   hash = ((uint64_t)sap->ss.ss_family << 16) | port;
+   for(pos = 0; (pos < 16); pos += 4)
+   {
+      memcpy(&word, &addr[pos], 4);
+      hash  = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+      hash ^= hash >> 29;
+   };
+
+   // probe window
+   victim = NULL;
+   for(pos = 0; (pos < MY_FLOW_PROBE); pos++)
+   {
+      idx = (unsigned)(hash + pos) & (ft->size - 1);
+      fp  = &ft->slots[idx];
+      if (!(fp->family))
+      {
+         victim = fp;
+         ft->count++;
+         break;
+      };
+      if ( (fp->family == sap->ss.ss_family) && (fp->port == ntohs(port)) && (!(memcmp(fp->addr, addr, 16))) )
+         return(fp);
+      if ( (!(victim)) || (fp->last.tv_sec < victim->last.tv_sec) ||
+           ( (fp->last.tv_sec == victim->last.tv_sec) && (fp->last.tv_nsec < victim->last.tv_nsec) ) )
+         victim = fp;
+   };
+   if (victim->family != 0)
+      ft->evictions++;
+
+   // initialize flow
+   memset(victim, 0, sizeof(struct my_flow));
+   memcpy(victim->addr, addr, 16);
+   victim->family = sap->ss.ss_family;
+   victim->port   = ntohs(port);
+   victim->first  = *tsp;
+   victim->last   = *tsp;
+
+   return(victim);
+}
+
+
+// update flow statistics of received request
+void my_flow_update(struct my_flow * fp, struct udp_echo_plus * msgp, ssize_t ssize, int fmt, struct timespec * tsp)
+{
+   uint32_t                  seq;
+
+   fp->pkts++;
+   fp->bytes += (uint64_t)ssize;
+   fp->last   = *tsp;
+
+   // track echo plus sequence numbers
+   switch(fmt)
+   {
+      case MY_FMT_V1:    seq = ntohl(msgp->req_sn); break;
+      case MY_FMT_V2:    seq = ntohl(((struct udp_echo_plus2 *)msgp)->req_sn); break;
+      case MY_FMT_STAMP: seq = ntohl(((struct stamp_sender *)msgp)->seq); break;
+      default:           return;
+   };
+   if (fp->pkts == 1)
+      fp->seq = seq;
+   else if (seq == fp->seq)
+      fp->dups++;
+   else if ((int32_t)(seq - fp->seq) < 0)
+      fp->reorders++;
+   else
+   {
+      fp->gaps += (seq - fp->seq) - 1;
+      fp->seq   = seq;
+   };
+
+   return;
+}
+
+
+// record elapsed time in log2 histogram
+void my_hist_add(struct my_hist * hp, const struct timespec * start,
+   const struct timespec * end, unsigned count)
+{
+   int64_t                   ns;
+   unsigned                  idx;
+
+   ns  = ((int64_t)end->tv_sec - (int64_t)start->tv_sec) * 1000000000;
+   ns += (int64_t)end->tv_nsec - (int64_t)start->tv_nsec;
+   if (ns < 0)
+      ns = 0;
+
+   // bucket holds times up to 2^(idx + MY_HIST_SHIFT) nanoseconds
+   idx = 0;
+   if (ns >= (1LL << MY_HIST_SHIFT))
+      idx = (unsigned)(64 - __builtin_clzll((unsigned long long)ns)) - MY_HIST_SHIFT;
+   if (idx >= MY_HIST_BUCKETS)
+      idx = MY_HIST_BUCKETS - 1;
+
+   atomic_store_explicit(&hp->buckets[idx], atomic_load_explicit(&hp->buckets[idx], memory_order_relaxed) + count, memory_order_relaxed);
+   atomic_store_explicit(&hp->count, atomic_load_explicit(&hp->count, memory_order_relaxed) + count, memory_order_relaxed);
+   atomic_store_explicit(&hp->sum, atomic_load_explicit(&hp->sum, memory_order_relaxed) + ((uint64_t)ns * count), memory_order_relaxed);
+
+   return;
+}
+
+
+// compute reply delay from configured distribution
+useconds_t my_impair_delay(struct my_worker * wp, const struct my_policy * pol)
+{
+   double                    d;
+   double                    u;
+   double                    v;
+
+   switch(cnf.delay_dist)
+   {
+      // Box-Muller transform, mean of delay and standard deviation of jitter
+      case MY_DIST_NORMAL:
+      u = my_rand_unit(wp);
+      v = my_rand_unit(wp);
+      d = (double)pol->delay + ((double)pol->jitter * sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v));
+      break;
+
+      // Pareto (shape 3, unit scale) normalized to mean of delay and
+      // standard deviation of jitter, leaving a heavy tail of late replies
+      case MY_DIST_PARETO:
+      u = my_rand_unit(wp);
+      d = (double)pol->delay + ((double)pol->jitter * ((pow(u, -1.0 / 3.0) - 1.5) / 0.8660254037844386));
+      break;
+
+      // uniform, legacy behavior when jitter is zero
+      default:
+      if (!(pol->jitter))
+         return( ((pol->delay)) ? (useconds_t)(my_rand(wp) % pol->delay) : 0);
+      d = (double)pol->delay + ((double)pol->jitter * ((2.0 * my_rand_unit(wp)) - 1.0));
+      break;
+   };
+
+   if (d < 0.0)
+      return(0);
+   if (d > (double)MY_DELAY_MAX)
+      return(MY_DELAY_MAX);
+   return((useconds_t)d);
+}
+
+
+// determine if packet is lost, returns 1 when packet should be dropped
+int my_impair_loss(struct my_worker * wp, const struct my_policy * pol)
+{
+   if (!(pol->gemodel))
+      return(my_rand_chance(wp, pol->drop));
+
+   // Gilbert-Elliott: transition between good and bad state, then apply
+   // the loss probability of the current state
+   if (!(wp->ge_bad))
+      wp->ge_bad = my_rand_chance(wp, pol->ge_p);
+   else
+      wp->ge_bad = !(my_rand_chance(wp, pol->ge_r));
+
+   return(my_rand_chance(wp, ((wp->ge_bad)) ? pol->ge_h : pol->ge_k));
+}
+
+
+// add 16 bit words to one's complement sum, odd trailing byte is padded with zero
+uint64_t my_ip_sum(uint64_t sum, const uint8_t * data, size_t len)
+{
+   size_t                    pos;
+
+   for(pos = 0; ((pos + 1) < len); pos += 2)
+      sum += ((uint64_t)data[pos] << 8) | data[pos + 1];
+   if ((len & 1))
+      sum += (uint64_t)data[len - 1] << 8;
+
+   return(sum);
+}
+
+
+// fold one's complement sum into IP checksum
+uint16_t my_ip_sum_fold(uint64_t sum)
+{
+   while((sum >> 16))
+      sum = (sum & 0xffff) + (sum >> 16);
+   return((uint16_t)~sum);
+}
+
+
+// open or create packet journal, an existing journal of the same size and
+// listeners is appended to so history survives restarts
+int my_journal_open(const char * path, unsigned mb)
+{
+   int                       fd;
+   unsigned                  idx;
+   size_t                    size;
+   uint64_t                  records;
+   char                      rotated[512];
+   struct stat               sb;
+   struct udp_echo_journal * jp;
+   struct udp_echo_journal_listener  table[UDP_ECHO_JOURNAL_LISTENERS];
+
+   _Static_assert(sizeof(struct udp_echo_journal) == 2048, "journal header size");
+   _Static_assert(sizeof(struct udp_echo_journal_rec) == 64, "journal record size");
+   _Static_assert( (MY_SENT == UDP_ECHO_JOURNAL_SENT) && (MY_RECV == UDP_ECHO_JOURNAL_RECV) &&
+                   (MY_DROP == UDP_ECHO_JOURNAL_DROP) && (MY_DENY == UDP_ECHO_JOURNAL_DENY), "journal actions");
+   _Static_assert( (MY_FMT_V1 == UDP_ECHO_JOURNAL_FMT_V1) && (MY_FMT_V2 == UDP_ECHO_JOURNAL_FMT_V2) &&
+                   (MY_FMT_STAMP == UDP_ECHO_JOURNAL_FMT_STAMP), "journal formats");
+   _Static_assert(MY_LISTENERS_MAX <= UDP_ECHO_JOURNAL_LISTENERS, "journal listener slots");
+
+   records = (((uint64_t)mb << 20) - sizeof(struct udp_echo_journal)) / sizeof(struct udp_echo_journal_rec);
+   size    = sizeof(struct udp_echo_journal) + ((size_t)records * sizeof(struct udp_echo_journal_rec));
+
+   memset(table, 0, sizeof(table));
+   for(idx = 0; (idx < listeners_len); idx++)
+   {
+      switch(listeners[idx].sa.ss.ss_family)
+      {
+         case AF_INET:
+         table[idx].family = 4;
+         table[idx].port   = ntohs(listeners[idx].sa.sin.sin_port);
+         memcpy(table[idx].addr, &listeners[idx].sa.sin.sin_addr, 4);
+         break;
+
+         case AF_INET6:
+         table[idx].family = 6;
+         table[idx].port   = ntohs(listeners[idx].sa.sin6.sin6_port);
+         memcpy(table[idx].addr, &listeners[idx].sa.sin6.sin6_addr, 16);
+         break;
+
+         default:
+         break;
+      };
+   };
+
+   if ((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1)
+   {
+      my_error("open(%s): %s", path, strerror(errno));
+      return(-1);
+   };
+
+   // a running instance being taken over keeps writing its journal, which
+   // moves aside so this instance starts a new one
+   if (flock(fd, LOCK_EX | LOCK_NB) == -1)
+   {
+      close(fd);
+      if ( (errno != EWOULDBLOCK) || (!(cnf.takeover)) )
+      {
+         my_error("journal %s: in use by another process", path);
+         return(-1);
+      };
+      snprintf(rotated, sizeof(rotated), "%s.1", path);
+      if (rename(path, rotated) == -1)
+      {
+         my_error("rename(%s): %s", rotated, strerror(errno));
+         return(-1);
+      };
+      my_debug("moved journal of running instance to %s", rotated);
+      if ( ((fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) == -1) || (flock(fd, LOCK_EX | LOCK_NB) == -1) )
+      {
+         my_error("journal %s: %s", path, strerror(errno));
+         if (fd != -1)
+            close(fd);
+         return(-1);
+      };
+   };
+   if ( ((cnf.uid != getuid()) || (cnf.gid != getgid())) && (fchown(fd, cnf.uid, cnf.gid) == -1) )
+   {
+      my_error("fchown(): %s", strerror(errno));
+      close(fd);
+      return(-1);
+   };
+   if (fstat(fd, &sb) == -1)
+   {
+      my_error("fstat(): %s", strerror(errno));
+      close(fd);
+      return(-1);
+   };
+   if ( ((size_t)sb.st_size != size) && (ftruncate(fd, (off_t)size) == -1) )
+   {
+      my_error("ftruncate(): %s", strerror(errno));
+      close(fd);
+      return(-1);
+   };
+   if ((jp = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+   {
+      my_error("mmap(): %s", strerror(errno));
+      close(fd);
+      return(-1);
+   };
+
+   // records of a different layout or listener set are not comparable
+   if ( ((size_t)sb.st_size != size) ||
+        (jp->magic != UDP_ECHO_JOURNAL_MAGIC) ||
+        (jp->version != UDP_ECHO_JOURNAL_VERSION) ||
+        (jp->rec_size != sizeof(struct udp_echo_journal_rec)) ||
+        (jp->records != records) ||
+        (jp->listeners != listeners_len) ||
+        ((memcmp(jp->listener, table, sizeof(table)))) )
+   {
+      my_debug("starting new journal %s with %" PRIu64 " records", path, records);
+      memset(jp, 0, sizeof(struct udp_echo_journal));
+      jp->version   = UDP_ECHO_JOURNAL_VERSION;
+      jp->rec_size  = sizeof(struct udp_echo_journal_rec);
+      jp->records   = records;
+      jp->created   = (uint64_t)time(NULL);
+      jp->listeners = listeners_len;
+      memcpy(jp->listener, table, sizeof(table));
+      __atomic_store_n(&jp->magic, UDP_ECHO_JOURNAL_MAGIC, __ATOMIC_RELEASE);
+   } else
+   {
+      my_debug("appending to journal %s after %" PRIu64 " records", path, jp->head);
+   };
+
+   journal      = jp;
+   journal_size = size;
+   journal_fd   = fd;
+
+   return(0);
+}
+
+
+// append connection log record to packet journal, the logger thread is
+// the only writer so readers only need head to be published last
+void my_journal_write(const struct my_logrec * rec, unsigned worker)
+{
+   uint64_t                      head;
+   struct udp_echo_journal_rec * out;
+
+   head = journal->head;
+   out  = &journal->rec[head % journal->records];
+
+   out->time     = ((uint64_t)rec->ts.tv_sec * 1000000000ULL) + (uint64_t)rec->ts.tv_nsec;
+   out->conn     = (uint64_t)rec->conn;
+   out->size     = (rec->ssize > 0) ? (uint32_t)rec->ssize : 0;
+   out->seq      = rec->seq;
+   out->delay    = (uint32_t)rec->delay;
+   out->delta    = rec->delta;
+   out->port     = rec->port;
+   out->worker   = (uint16_t)worker;
+   out->family   = (rec->family == AF_INET) ? 4 : 6;
+   out->action   = rec->mode;
+   out->format   = rec->echoplus;
+   out->listener = rec->listener;
+   memcpy(out->addr, rec->addr, sizeof(out->addr));
+   memset(out->reserved, 0, sizeof(out->reserved));
+
+   __atomic_store_n(&journal->head, head + 1, __ATOMIC_RELEASE);
+
+   return;
+}
+
+
+// queue connection log record for logger thread
+int my_log_conn(struct my_worker * wp, int mode, union my_sa * sap,
+   struct udp_echo_plus * msgp, ssize_t ssize, int fmt, struct timespec * tsp,
+   useconds_t delay)
+{
+   size_t                     head;
+   struct my_logring        * ring;
+   struct my_logrec         * rec;
+   struct udp_echo_plus2    * v2;
+   struct stamp_reflector   * refl;
+   uint64_t                   ntp;
+
+   // sampled requests and their replies are captured with payloads
+   if ( ((wp->cap)) && ((mode == MY_RECV) || (mode == MY_SENT)) && (!(wp->conn % atomic_load_explicit(&cnf.capture_sample, memory_order_relaxed))) )
+      my_capture(wp, mode, sap, (const uint8_t *)msgp, ssize, tsp);
+
+   // never block the echo path, drop record when logger falls behind
+   ring = wp->log;
+   head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+   if ((head - atomic_load_explicit(&ring->tail, memory_order_acquire)) >= MY_LOG_RING)
+   {
+      atomic_store_explicit(&ring->dropped, atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1, memory_order_relaxed);
+      return(-1);
+   };
+   rec = &ring->recs[head & (MY_LOG_RING - 1)];
+
+   rec->mode     = (uint8_t)mode;
+   rec->listener = (uint8_t)wp->sock->listener;
+   rec->echoplus = (uint8_t)fmt;
+   rec->conn     = wp->conn;
+   rec->ssize    = ssize;
+   rec->ts       = *tsp;
+   rec->delay    = delay;
+   rec->family   = (uint8_t)sap->ss.ss_family;
+   switch(sap->ss.ss_family)
+   {
+      case AF_INET:
+      memcpy(rec->addr, &sap->sin.sin_addr, 4);
+      rec->port = ntohs(sap->sin.sin_port);
+      break;
+
+      case AF_INET6:
+      memcpy(rec->addr, &sap->sin6.sin6_addr, 16);
+      rec->port = ntohs(sap->sin6.sin6_port);
+      break;
+
+      default:
+      break;
+   };
+   switch(rec->echoplus)
+   {
+      case MY_FMT_V1:
+      rec->seq   = ntohl(msgp->req_sn);
+      rec->delta = ntohl(msgp->reply_time) - ntohl(msgp->recv_time);
+      break;
+
+      case MY_FMT_V2:
+      v2         = (struct udp_echo_plus2 *)msgp;
+      rec->seq   = ntohl(v2->req_sn);
+      rec->delta = (uint32_t)((be64toh(v2->reply_time) - be64toh(v2->recv_time)) / 1000);
+      break;
+
+      // reflector timestamps are only present once the reply is built
+      case MY_FMT_STAMP:
+      refl       = (struct stamp_reflector *)msgp;
+      ntp        = ((uint64_t)ntohl(refl->ts_sec) << 32) | ntohl(refl->ts_frac);
+      ntp       -= ((uint64_t)ntohl(refl->rx_sec) << 32) | ntohl(refl->rx_frac);
+      rec->seq   = ntohl(refl->seq);
+      rec->delta = (mode == MY_SENT) ? (uint32_t)(((ntp >> 12) * 1000000) >> 20) : 0;
+      break;
+
+      default:
+      rec->seq   = 0;
+      rec->delta = 0;
+      break;
+   };
+
+   atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+   return(0);
+}
+
+
+// format connection log record
+void my_log_format(struct my_logrec * rec)
+{
+   const char               * mode_name;
+   char                       addr_str[INET6_ADDRSTRLEN];
+   char                       server[sizeof(listeners[0].name) + 16];
+
+   // determine log entry type
+   switch(rec->mode)
+   {
+      case MY_SENT: mode_name = "sent"; break;
+      case MY_RECV: mode_name = "recv"; break;
+      case MY_DROP: mode_name = "drop"; break;
+      case MY_DENY: mode_name = "deny"; break;
+      default: return;
+   };
+
+   // convert address to presentation format
+   switch(rec->family)
+   {
+      case AF_INET:
+      case AF_INET6:
+      inet_ntop(rec->family, rec->addr, addr_str, sizeof(addr_str));
+      break;
+
+      default:
+      my_log_write(LOG_DEBUG, "conn %zu: ignoring request from unknown address family: %i", rec->conn, rec->family);
+      return;
+   };
+
+   // name listener only when there is more than one
+   server[0] = '\0';
+   if (listeners_len > 1)
+      snprintf(server, sizeof(server), " server: %s;", listeners[rec->listener].name);
+
+   // log connection
+   if ((rec->echoplus))
+   {
+      my_log_write(LOG_INFO,
+         "conn %zu: client: [%s]:%hu;%s %s bytes: %zi; timestamp: %lu.%09lu; seq: %u; delta: %u us; delay: %u us;",
+         rec->conn,
+         addr_str,
+         rec->port,
+         server,
+         mode_name,
+         rec->ssize,
+         rec->ts.tv_sec,
+         rec->ts.tv_nsec,
+         rec->seq,
+         rec->delta,
+         rec->delay
+      );
+   } else
+   {
+      my_log_write(LOG_INFO,
+         "conn %zu: client: [%s]:%hu;%s %s bytes: %zi; timestamp: %lu.%09lu;",
+         rec->conn,
+         addr_str,
+         rec->port,
+         server,
+         mode_name,
+         rec->ssize,
+         rec->ts.tv_sec,
+         rec->ts.tv_nsec
+      );
+   };
+
+   // log if IPv4 address mapped to IPv6
+   if (rec->family == AF_INET6)
+      if (rec->mode == MY_RECV)
+         if (IN6_IS_ADDR_V4MAPPED((struct in6_addr *)rec->addr) != 0)
+            my_log_write(LOG_INFO, "conn %zu: client: [%s]:%hu; IPv4 mapped address", rec->conn, addr_str, rec->port);
+
+   return;
+}
+
+
+// write log message to syslog or log file
+void my_log_write(int priority, const char * fmt, ...)
+{
+   va_list                    args;
+   time_t                     now;
+   struct tm                  tm;
+   char                       stamp[32];
+
+   va_start(args, fmt);
+   if (!(logfs))
+   {
+      vsyslog(priority, fmt, args);
+      va_end(args);
+      return;
+   };
+   now = time(NULL);
+   localtime_r(&now, &tm);
+   strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+   fprintf(logfs, "%s %s[%i]: ", stamp, cnf.prog_name, (int)getpid());
+   vfprintf(logfs, fmt, args);
+   fprintf(logfs, "\n");
+   va_end(args);
+
+   return;
+}
+
+
+// logger thread
+void * my_logger_main(void * arg)
+{
+   int                        stop;
+   unsigned                   pos;
+   size_t                     count;
+   size_t                     head;
+   size_t                     tail;
+   uint64_t                   dropped;
+   struct my_logring        * ring;
+   struct timespec            ts;
+
+   (void)arg;
+
+   while(1)
+   {
+      // check stop flag first so records queued before stopping are drained
+      stop  = logger_stop;
+      count = 0;
+
+      for(pos = 0; (pos < cnf.workers); pos++)
+      {
+         ring = workers[pos].log;
+         tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+         head = atomic_load_explicit(&ring->head, memory_order_acquire);
+         for(; (tail != head); tail++, count++)
+         {
+            if ((journal))
+               my_journal_write(&ring->recs[tail & (MY_LOG_RING - 1)], pos);
+            else
+               my_log_format(&ring->recs[tail & (MY_LOG_RING - 1)]);
+         };
+         atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+         // report overflow
+         dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+         if (dropped != ring->reported)
+         {
+            my_log_write(LOG_WARNING, "worker %u: %" PRIu64 " log records dropped", pos, dropped - ring->reported);
+            if ((journal))
+               __atomic_store_n(&journal->dropped, journal->dropped + (dropped - ring->reported), __ATOMIC_RELAXED);
+            ring->reported = dropped;
+         };
+      };
+      if (logfs)
+         fflush(logfs);
+
+      if ((stop))
+         break;
+      if (!(count))
+      {
+         ts.tv_sec  = 0;
+         ts.tv_nsec = MY_LOG_INTERVAL;
+         nanosleep(&ts, NULL);
+      };
+   };
+
+   return(NULL);
+}
+
+
+// process received echo request
+int my_echo(struct my_worker * wp, union my_sa * sap, struct udp_echo_plus * msgp,
+   ssize_t ssize, struct timespec * tsp, useconds_t * delayp, uint8_t * fmtp)
+{
+   uint64_t                   us;
+   uint64_t                   bit;
+   struct my_rules          * rp;
+   struct my_flow           * fp;
+   uint64_t                   ntp;
+   uint32_t                   seq;
+   uint32_t                   sec;
+   uint32_t                   frac;
+   uint16_t                   err;
+   struct udp_echo_plus2    * v2;
+   struct stamp_sender      * sndr;
+   struct stamp_reflector   * refl;
+   const struct my_policy   * pol;
+   int                        fmt;
+
+   us  = (uint64_t)(tsp->tv_sec * 1000000);
+   us += (uint64_t)tsp->tv_nsec / 1000;
+
+   // header format is detected once, replies are stamped with the same
+   // format even if echo plus is toggled before they are sent
+   pol   = atomic_load(&policy);
+   fmt   = my_echo_format(msgp, ssize, pol->echoplus);
+   *fmtp = (uint8_t)fmt;
+
+   // log connection
+   my_log_conn(wp, MY_RECV, sap, msgp, ssize, fmt, tsp, 0);
+   MY_STAT_INC(wp, MY_STAT_RX_PKTS,  1);
+   MY_STAT_INC(wp, MY_STAT_RX_BYTES, ssize);
+   MY_PROF(wp, MY_PROF_LOG);
+
+   // update client statistics
+   if ((fp = my_flow_lookup(wp, sap, tsp)) != NULL)
+      my_flow_update(fp, msgp, ssize, fmt, tsp);
+
+   // apply policy of source prefix, unmatched sources are refused
+   if ((rp = atomic_load(&rules)) != NULL)
+   {
+      if ( ((pol = my_rules_lookup(rp, sap)) == NULL) || ((pol->deny)) )
+      {
+         my_log_conn(wp, MY_DENY, sap, msgp, ssize, fmt, tsp, 0);
+         MY_STAT_INC(wp, MY_STAT_DENIES, 1);
+         if ((fp))
+            fp->drops++;
+         return(MY_DROP);
+      };
+   };
+
+   // process echo+ packet, v2 requests are detected by magic and version
+   switch(fmt)
+   {
+      case MY_FMT_V1:
+      msgp->res_sn    = msgp->req_sn;
+      msgp->recv_time = htonl(us & 0xFFFFFFFFLL);
+      msgp->failures  = 0;
+      break;
+
+      case MY_FMT_V2:
+      v2             = (struct udp_echo_plus2 *)msgp;
+      v2->flags      = UDP_ECHO_PLUS_F_REPLY;
+      v2->flags     |= ((wp->kstamp)) ? UDP_ECHO_PLUS_F_KERNEL : 0;
+      v2->server_id  = htons(cnf.server_id);
+      v2->res_sn     = v2->req_sn;
+      v2->recv_time  = htobe64(((uint64_t)tsp->tv_sec * 1000000000) + (uint64_t)tsp->tv_nsec);
+      v2->failures   = htonl(((fp)) ? (uint32_t)fp->drops : 0);
+      break;
+
+      // stateless reflector, sender fields are saved before the reflector
+      // header overwrites them
+      case MY_FMT_STAMP:
+      sndr               = (struct stamp_sender *)msgp;
+      refl               = (struct stamp_reflector *)msgp;
+      seq                = sndr->seq;
+      sec                = sndr->ts_sec;
+      frac               = sndr->ts_frac;
+      err                = sndr->error;
+      ntp                = my_ntp_time(tsp);
+      refl->seq          = seq;
+      refl->error        = htons(atomic_load_explicit(&stamp_error, memory_order_relaxed));
+      refl->mbz1         = 0;
+      refl->rx_sec       = htonl((uint32_t)(ntp >> 32));
+      refl->rx_frac      = htonl((uint32_t)ntp);
+      refl->sender_seq   = seq;
+      refl->sender_sec   = sec;
+      refl->sender_frac  = frac;
+      refl->sender_error = err;
+      refl->mbz2         = 0;
+      refl->sender_ttl   = wp->ttl;
+      memset(refl->mbz3, 0, sizeof(refl->mbz3));
+      break;
+
+      // test packets shorter than the base STAMP packet are not reflected
+      default:
+      if (cnf.mode == MY_MODE_STAMP)
+      {
+         my_log_conn(wp, MY_DROP, sap, msgp, ssize, fmt, tsp, 0);
+         MY_STAT_INC(wp, MY_STAT_DROPS, 1);
+         if ((fp))
+            fp->drops++;
+         return(MY_DROP);
+      };
+      break;
+   };
+
+   // randomly drop packets
+   if (my_impair_loss(wp, pol))
+   {
+      my_log_conn(wp, MY_DROP, sap, msgp, ssize, fmt, tsp, 0);
+      MY_STAT_INC(wp, MY_STAT_DROPS, 1);
+      if ((fp))
+         fp->drops++;
+      return(MY_DROP);
+   };
+
+   // flip one random bit
+   if ( (ssize > 0) && (my_rand_chance(wp, pol->corrupt)) )
+   {
+      bit = my_rand(wp) % ((uint64_t)ssize * 8);
+      ((uint8_t *)msgp)[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+   };
+
+   // reorder by holding reply back so later replies overtake it
+   *delayp = my_impair_delay(wp, pol);
+   if (my_rand_chance(wp, pol->reorder))
+      *delayp += cnf.reorder_gap;
+
+   // queue copy of reply, sent no earlier than the original
+   if (my_rand_chance(wp, pol->duplicate))
+      my_delay_push(wp, sap, msgp, ssize, fmt, tsp, *delayp);
+
+   // schedule delayed reply, drop request if packet pool is exhausted
+   if (*delayp > 0)
+   {
+      if (my_delay_push(wp, sap, msgp, ssize, fmt, tsp, *delayp) == -1)
+      {
+         my_log_conn(wp, MY_DROP, sap, msgp, ssize, fmt, tsp, *delayp);
+         MY_STAT_INC(wp, MY_STAT_DROPS, 1);
+         if ((fp))
+            fp->drops++;
+         return(MY_DROP);
+      };
+      return(MY_DELAY);
+   };
+
+   return(MY_SENT);
+}
+
+
+// set echo plus reply timestamp of each segment immediately before transmit
+void my_echo_reply_time(struct udp_echo_plus * msgp, ssize_t ssize, size_t seg,
+   const uint8_t * fmts, const struct timespec * tsp)
+{
+   ssize_t                    off;
+   uint64_t                   us;
+   uint64_t                   ntp;
+
+   // segments of a reply train are stamped individually
+   if ( ((seg)) && ((size_t)ssize > seg) )
+   {
+      for(off = 0; (off < ssize); off += (ssize_t)seg)
+         my_echo_reply_time((struct udp_echo_plus *)((uint8_t *)msgp + off), ((ssize - off) > (ssize_t)seg) ? (ssize_t)seg : (ssize - off), 0, &fmts[(size_t)off / seg], tsp);
+      return;
+   };
+
+   // format was detected once when the request arrived
+   switch(fmts[0])
+   {
+      case MY_FMT_V1:
+      us  = (uint64_t)(tsp->tv_sec * 1000000);
+      us += (uint64_t)tsp->tv_nsec / 1000;
+      msgp->reply_time = htonl(us & 0xFFFFFFFFLL);
+      break;
+
+      case MY_FMT_V2:
+      ((struct udp_echo_plus2 *)msgp)->reply_time = htobe64(((uint64_t)tsp->tv_sec * 1000000000) + (uint64_t)tsp->tv_nsec);
+      break;
+
+      case MY_FMT_STAMP:
+      ntp = my_ntp_time(tsp);
+      ((struct stamp_reflector *)msgp)->ts_sec  = htonl((uint32_t)(ntp >> 32));
+      ((struct stamp_reflector *)msgp)->ts_frac = htonl((uint32_t)ntp);
+      break;
+
+      default:
+      break;
+   };
+
+   return;
+}
+
+
+// echo each segment of GRO coalesced datagram, compacting surviving replies
+int my_echo_train(struct my_worker * wp, union my_sa * sap, uint8_t * buff,
+   ssize_t * sizep, size_t seg, struct timespec * tsp, useconds_t * delayp,
+   uint8_t * fmts)
+{
+   ssize_t                    off;
+   ssize_t                    len;
+   ssize_t                    out;
+
+   if ( (!(seg)) || ((size_t)*sizep <= seg) )
+      return(my_echo(wp, sap, (struct udp_echo_plus *)buff, *sizep, tsp, delayp, fmts));
+
+   // segments beyond the format table are discarded
+   if ((size_t)*sizep > (seg * MY_TRAIN_SEGS))
+   {
+      MY_STAT_INC(wp, MY_STAT_TRUNCATED, 1);
+      *sizep = (ssize_t)(seg * MY_TRAIN_SEGS);
+   };
+
+   // only the final segment may be short, so compacting the replies in
+   // order keeps the train valid for UDP_SEGMENT
+   for(off = 0, out = 0; (off < *sizep); off += len)
+   {
+      len = ((*sizep - off) > (ssize_t)seg) ? (ssize_t)seg : (*sizep - off);
+      if ((off))
+         wp->conn++;
+      if (my_echo(wp, sap, (struct udp_echo_plus *)&buff[off], len, tsp, delayp, &fmts[(size_t)out / seg]) != MY_SENT)
+         continue;
+      if (out != off)
+         memmove(&buff[out], &buff[off], (size_t)len);
+      out += len;
+   };
+   *sizep  = out;
+   *delayp = 0;
+
+   return(((out)) ? MY_SENT : MY_DROP);
+}
+
+
+// determine header format of request, returns MY_FMT_NONE if echoed unmodified
+int my_echo_format(struct udp_echo_plus * msgp, ssize_t ssize, int echoplus)
+{
+   struct udp_echo_plus2    * v2;
+
+   if (cnf.mode == MY_MODE_STAMP)
+      return( (ssize >= (ssize_t)sizeof(struct stamp_sender)) ? MY_FMT_STAMP : MY_FMT_NONE);
+   if ( (!(echoplus)) || (ssize < (ssize_t)sizeof(struct udp_echo_plus)) )
+      return(MY_FMT_NONE);
+   v2 = (struct udp_echo_plus2 *)msgp;
+   if ( (ssize >= (ssize_t)sizeof(struct udp_echo_plus2)) &&
+        (v2->magic == htonl(UDP_ECHO_PLUS_MAGIC)) && (v2->version == UDP_ECHO_PLUS_VERSION) )
+      return(MY_FMT_V2);
+   return(MY_FMT_V1);
+}
+
+
+// extract GRO segment size from ancillary data, returns 0 if not coalesced
+size_t my_gro_rx(struct msghdr * hdr)
+{
+#ifdef UDP_GRO
+   int                       seg;
+   struct cmsghdr          * cmsg;
+
+   if (!(cnf.gro))
+      return(0);
+   for(cmsg = CMSG_FIRSTHDR(hdr); (cmsg != NULL); cmsg = CMSG_NXTHDR(hdr, cmsg))
+   {
+      if ( (cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO) &&
+           (cmsg->cmsg_len >= CMSG_LEN(sizeof(int))) )
+      {
+         memcpy(&seg, CMSG_DATA(cmsg), sizeof(int));
+         return((seg > 0) ? (size_t)seg : 0);
+      };
+   };
+#else
+   (void)hdr;
+#endif
+   return(0);
+}
+
+
+// resolve listen addresses and ports into listeners
+int my_listeners_init(void)
+{
+   int                       rc;
+   unsigned                  pos;
+   unsigned                  count;
+   unsigned                  port;
+   struct my_listener      * lp;
+
+   // every address listens on every port, all addresses when none are given
+   listeners_len = 0;
+   count         = ((cnf.listen_len)) ? cnf.listen_len : 1;
+   for(pos = 0; (pos < count); pos++)
+   {
+      for(port = 0; (port < cnf.ports_len); port++)
+      {
+         lp = &listeners[listeners_len++];
+         bzero(lp, sizeof(struct my_listener));
+         if (!(cnf.listen_len))
+         {
+            lp->sa.sin6.sin6_family = AF_INET6;
+            lp->sa.sin6.sin6_addr   = in6addr_any;
+            lp->sa.sin6.sin6_port   = htons(cnf.ports[port]);
+            lp->salen               = sizeof(struct sockaddr_in6);
+         } else if ((rc = inet_pton(AF_INET, cnf.listen[pos], &lp->sa.sin.sin_addr)) == 1)
+         {
+            lp->sa.sin.sin_family   = AF_INET;
+            lp->sa.sin.sin_port     = htons(cnf.ports[port]);
+            lp->salen               = sizeof(struct sockaddr_in);
+         } else if ((rc = inet_pton(AF_INET6, cnf.listen[pos], &lp->sa.sin6.sin6_addr)) == 1)
+         {
+            lp->sa.sin6.sin6_family = AF_INET6;
+            lp->sa.sin6.sin6_port   = htons(cnf.ports[port]);
+            lp->salen               = sizeof(struct sockaddr_in6);
+         } else
+         {
+            if (rc == -1)
+               my_error("inet_pton(): %s", strerror(errno));
+            else
+               my_error("invalid address specified with `-l': %s", cnf.listen[pos]);
+            return(-1);
+         };
+      };
+   };
+
+   return(0);
+}
+
+
+// log each segment of reply train
+void my_log_train(struct my_worker * wp, int mode, union my_sa * sap,
+   uint8_t * buff, ssize_t ssize, size_t seg, const uint8_t * fmts,
+   struct timespec * tsp, useconds_t delay)
+{
+   ssize_t                    off;
+   ssize_t                    len;
+
+   if (!(seg))
+      seg = (size_t)ssize;
+   for(off = 0; (off < ssize); off += len)
+   {
+      len = ((ssize - off) > (ssize_t)seg) ? (ssize_t)seg : (ssize - off);
+      my_log_conn(wp, mode, sap, (struct udp_echo_plus *)&buff[off], len, fmts[(size_t)off / seg], tsp, delay);
+   };
+   return;
+}
+
+
+// main loop
+int my_loop(struct my_worker * wp)
+{
+   int                        rc;
+   int                        timeout;
+   unsigned                   idx;
+   struct pollfd              fds[MY_LISTENERS_MAX];
+
+   // setup poller
+   for(idx = 0; (idx < listeners_len); idx++)
+   {
+      fds[idx].fd      = wp->socks[idx].s;
+      fds[idx].events  = POLLIN;
+      fds[idx].revents = 0;
+   };
+   timeout = my_delay_run(wp, 5000);
+   my_worker_idle(wp);
+   MY_PROF_BEGIN(wp);
+   rc = poll(fds, listeners_len, timeout);
+   MY_PROF(wp, MY_PROF_WAIT);
+   my_worker_quiesce(wp);
+   my_errqueue_drain(wp);
+   if (rc == 0)
+      my_shm_publish(wp, 1);
+   if (rc < 1)
+      return(0);
+
+   for(idx = 0; (idx < listeners_len); idx++)
+   {
+      if (!(fds[idx].revents))
+         continue;
+#ifdef MSG_WAITFORONE
+      if ((wp->batch))
+      {
+         my_recv_batch(wp, &wp->socks[idx]);
+         continue;
+      };
+#endif
+      my_recv(wp, &wp->socks[idx]);
+   };
+
+   return(0);
+}
+
+
+// main loop spinning on non-blocking receives
+int my_loop_busy(struct my_worker * wp)
+{
+   unsigned                   spins;
+   unsigned                   idx;
+
+   // worker never blocks, so it passes a quiescent point on every spin,
+   // receive errors are already counted and do not stop the loop
+   for(spins = 0; (!(should_stop)); spins++)
+   {
+      my_worker_quiesce(wp);
+      my_delay_run(wp, 0);
+      if (!(spins & (MY_BUSY_DRAIN - 1)))
+         my_errqueue_drain(wp);
+      for(idx = 0; (idx < listeners_len); idx++)
+      {
+#ifdef MSG_WAITFORONE
+         if ((wp->batch))
+         {
+            my_recv_batch(wp, &wp->socks[idx]);
+            continue;
+         };
+#endif
+         my_recv(wp, &wp->socks[idx]);
+      };
+   };
+
+   return(0);
+}
+
+
+#ifdef EPOLLET
+// main loop using edge triggered epoll
+int my_loop_epoll(struct my_worker * wp)
+{
+   int                        rc;
+   int                        pos;
+   int                        timeout;
+   unsigned                   idx;
+   unsigned                   len;
+   unsigned                   reads;
+   unsigned                   spins;
+   struct my_sock           * sp;
+   struct epoll_event         events[MY_EPOLL_EVENTS];
+
+   // edge triggered epoll does not report sockets left with unread
+   // datagrams again, so only block once the ready list is empty
+   timeout = my_delay_run(wp, 5000);
+   if ((wp->ready_len))
+      timeout = 0;
+   my_worker_idle(wp);
+   MY_PROF_BEGIN(wp);
+   rc = epoll_wait(wp->epfd, events, MY_EPOLL_EVENTS, timeout);
+   MY_PROF(wp, MY_PROF_WAIT);
+   my_worker_quiesce(wp);
+   my_errqueue_drain(wp);
+   if ( (rc == 0) && (!(wp->ready_len)) )
+      my_shm_publish(wp, 1);
+
+   // newly readable sockets queue behind those left by the previous pass
+   for(pos = 0; (pos < rc); pos++)
+   {
+      sp = events[pos].data.ptr;
+      if ((sp->ready))
+         continue;
+      sp->ready = 1;
+      wp->ready[wp->ready_len++] = (unsigned)(sp - wp->socks);
+   };
+
+   // serve ready sockets in turn with a bounded number of receives each,
+   // so one flooded listener cannot starve the others, reading transmit
+   // timestamps as the busy poll loop does
+   len   = wp->ready_len;
+   spins = 0;
+   for(idx = 0, wp->ready_len = 0; (idx < len); idx++)
+   {
+      sp = &wp->socks[wp->ready[idx]];
+      for(reads = 0; ( (reads < MY_EPOLL_READS) && (!(should_stop)) ); reads++)
+      {
+         my_worker_quiesce(wp);
+         my_delay_run(wp, 0);
+         if (!(++spins & (MY_BUSY_DRAIN - 1)))
+            my_errqueue_drain(wp);
+#ifdef MSG_WAITFORONE
+         if ((wp->batch))
+         {
+            if ( (my_recv_batch(wp, sp) == -1) && (errno != EINTR) )
+               break;
+            continue;
+         };
+#endif
+         if ( (my_recv(wp, sp) == -1) && (errno != EINTR) )
+            break;
+      };
+
+      // socket keeps its place until the kernel queue is drained
+      if (reads < MY_EPOLL_READS)
+         sp->ready = 0;
+      else
+         wp->ready[wp->ready_len++] = wp->ready[idx];
+   };
+
+   return(0);
+}
+#endif
+
+
+// create metrics listener on address:port or UNIX socket path
+int my_metrics_open(const char * spec)
+{
+   int                       s;
+   int                       rc;
+   int                       opt;
+   char                      host[256];
+   char                    * port;
+   struct stat               sb;
+   struct sockaddr_un        sun;
+   struct addrinfo           hints;
+   struct addrinfo         * res;
+
+   // UNIX domain socket
+   if ((strchr(spec, '/')))
+   {
+      if (strlen(spec) >= sizeof(sun.sun_path))
+      {
+         my_error("metrics socket path too long");
+         return(-1);
+      };
+      memset(&sun, 0, sizeof(sun));
+      sun.sun_family = AF_UNIX;
+      strncpy(sun.sun_path, spec, sizeof(sun.sun_path)-1);
+      if ( (stat(spec, &sb) == 0) && (S_ISSOCK(sb.st_mode)) )
+         unlink(spec);
+      if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+      {
+         my_error("socket(): %s", strerror(errno));
+         return(-1);
+      };
+      if (bind(s, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+      {
+         my_error("bind(%s): %s", spec, strerror(errno));
+         close(s);
+         return(-1);
+      };
+      metrics_path = spec;
+   } else
+   {
+      // split address and port, address may be enclosed in brackets
+      strncpy(host, spec, sizeof(host)-1);
+      host[sizeof(host)-1] = '\0';
+      if ((port = strrchr(host, ':')) == NULL)
+      {
+         my_error("invalid metrics listener `%s'", spec);
+         return(-1);
+      };
+      *port++ = '\0';
+      if ( (host[0] == '[') && (port[-2] == ']') )
+      {
+         port[-2] = '\0';
+         memmove(host, &host[1], strlen(host));
+      };
+
+      memset(&hints, 0, sizeof(hints));
+      hints.ai_family   = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      hints.ai_flags    = AI_PASSIVE;
+      if ((rc = getaddrinfo(((host[0])) ? host : NULL, port, &hints, &res)) != 0)
+      {
+         my_error("getaddrinfo(%s): %s", spec, gai_strerror(rc));
+         return(-1);
+      };
+      if ((s = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) == -1)
+      {
+         my_error("socket(): %s", strerror(errno));
+         freeaddrinfo(res);
+         return(-1);
+      };
+      opt = 1;
+      setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (void *)&opt, sizeof(int));
+#ifdef SO_REUSEPORT
+      // a new instance binds the port before the instance it replaces exits
+      setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (void *)&opt, sizeof(int));
+#endif
+      if (bind(s, res->ai_addr, res->ai_addrlen) == -1)
+      {
+         my_error("bind(%s): %s", spec, strerror(errno));
+         freeaddrinfo(res);
+         close(s);
+         return(-1);
+      };
+      freeaddrinfo(res);
+   };
+
+   if (listen(s, 16) == -1)
+   {
+      my_error("listen(): %s", strerror(errno));
+      close(s);
+      return(-1);
+   };
+   fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+
+   return(s);
+}
+
+
+// serve metrics request
+void my_metrics_serve(void)
+{
+   int                       c;
+   int                       len;
+   ssize_t                   ssize;
+   const char              * status;
+   char                      req[1024];
+   char                      hdr[128];
+   struct pollfd             fds[1];
+
+   if ((c = accept(metrics_s, NULL, NULL)) == -1)
+      return;
+   fds[0].events  = POLLIN;
+   fds[0].revents = 0;
+
+   // bound the time a stalled client can hold up the main thread
+   fds[0].fd = c;
+   if ( (poll(fds, 1, MY_METRICS_TIMEOUT) < 1) || ((ssize = read(c, req, sizeof(req)-1)) < 1) )
+   {
+      close(c);
+      return;
+   };
+   req[ssize] = '\0';
+
+   // render metrics
+   status = "404 Not Found";
+   len    = 0;
+   if ( (!(strncmp(req, "GET /metrics ", 13))) || (!(strncmp(req, "GET / ", 6))) )
+   {
+      status = "200 OK";
+      if ((len = (int)my_metrics_render(metrics_buff, metrics_size)) == -1)
+      {
+         status = "500 Internal Server Error";
+         len    = 0;
+      };
+   };
+
+   snprintf(hdr, sizeof(hdr), "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %i\r\n\r\n", status, len);
+   send(c, hdr, strlen(hdr), MSG_NOSIGNAL);
+   send(c, metrics_buff, (size_t)len, MSG_NOSIGNAL);
+   close(c);
+
+   return;
+}
+
+
+// merge worker statistics into Prometheus text format
+ssize_t my_metrics_render(char * buff, size_t size)
+{
+   unsigned                  idx;
+   size_t                    len;
+   uint64_t                  cumulative;
+   uint64_t                * val;
+   const uint64_t          * base;
+   unsigned                  h;
+   unsigned                  l;
+   struct my_totals          t;
+
+   static const char * names[MY_STAT_COUNTERS][2] =
+   {
+      { "received_packets_total",  "Echo requests received" },
+      { "received_bytes_total",    "Echo request payload bytes received" },
+      { "sent_packets_total",      "Echo replies sent" },
+      { "sent_bytes_total",        "Echo reply payload bytes sent" },
+      { "dropped_packets_total",   "Echo requests dropped by impairments or a full delay pool" },
+      { "denied_packets_total",    "Echo requests refused by policy rules" },
+      { "truncated_packets_total", "Echo requests larger than the receive buffer" },
+      { "receive_errors_total",    "Socket receive errors" },
+      { "send_errors_total",       "Socket send errors" },
+      { "zerocopy_packets_total",  "Echo replies sent with zero copy transmit" },
+      { "zerocopy_copied_total",   "Zero copy replies the kernel copied anyway" },
+      { "socket_dropped_packets_total", "Echo requests dropped by the kernel on a full socket receive queue" },
+   };
+
+   static const char * hist_names[MY_HIST_COUNT][2] =
+   {
+      { "service_time_seconds",    "Time from receiving a request to sending its reply, excluding injected delay" },
+      { "residence_time_seconds",  "Time from receive timestamp of a request to transmit timestamp of its reply, including injected delay" },
+   };
+
+   // merge per worker shards, reported relative to the last reset
+   my_stats_merge(&t);
+   val  = (uint64_t *)&t;
+   base = (const uint64_t *)&stats_base;
+   for(idx = 0; (idx < (sizeof(t) / sizeof(uint64_t))); idx++)
+      val[idx] -= base[idx];
+
+   len = 0;
+#define MY_APPEND(...) do { if (len < size) len += (size_t)snprintf(&buff[len], size - len, __VA_ARGS__); } while(0)
+   for(idx = 0; (idx < MY_STAT_COUNTERS); idx++)
+   {
+      MY_APPEND("# HELP akcom_udpechod_%s %s\n", names[idx][0], names[idx][1]);
+      MY_APPEND("# TYPE akcom_udpechod_%s counter\n", names[idx][0]);
+      MY_APPEND("akcom_udpechod_%s %" PRIu64 "\n", names[idx][0], t.counters[idx]);
+   };
+   for(idx = 0; (idx < MY_STAT_COUNTERS); idx++)
+   {
+      MY_APPEND("# HELP akcom_udpechod_listener_%s %s, per listen address\n", names[idx][0], names[idx][1]);
+      MY_APPEND("# TYPE akcom_udpechod_listener_%s counter\n", names[idx][0]);
+      for(l = 0; (l < listeners_len); l++)
+         MY_APPEND("akcom_udpechod_listener_%s{listener=\"%s\"} %" PRIu64 "\n", names[idx][0], listeners[l].name, t.listeners[l][idx]);
+   };
+   MY_APPEND("# HELP akcom_udpechod_log_records_dropped_total Connection log records discarded on overflow\n");
+   MY_APPEND("# TYPE akcom_udpechod_log_records_dropped_total counter\n");
+   MY_APPEND("akcom_udpechod_log_records_dropped_total %" PRIu64 "\n", t.log_dropped);
+   MY_APPEND("# HELP akcom_udpechod_workers Worker threads\n");
+   MY_APPEND("# TYPE akcom_udpechod_workers gauge\n");
+   MY_APPEND("akcom_udpechod_workers %u\n", cnf.workers);
+
+   // bucket upper bounds are powers of two nanoseconds
+   for(h = 0; (h < MY_HIST_COUNT); h++)
+   {
+      MY_APPEND("# HELP akcom_udpechod_%s %s\n", hist_names[h][0], hist_names[h][1]);
+      MY_APPEND("# TYPE akcom_udpechod_%s histogram\n", hist_names[h][0]);
+      for(idx = 0, cumulative = 0; (idx < (MY_HIST_BUCKETS - 1)); idx++)
+      {
+         cumulative += t.hist[h][idx];
+         MY_APPEND("akcom_udpechod_%s_bucket{le=\"%.12g\"} %" PRIu64 "\n", hist_names[h][0], (double)(1ULL << (idx + MY_HIST_SHIFT)) / 1e9, cumulative);
+      };
+      MY_APPEND("akcom_udpechod_%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", hist_names[h][0], t.hist_count[h]);
+      MY_APPEND("akcom_udpechod_%s_sum %.9f\n", hist_names[h][0], (double)t.hist_sum[h] / 1e9);
+      MY_APPEND("akcom_udpechod_%s_count %" PRIu64 "\n", hist_names[h][0], t.hist_count[h]);
+   };
+#undef MY_APPEND
+
+   // partial text would be rejected by the scraper
+   if (len >= size)
+   {
+      syslog(LOG_ERR, "metrics: response exceeds %zu byte buffer", size);
+      return(-1);
+   };
+
+   return((ssize_t)len);
+}
+
+
+// parse CPU list such as 0,2,4-7 into worker CPU assignments
+int my_parse_cpus(const char * str)
+{
+   unsigned long             lo;
+   unsigned long             hi;
+   char                    * end;
+
+   cnf.cpus_len = 0;
+   while(1)
+   {
+      lo = strtoul(str, &end, 10);
+      if (end == str)
+         return(-1);
+      hi = lo;
+      if (end[0] == '-')
+      {
+         str = &end[1];
+         hi  = strtoul(str, &end, 10);
+         if (end == str)
+            return(-1);
+      };
+      if ( (hi < lo) || (hi >= CPU_SETSIZE) )
+         return(-1);
+
+      // worker N is pinned to entry N modulo list length, extra entries are unused
+      for(; ( (lo <= hi) && (cnf.cpus_len < MY_WORKERS_MAX) ); lo++)
+         cnf.cpus[cnf.cpus_len++] = (unsigned)lo;
+
+      if (end[0] == '\0')
+         return(0);
+      if (end[0] != ',')
+         return(-1);
+      str = &end[1];
+   };
+}
+
+
+// parse probability in percent to fixed point threshold
+int my_parse_prob(const char * str, uint64_t * threshp, char ** endp)
+{
+   double                    perct;
+   char                    * end;
+
+   perct = strtod(str, &end);
+   if ( (end == str) || (!( (perct >= 0.0) && (perct <= 100.0) )) )
+      return(-1);
+   if ( (!(endp)) && (end[0] != '\0') )
+      return(-1);
+   if ((endp))
+      *endp = end;
+
+   *threshp = (uint64_t)((perct / 100.0) * 4294967296.0);
+
+   return(0);
+}
+
+
+// remove PID file unless a newer instance has replaced it
+void my_pidfile_release(void)
+{
+   int                       pid;
+   FILE                    * fs;
+
+   if ((fs = fopen(cnf.pidfile, "r")) == NULL)
+      return;
+   if (fscanf(fs, "%i", &pid) != 1)
+      pid = 0;
+   fclose(fs);
+
+   if (pid == (int)getpid())
+      unlink(cnf.pidfile);
+
+   return;
+}
+
+
+// extract local address of request from ancillary data
+void my_pktinfo_rx(struct msghdr * hdr, struct my_pktinfo * pip)
+{
+   struct cmsghdr          * cmsg;
+#ifdef IP_PKTINFO
+   struct in_pktinfo         pi;
+#endif
+#ifdef IPV6_PKTINFO
+   struct in6_pktinfo        pi6;
+#endif
+
+   pip->family = 0;
+   for(cmsg = CMSG_FIRSTHDR(hdr); (cmsg != NULL); cmsg = CMSG_NXTHDR(hdr, cmsg))
+   {
+#ifdef IP_PKTINFO
+      if ( (cmsg->cmsg_level == IPPROTO_IP) && (cmsg->cmsg_type == IP_PKTINFO) &&
+           (cmsg->cmsg_len >= CMSG_LEN(sizeof(pi))) )
+      {
+         memcpy(&pi, CMSG_DATA(cmsg), sizeof(pi));
+         pip->family  = AF_INET;
+         pip->ifindex = (unsigned)pi.ipi_ifindex;
+         memcpy(pip->addr, &pi.ipi_addr, 4);
+         return;
+      };
+#endif
+#ifdef IPV6_PKTINFO
+      if ( (cmsg->cmsg_level == IPPROTO_IPV6) && (cmsg->cmsg_type == IPV6_PKTINFO) &&
+           (cmsg->cmsg_len >= CMSG_LEN(sizeof(pi6))) )
+      {
+         memcpy(&pi6, CMSG_DATA(cmsg), sizeof(pi6));
+         pip->family  = AF_INET6;
+         pip->ifindex = pi6.ipi6_ifindex;
+         memcpy(pip->addr, &pi6.ipi6_addr, 16);
+         return;
+      };
+#endif
+   };
+
+   return;
+}
+
+
+// initialize policy from global impairment settings
+void my_policy_init(struct my_policy * pol)
+{
+   memset(pol, 0, sizeof(struct my_policy));
+   pol->echoplus  = cnf.echoplus;
+   pol->gemodel   = cnf.gemodel;
+   pol->drop      = cnf.drop;
+   pol->reorder   = cnf.reorder;
+   pol->duplicate = cnf.duplicate;
+   pol->corrupt   = cnf.corrupt;
+   pol->ge_p      = cnf.ge_p;
+   pol->ge_r      = cnf.ge_r;
+   pol->ge_h      = cnf.ge_h;
+   pol->ge_k      = cnf.ge_k;
+   pol->delay     = cnf.delay;
+   pol->jitter    = cnf.jitter;
+   return;
+}
+
+
+// publish default policy from global impairment settings, together with
+// rules resolved against it
+int my_policy_publish(void)
+{
+   struct my_policy        * pol;
+   struct my_rules         * rp;
+
+   // both are built before either is published, so a failure changes nothing
+   if ((pol = malloc(sizeof(struct my_policy))) == NULL)
+      return(-1);
+   my_policy_init(pol);
+   rp = atomic_load(&rules);
+   if ( ((rp)) && ((rp = my_rules_inherit(rp)) == NULL) )
+   {
+      free(pol);
+      return(-1);
+   };
+
+   pol = atomic_exchange(&policy, pol);
+   if ((rp))
+      rp = atomic_exchange(&rules, rp);
+   if ( (!(pol)) && (!(rp)) )
+      return(0);
+
+   // previous policy may still be applied to a request in flight
+   if (my_quiesce_wait() == -1)
+   {
+      policy_retired = pol;
+      if ((rp))
+         rules_retired = rp;
+      return(0);
+   };
+   free(pol);
+   my_rules_free(rp);
+
+   return(0);
+}
+
+
+#ifdef MY_PROFILE
+// read cycle counter, or CLOCK_MONOTONIC nanoseconds where none is available
+uint64_t my_prof_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+   return((uint64_t)__rdtsc());
+#else
+   struct timespec           ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return(((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec);
+#endif
+}
+
+
+// log per stage timings merged over all workers, ticks are converted to
+// nanoseconds with the clock rate measured since startup
+void my_prof_dump(void)
+{
+   unsigned                  pos;
+   unsigned                  stage;
+   unsigned                  idx;
+   unsigned                  q;
+   uint64_t                  count;
+   uint64_t                  sum;
+   uint64_t                  max;
+   uint64_t                  cumulative;
+   uint64_t                  target;
+   uint64_t                  ns;
+   double                    rate;
+   double                    quantiles[4];
+   struct timespec           ts;
+   struct my_prof          * pp;
+   static const double       points[4] = { 0.50, 0.90, 0.99, 0.999 };
+   static uint64_t           buckets[MY_PROF_BUCKETS];
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   ns   = ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+   rate = ((ns > prof_ns)) ? (double)(my_prof_clock() - prof_ticks) / (double)(ns - prof_ns) : 1.0;
+   if (rate <= 0.0)
+      rate = 1.0;
+   my_log_write(LOG_NOTICE, "profile: %u workers; %.3f clock ticks per ns;", cnf.workers, rate);
+
+   for(stage = 0; (stage < MY_PROF_STAGES); stage++)
+   {
+      memset(buckets, 0, sizeof(buckets));
+      count = 0;
+      sum   = 0;
+      max   = 0;
+      for(pos = 0; (pos < cnf.workers); pos++)
+      {
+         pp     = workers[pos].prof;
+         count += atomic_load_explicit(&pp->count[stage], memory_order_relaxed);
+         sum   += atomic_load_explicit(&pp->sum[stage],   memory_order_relaxed);
+         if (max < atomic_load_explicit(&pp->max[stage], memory_order_relaxed))
+            max = atomic_load_explicit(&pp->max[stage], memory_order_relaxed);
+         for(idx = 0; (idx < MY_PROF_BUCKETS); idx++)
+            buckets[idx] += atomic_load_explicit(&pp->buckets[stage][idx], memory_order_relaxed);
+      };
+      if (!(count))
+      {
+         my_log_write(LOG_NOTICE, "profile: %s: 0 samples;", prof_names[stage]);
+         continue;
+      };
+
+      // quantile is reported as the upper bound of the bucket holding it
+      for(q = 0, idx = 0, cumulative = 0; (q < 4); q++)
+      {
+         if ((target = (uint64_t)((double)count * points[q])) < 1)
+            target = 1;
+         for(; (idx < MY_PROF_BUCKETS); idx++)
+         {
+            if ((cumulative + buckets[idx]) >= target)
+               break;
+            cumulative += buckets[idx];
+         };
+         if (idx >= MY_PROF_BUCKETS)
+            idx = MY_PROF_BUCKETS - 1;
+         if (idx < (1U << MY_PROF_SUB_BITS))
+            quantiles[q] = (double)(idx + 1);
+         else
+            quantiles[q] = (double)((((uint64_t)(1U << MY_PROF_SUB_BITS) + (idx & ((1U << MY_PROF_SUB_BITS) - 1)) + 1))
+                           << ((idx >> MY_PROF_SUB_BITS) - 1));
+      };
+
+      my_log_write(LOG_NOTICE, "profile: %s: %" PRIu64 " samples; avg %.0f ns; p50 %.0f ns; p90 %.0f ns; p99 %.0f ns; p99.9 %.0f ns; max %.0f ns;",
+         prof_names[stage], count, (double)sum / (double)count / rate,
+         quantiles[0] / rate, quantiles[1] / rate, quantiles[2] / rate, quantiles[3] / rate,
+         (double)max / rate);
+   };
+
+   return;
+}
+
+
+// record ticks since previous stage ended, values below 2^MY_PROF_SUB_BITS
+// have a bucket each and every power of 2 above is split into
+// 2^MY_PROF_SUB_BITS linear buckets
+void my_prof_mark(struct my_worker * wp, unsigned stage)
+{
+   unsigned                  idx;
+   unsigned                  exp;
+   uint64_t                  now;
+   uint64_t                  ticks;
+   struct my_prof          * pp;
+
+   pp       = wp->prof;
+   now      = my_prof_clock();
+   ticks    = ((now > pp->last)) ? (now - pp->last) : 0;
+   pp->last = now;
+
+   if (ticks < (1U << MY_PROF_SUB_BITS))
+      idx = (unsigned)ticks;
+   else
+   {
+      exp = 63U - (unsigned)__builtin_clzll((unsigned long long)ticks);
+      idx = ((exp - MY_PROF_SUB_BITS + 1) << MY_PROF_SUB_BITS) +
+            (unsigned)((ticks >> (exp - MY_PROF_SUB_BITS)) & ((1U << MY_PROF_SUB_BITS) - 1));
+   };
+   MY_COUNTER_ADD(&pp->buckets[stage][idx], 1);
+   MY_COUNTER_ADD(&pp->count[stage], 1);
+   MY_COUNTER_ADD(&pp->sum[stage], ticks);
+   if (ticks > atomic_load_explicit(&pp->max[stage], memory_order_relaxed))
+      atomic_store_explicit(&pp->max[stage], ticks, memory_order_relaxed);
+
+   return;
+}
+#endif
+
+
+// wait for every worker to pass a quiescent point, returns -1 if workers stop first
+int my_quiesce_wait(void)
+{
+   unsigned                  pos;
+   uint64_t                  gen;
+   struct timespec           ts;
+
+   // idle workers are blocked in the event engine and hold no pointers
+   gen = atomic_fetch_add(&rules_gen, 1) + 1;
+   for(pos = 0; (pos < cnf.workers); pos++)
+   {
+      while(atomic_load(&workers[pos].qgen) < gen)
+      {
+         if ((should_stop))
+            return(-1);
+         ts.tv_sec  = 0;
+         ts.tv_nsec = 1000000;
+         nanosleep(&ts, NULL);
+      };
+   };
+
+   return(0);
+}
+
+
+// xoshiro256** pseudo random number generator
+uint64_t my_rand(struct my_worker * wp)
+{
+   uint64_t                * s;
+   uint64_t                  result;
+   uint64_t                  t;
+
+   s      = wp->rng;
+   result = s[1] * 5;
+   result = ((result << 7) | (result >> 57)) * 9;
+   t      = s[1] << 17;
+   s[2]  ^= s[0];
+   s[3]  ^= s[1];
+   s[1]  ^= s[2];
+   s[0]  ^= s[3];
+   s[2]  ^= t;
+   s[3]   = (s[3] << 45) | (s[3] >> 19);
+
+   return(result);
+}
+
+
+// returns 1 with probability of threshold / 2^32
+int my_rand_chance(struct my_worker * wp, uint64_t thresh)
+{
+   if (!(thresh))
+      return(0);
+   return((my_rand(wp) >> 32) < thresh);
+}
+
+
+// seed generator state using splitmix64
+void my_rand_seed(struct my_worker * wp, uint64_t seed)
+{
+   unsigned                  pos;
+   uint64_t                  z;
+
+   for(pos = 0; (pos < 4); pos++)
+   {
+      z  = (seed += 0x9e3779b97f4a7c15ULL);
+      z  = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z  = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      wp->rng[pos] = z ^ (z >> 31);
+   };
+
+   return;
+}
+
+
+// returns uniform double in the open interval (0, 1)
+double my_rand_unit(struct my_worker * wp)
+{
+   return(((double)(my_rand(wp) >> 11) + 0.5) * (1.0 / 9007199254740992.0));
+}
+
+
+// receive and echo one datagram
+int my_recv(struct my_worker * wp, struct my_sock * sp)
+{
+   int                        rc;
+   ssize_t                    ssize;
+   size_t                     seg;
+   useconds_t                 delay;
+   uint8_t                    fmts[MY_TRAIN_SEGS];
+   struct timespec            rts;
+   struct timespec            rx;
+   struct timespec            ts;
+   union my_sa                sa;
+   struct iovec               iov;
+   struct msghdr              hdr;
+   union
+   {
+      char                    bytes[MY_BUFF_SIZE];
+      struct udp_echo_plus    msg;
+   } udpbuff;
+   union
+   {
+      char                    bytes[MY_CMSG_SIZE];
+      struct cmsghdr          align;
+   } ctrl;
+
+   // read data and ancillary timestamps
+   wp->sock     = sp;
+   iov.iov_base = udpbuff.bytes;
+   iov.iov_len  = sizeof(udpbuff);
+   memset(&hdr, 0, sizeof(hdr));
+   hdr.msg_name    = &sa;
+   hdr.msg_namelen = sizeof(struct sockaddr_storage);
+   hdr.msg_iov     = &iov;
+   hdr.msg_iovlen  = 1;
+   if ((my_cmsg_enabled()))
+   {
+      hdr.msg_control    = ctrl.bytes;
+      hdr.msg_controllen = sizeof(ctrl);
+   };
+   MY_PROF_BEGIN(wp);
+   ssize = recvmsg(sp->s, &hdr, MSG_DONTWAIT|MSG_TRUNC);
+   MY_PROF(wp, MY_PROF_RECV);
+   if (ssize == -1)
+   {
+      if ( (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR) )
+         MY_STAT_INC(wp, MY_STAT_RX_ERRORS, 1);
+      return(-1);
+   };
+   if (ssize > (ssize_t)sizeof(udpbuff))
+   {
+      MY_STAT_INC(wp, MY_STAT_TRUNCATED, 1);
+      ssize = sizeof(udpbuff);
+   };
+
+   // increment connection counter
+   wp->conn++;
+
+   // grab timestamp, kernel receive timestamp is preferred when available
+   clock_gettime(CLOCK_REALTIME, &rts);
+   rx = rts;
+   wp->kstamp = (my_ts_rx(&hdr, &rx) == 0);
+   wp->ttl = my_ttl_rx(&hdr);
+   seg     = my_gro_rx(&hdr);
+   my_pktinfo_rx(&hdr, &wp->dst);
+   my_rxq_ovfl(wp, &hdr);
+   MY_PROF(wp, MY_PROF_STAMP);
+
+   // log, drop and delay request
+   rc = my_echo_train(wp, &sa, (uint8_t *)udpbuff.bytes, &ssize, seg, &rx, &delay, fmts);
+   MY_PROF(wp, MY_PROF_IMPAIR);
+   if (rc != MY_SENT)
+      return(0);
+
+   // grab timestamp
+   clock_gettime(CLOCK_REALTIME, &ts);
+   ts.tv_nsec++;
+
+   // send response, address is reused from the request header
+   my_echo_reply_time(&udpbuff.msg, ssize, seg, fmts, &ts);
+   iov.iov_len = (size_t)ssize;
+   my_reply_ctrl(&hdr, ctrl.bytes, &wp->dst, seg, ssize);
+   my_stats_sent(wp, sendmsg(sp->s, &hdr, 0), seg, &rx);
+   my_hist_add(&wp->stats->hists[MY_HIST_SERVICE], &rts, &ts, 1);
+   MY_PROF(wp, MY_PROF_SEND);
+
+   // log response
+   my_log_train(wp, MY_SENT, &sa, (uint8_t *)udpbuff.bytes, ssize, seg, fmts, &ts, delay);
+   MY_PROF(wp, MY_PROF_LOG_SENT);
+
+   return(0);
+}
+
+
+#ifdef MSG_WAITFORONE
+// receive and echo one batch of datagrams
+int my_recv_batch(struct my_worker * wp, struct my_sock * sp)
+{
+   struct my_batch          * bp;
+   int                        rc;
+   int                        count;
+   int                        pos;
+   int                        sent;
+   int                        run;
+   unsigned                   ahead;
+   ssize_t                    len;
+   size_t                     seg;
+   size_t                     conn;
+   struct timespec            rts;
+   struct timespec            ts;
+   struct msghdr            * hdr;
+   uint8_t                  * buff;
+
+   bp       = wp->batch;
+   wp->sock = sp;
+
+   // reset lengths clobbered by the previous batch
+   for(pos = 0; (pos < (int)bp->size); pos++)
+   {
+      bp->msgs[pos].msg_hdr.msg_namelen    = sizeof(struct sockaddr_storage);
+      bp->msgs[pos].msg_hdr.msg_controllen = ((bp->msgs[pos].msg_hdr.msg_control)) ? MY_CMSG_SIZE : 0;
+      bp->iovs[pos].iov_len                = MY_BUFF_SIZE;
+   };
+
+   // drain up to one batch of queued datagrams
+   MY_PROF_BEGIN(wp);
+   rc = recvmmsg(sp->s, bp->msgs, bp->size, MSG_DONTWAIT, NULL);
+   MY_PROF(wp, MY_PROF_RECV);
+   if (rc < 1)
+   {
+      if ( (rc == -1) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR) )
+         MY_STAT_INC(wp, MY_STAT_RX_ERRORS, 1);
+      return(-1);
+   };
+   clock_gettime(CLOCK_REALTIME, &rts);
+
+   // process each request and queue surviving replies
+   for(pos = 0, count = 0, ahead = 0; (pos < rc); pos++)
+   {
+      wp->conn++;
+      hdr  = &bp->msgs[pos].msg_hdr;
+      len  = (ssize_t)bp->msgs[pos].msg_len;
+      buff = hdr->msg_iov->iov_base;
+      if ((hdr->msg_flags & MSG_TRUNC))
+         MY_STAT_INC(wp, MY_STAT_TRUNCATED, 1);
+      bp->stamps[count] = rts;
+      wp->kstamp = (my_ts_rx(hdr, &bp->stamps[count]) == 0);
+      wp->ttl = my_ttl_rx(hdr);
+      seg     = my_gro_rx(hdr);
+      my_pktinfo_rx(hdr, &wp->dst);
+      my_rxq_ovfl(wp, hdr);
+      MY_PROF(wp, MY_PROF_STAMP);
+      if (my_echo_train(wp, &bp->sas[pos], buff, &len, seg, &bp->stamps[count], &bp->delays[count], &bp->fmts[count * MY_TRAIN_SEGS]) != MY_SENT)
+      {
+         MY_PROF(wp, MY_PROF_IMPAIR);
+         continue;
+      };
+
+      // reply reuses the request's ancillary data buffer for its source
+      // address and UDP_SEGMENT
+      bp->iovs[pos].iov_len      = (size_t)len;
+      bp->segs[count]            = (unsigned)seg;
+      bp->conns[count]           = wp->conn;
+      bp->dsts[count]            = wp->dst;
+      bp->origins[count]         = (unsigned)pos;
+      bp->spares[count]          = MY_ZC_NONE;
+      if ( ((bp->zc)) && ((size_t)len >= cnf.zerocopy) &&
+           ((bp->spares[count] = my_zc_reserve(bp->zc, sp->zcq, ahead)) != MY_ZC_NONE) )
+         ahead++;
+      bp->replies[count].msg_hdr = *hdr;
+      my_reply_ctrl(&bp->replies[count].msg_hdr, &bp->ctrls[pos * MY_CMSG_SIZE], &wp->dst, seg, len);
+      count++;
+      MY_PROF(wp, MY_PROF_IMPAIR);
+   };
+   if (!(count))
+      return(0);
+
+   // grab timestamp
+   clock_gettime(CLOCK_REALTIME, &ts);
+   ts.tv_nsec++;
+
+   // send responses
+   for(pos = 0; (pos < count); pos++)
+   {
+      hdr = &bp->replies[pos].msg_hdr;
+      my_echo_reply_time(hdr->msg_iov->iov_base, (ssize_t)hdr->msg_iov->iov_len, bp->segs[pos], &bp->fmts[pos * MY_TRAIN_SEGS], &ts);
+   };
+   // zero copy and copied replies are sent in runs sharing transmit flags
+   for(sent = 0; (sent < count); sent += rc)
+   {
+      for(run = sent + 1; ( (run < count) && ((bp->spares[run] == MY_ZC_NONE) == (bp->spares[sent] == MY_ZC_NONE)) ); run++);
+      if ((rc = sendmmsg(sp->s, &bp->replies[sent], (unsigned)(run - sent), (bp->spares[sent] == MY_ZC_NONE) ? 0 : MSG_ZEROCOPY)) < 1)
+      {
+         // notification memory is exhausted, copy the remaining replies
+         if ( (bp->spares[sent] == MY_ZC_NONE) || (errno != ENOBUFS) )
+            break;
+         for(pos = sent; (pos < count); pos++)
+         {
+            if (bp->spares[pos] != MY_ZC_NONE)
+               bp->zc->free[bp->zc->nfree++] = bp->spares[pos];
+            bp->spares[pos] = MY_ZC_NONE;
+         };
+         rc = 0;
+      };
+   };
+   for(pos = 0; (pos < sent); pos++)
+      my_stats_sent(wp, (ssize_t)bp->replies[pos].msg_len, bp->segs[pos], &bp->stamps[pos]);
+
+   // buffers of zero copy replies are held until completion, the reserved
+   // spare takes over receiving for that datagram slot
+   for(pos = 0; (pos < count); pos++)
+   {
+      if (bp->spares[pos] == MY_ZC_NONE)
+         continue;
+      if (pos < sent)
+      {
+         sp->zcq->pending[sp->zcq->next++ & (MY_ZC_POOL - 1)] = bp->slots[bp->origins[pos]];
+         bp->slots[bp->origins[pos]]             = bp->spares[pos];
+         bp->iovs[bp->origins[pos]].iov_base     = &bp->buffs[(size_t)bp->spares[pos] * MY_BUFF_SIZE];
+         MY_STAT_INC(wp, MY_STAT_ZC_PKTS, 1);
+      }
+      else
+         bp->zc->free[bp->zc->nfree++] = bp->spares[pos];
+   };
+   if (sent < count)
+      MY_STAT_INC(wp, MY_STAT_TX_ERRORS, count - sent);
+   my_hist_add(&wp->stats->hists[MY_HIST_SERVICE], &rts, &ts, (unsigned)count);
+   MY_PROF(wp, MY_PROF_SEND);
+
+   // log responses under the connection number and local address of their requests
+   conn = wp->conn;
+   for(pos = 0; (pos < count); pos++)
+   {
+      hdr      = &bp->replies[pos].msg_hdr;
+      wp->conn = bp->conns[pos];
+      wp->dst  = bp->dsts[pos];
+      my_log_train(wp, MY_SENT, hdr->msg_name, hdr->msg_iov->iov_base, (ssize_t)hdr->msg_iov->iov_len, bp->segs[pos], &bp->fmts[pos * MY_TRAIN_SEGS], &ts, bp->delays[pos]);
+   };
+   wp->conn = conn;
+   MY_PROF(wp, MY_PROF_LOG_SENT);
+
+   return(0);
+}
+#endif
+
+
+
+
+// set reply source address, and UDP_SEGMENT if reply train holds more than one segment
+void my_reply_ctrl(struct msghdr * hdr, void * ctrl, const struct my_pktinfo * pip,
+   size_t seg, ssize_t ssize)
+{
+   size_t                    len;
+   struct cmsghdr          * cmsg;
+#ifdef IP_PKTINFO
+   struct in_pktinfo         pi;
+#endif
+#ifdef IPV6_PKTINFO
+   struct in6_pktinfo        pi6;
+#endif
+#ifdef UDP_SEGMENT
+   uint16_t                  gso;
+#endif
+
+   // ctrl usually holds the request's ancillary data, which is no longer
+   // needed once the local address has been extracted
+   len  = 0;
+   cmsg = ctrl;
+#ifdef IP_PKTINFO
+   // kernel picks the outgoing interface, only the source address is fixed
+   if (pip->family == AF_INET)
+   {
+      memset(&pi, 0, sizeof(pi));
+      memcpy(&pi.ipi_spec_dst, pip->addr, 4);
+      cmsg->cmsg_level = IPPROTO_IP;
+      cmsg->cmsg_type  = IP_PKTINFO;
+      cmsg->cmsg_len   = CMSG_LEN(sizeof(pi));
+      memcpy(CMSG_DATA(cmsg), &pi, sizeof(pi));
+      len             += CMSG_SPACE(sizeof(pi));
+   };
+#endif
+#ifdef IPV6_PKTINFO
+   // link local source addresses are only valid on the arrival interface
+   if (pip->family == AF_INET6)
+   {
+      memset(&pi6, 0, sizeof(pi6));
+      memcpy(&pi6.ipi6_addr, pip->addr, 16);
+      if ((IN6_IS_ADDR_LINKLOCAL(&pi6.ipi6_addr)))
+         pi6.ipi6_ifindex = pip->ifindex;
+      cmsg->cmsg_level = IPPROTO_IPV6;
+      cmsg->cmsg_type  = IPV6_PKTINFO;
+      cmsg->cmsg_len   = CMSG_LEN(sizeof(pi6));
+      memcpy(CMSG_DATA(cmsg), &pi6, sizeof(pi6));
+      len             += CMSG_SPACE(sizeof(pi6));
+   };
+#endif
+#ifdef UDP_SEGMENT
+   if ( ((seg)) && ((size_t)ssize > seg) )
+   {
+      gso              = (uint16_t)seg;
+      cmsg             = (struct cmsghdr *)((uint8_t *)ctrl + len);
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type  = UDP_SEGMENT;
+      cmsg->cmsg_len   = CMSG_LEN(sizeof(uint16_t));
+      memcpy(CMSG_DATA(cmsg), &gso, sizeof(uint16_t));
+      len             += CMSG_SPACE(sizeof(uint16_t));
+   };
+#else
+   (void)seg;
+   (void)ssize;
+#endif
+
+   hdr->msg_control    = ((len)) ? ctrl : NULL;
+   hdr->msg_controllen = len;
+
+   return;
+}
+
+
+// free compiled rules
+void my_rules_free(struct my_rules * rp)
+{
+   if (!(rp))
+      return;
+   free(rp->tries[0].nodes);
+   free(rp->tries[1].nodes);
+   free(rp->policies);
+   free(rp);
+   return;
+}
+
+
+// add prefix to trie
+int my_rules_insert(struct my_trie * tp, const uint8_t * addr, unsigned plen, int32_t pol_idx)
+{
+   unsigned                  pos;
+   unsigned                  bit;
+   uint32_t                  node;
+   struct my_trie_node     * nodes;
+
+   for(pos = 0, node = 0; (pos < plen); pos++)
+   {
+      bit = (addr[pos / 8] >> (7 - (pos % 8))) & 0x01;
+      if (!(tp->nodes[node].child[bit]))
+      {
+         if (tp->len == tp->size)
+         {
+            if ((nodes = realloc(tp->nodes, sizeof(struct my_trie_node) * tp->size * 2)) == NULL)
+               return(-1);
+            tp->nodes = nodes;
+            tp->size *= 2;
+         };
+         tp->nodes[tp->len].child[0] = 0;
+         tp->nodes[tp->len].child[1] = 0;
+         tp->nodes[tp->len].policy   = -1;
+         tp->nodes[node].child[bit]  = tp->len++;
+      };
+      node = tp->nodes[node].child[bit];
+   };
+   tp->nodes[node].policy = pol_idx;
+
+   return(0);
+}
+
+
+// copy compiled rules, resolving settings they do not override against the defaults
+struct my_rules * my_rules_inherit(const struct my_rules * rp)
+{
+   unsigned                  pos;
+   struct my_rules         * np;
+   struct my_policy        * pol;
+   const struct my_policy  * rule;
+
+   if ((np = calloc(1, sizeof(struct my_rules))) == NULL)
+      return(NULL);
+   for(pos = 0; (pos < 2); pos++)
+   {
+      if ((np->tries[pos].nodes = malloc(sizeof(struct my_trie_node) * rp->tries[pos].size)) == NULL)
+      {
+         my_rules_free(np);
+         return(NULL);
+      };
+      memcpy(np->tries[pos].nodes, rp->tries[pos].nodes, sizeof(struct my_trie_node) * rp->tries[pos].len);
+      np->tries[pos].size = rp->tries[pos].size;
+      np->tries[pos].len  = rp->tries[pos].len;
+   };
+   if ((np->policies = calloc(((rp->policies_size)) ? rp->policies_size : 1, sizeof(struct my_policy))) == NULL)
+   {
+      my_rules_free(np);
+      return(NULL);
+   };
+   np->policies_size = rp->policies_size;
+   np->policies_len  = rp->policies_len;
+
+   for(pos = 0; (pos < rp->policies_len); pos++)
+   {
+      rule = &rp->policies[pos];
+      pol  = &np->policies[pos];
+      my_policy_init(pol);
+      pol->deny      = rule->deny;
+      pol->overrides = rule->overrides;
+      if ((rule->overrides & MY_RULE_DROP))
+      {
+         pol->drop    = rule->drop;
+         pol->gemodel = 0;
+      };
+      pol->reorder   = ((rule->overrides & MY_RULE_REORDER))   ? rule->reorder   : pol->reorder;
+      pol->duplicate = ((rule->overrides & MY_RULE_DUPLICATE)) ? rule->duplicate : pol->duplicate;
+      pol->corrupt   = ((rule->overrides & MY_RULE_CORRUPT))   ? rule->corrupt   : pol->corrupt;
+      pol->delay     = ((rule->overrides & MY_RULE_DELAY))     ? rule->delay     : pol->delay;
+      pol->jitter    = ((rule->overrides & MY_RULE_JITTER))    ? rule->jitter    : pol->jitter;
+   };
+
+   return(np);
+}
+
+
+// compile rule file into prefix tries
+struct my_rules * my_rules_load(const char * file, char * err, size_t errlen)
+{
+   FILE                    * fs;
+   unsigned                  lineno;
+   unsigned                  plen;
+   unsigned                  pos;
+   int                       family;
+   char                      line[1024];
+   char                    * ptr;
+   char                    * tok;
+   char                    * val;
+   char                    * end;
+   char                    * state;
+   uint8_t                   addr[16];
+   struct my_rules         * rp;
+   struct my_policy        * pol;
+
+   if ((fs = fopen(file, "r")) == NULL)
+   {
+      snprintf(err, errlen, "%s: %s", file, strerror(errno));
+      return(NULL);
+   };
+   snprintf(err, errlen, "%s: read error", file);
+
+   // allocate tries with root nodes
+   if ((rp = calloc(1, sizeof(struct my_rules))) == NULL)
+   {
+      snprintf(err, errlen, "out of virtual memory");
+      fclose(fs);
+      return(NULL);
+   };
+   for(pos = 0; (pos < 2); pos++)
+   {
+      if ((rp->tries[pos].nodes = calloc(64, sizeof(struct my_trie_node))) == NULL)
+      {
+         snprintf(err, errlen, "out of virtual memory");
+         my_rules_free(rp);
+         fclose(fs);
+         return(NULL);
+      };
+      rp->tries[pos].size            = 64;
+      rp->tries[pos].len             = 1;
+      rp->tries[pos].nodes[0].policy = -1;
+   };
+
+   for(lineno = 1; ((fgets(line, sizeof(line), fs))); lineno++)
+   {
+      // strip comments and skip empty lines
+      if ((ptr = strchr(line, '#')) != NULL)
+         ptr[0] = '\0';
+      if ((tok = strtok_r(line, " \t\r\n", &state)) == NULL)
+         continue;
+
+      // parse prefix
+      plen = 0;
+      if ((ptr = strchr(tok, '/')) != NULL)
+      {
+         ptr[0] = '\0';
+         plen = (unsigned)strtoul(&ptr[1], &end, 10);
+         if ( (ptr[1] == '\0') || (end[0] != '\0') )
+         {
+            snprintf(err, errlen, "%s:%u: invalid prefix length", file, lineno);
+            break;
+         };
+      };
+      if (inet_pton(AF_INET, tok, addr) == 1)
+      {
+         family = AF_INET;
+         plen   = ((ptr)) ? plen : 32;
+      }
+      else if (inet_pton(AF_INET6, tok, addr) == 1)
+      {
+         family = AF_INET6;
+         plen   = ((ptr)) ? plen : 128;
+      }
+      else
+      {
+         snprintf(err, errlen, "%s:%u: invalid address `%s'", file, lineno, tok);
+         break;
+      };
+      if (plen > ((family == AF_INET) ? 32U : 128U))
+      {
+         snprintf(err, errlen, "%s:%u: invalid prefix length", file, lineno);
+         break;
+      };
+
+      // allocate policy
+      if (rp->policies_len == rp->policies_size)
+      {
+         rp->policies_size = ((rp->policies_size)) ? (rp->policies_size * 2) : 16;
+         if ((pol = realloc(rp->policies, sizeof(struct my_policy) * rp->policies_size)) == NULL)
+         {
+            snprintf(err, errlen, "out of virtual memory");
+            break;
+         };
+         rp->policies = pol;
+      };
+      pol = &rp->policies[rp->policies_len];
+      my_policy_init(pol);
+
+      // parse actions
+      while((tok = strtok_r(NULL, " \t\r\n", &state)) != NULL)
+      {
+         if ((val = strchr(tok, '=')) != NULL)
+            *val++ = '\0';
+         if      ( (!(strcasecmp(tok, "allow"))) && (!(val)) )  { pol->deny = 0; }
+         else if ( (!(strcasecmp(tok, "deny")))  && (!(val)) )  { pol->deny = 1; }
+         else if ( (!(strcasecmp(tok, "drop"))) && ((val)) && (my_parse_prob(val, &pol->drop, NULL) == 0) )
+         {
+            pol->gemodel    = 0;
+            pol->overrides |= MY_RULE_DROP;
+         }
+         else if ( (!(strcasecmp(tok, "reorder"))) && ((val)) && (my_parse_prob(val, &pol->reorder, NULL) == 0) )
+            pol->overrides |= MY_RULE_REORDER;
+         else if ( (!(strcasecmp(tok, "duplicate"))) && ((val)) && (my_parse_prob(val, &pol->duplicate, NULL) == 0) )
+            pol->overrides |= MY_RULE_DUPLICATE;
+         else if ( (!(strcasecmp(tok, "corrupt"))) && ((val)) && (my_parse_prob(val, &pol->corrupt, NULL) == 0) )
+            pol->overrides |= MY_RULE_CORRUPT;
+         else if ( (!(strcasecmp(tok, "delay"))) && ((val)) && ((pol->delay = (useconds_t)strtoul(val, &end, 10)) <= MY_DELAY_MAX) && (end[0] == '\0') )
+            pol->overrides |= MY_RULE_DELAY;
+         else if ( (!(strcasecmp(tok, "jitter"))) && ((val)) && ((pol->jitter = (useconds_t)strtoul(val, &end, 10)) <= MY_DELAY_MAX) && (end[0] == '\0') )
+            pol->overrides |= MY_RULE_JITTER;
+         else
+         {
+            snprintf(err, errlen, "%s:%u: invalid action `%s'", file, lineno, tok);
+            break;
+         };
+      };
+      if ((tok))
+         break;
+
+      // add prefix to trie of address family
+      if (my_rules_insert(&rp->tries[(family == AF_INET) ? 0 : 1], addr, plen, (int32_t)rp->policies_len) == -1)
+      {
+         snprintf(err, errlen, "out of virtual memory");
+         break;
+      };
+      rp->policies_len++;
+   };
+
+   // any early exit from the loop is a parse error
+   if (!(feof(fs)))
+   {
+      my_rules_free(rp);
+      fclose(fs);
+      return(NULL);
+   };
+   fclose(fs);
+
+   return(rp);
+}
+
+
+// find policy of longest matching prefix, returns NULL if no prefix matches
+const struct my_policy * my_rules_lookup(const struct my_rules * rp, const union my_sa * sap)
+{
+   unsigned                  pos;
+   unsigned                  bits;
+   uint32_t                  node;
+   int32_t                   match;
+   const uint8_t           * addr;
+   const struct my_trie    * tp;
+
+   switch(sap->ss.ss_family)
+   {
+      case AF_INET:
+      addr = (const uint8_t *)&sap->sin.sin_addr;
+      bits = 32;
+      tp   = &rp->tries[0];
+      break;
+
+      // IPv4 mapped addresses use the IPv4 rules
+      case AF_INET6:
+      addr = sap->sin6.sin6_addr.s6_addr;
+      bits = 128;
+      tp   = &rp->tries[1];
+      if (IN6_IS_ADDR_V4MAPPED(&sap->sin6.sin6_addr) != 0)
+      {
+         addr = &addr[12];
+         bits = 32;
+         tp   = &rp->tries[0];
+      };
+      break;
+
+      default:
+      return(NULL);
+   };
+
+   for(pos = 0, node = 0, match = -1; ; pos++)
+   {
+      if (tp->nodes[node].policy != -1)
+         match = tp->nodes[node].policy;
+      if (pos == bits)
+         break;
+      if ((node = tp->nodes[node].child[(addr[pos / 8] >> (7 - (pos % 8))) & 0x01]) == 0)
+         break;
+   };
+
+   return( (match == -1) ? NULL : &rp->policies[match]);
+}
+
+
+// reload rule file and retire previous rules once workers are quiescent
+int my_rules_reload(void)
+{
+   char                      err[256];
+   struct my_rules         * rp;
+
+   if (!(cnf.rules))
+      return(0);
+
+   if ((rp = my_rules_load(cnf.rules, err, sizeof(err))) == NULL)
+   {
+      syslog(LOG_ERR, "%s", err);
+      syslog(LOG_ERR, "keeping previously loaded rules");
+      return(-1);
+   };
+   rp = atomic_exchange(&rules, rp);
+
+   // workers may stop before reaching a quiescent point, so release the
+   // previous rules after the workers have been joined
+   if (my_quiesce_wait() == -1)
+   {
+      rules_retired = rp;
+      return(0);
+   };
+   my_rules_free(rp);
+
+   rp = atomic_load_explicit(&rules, memory_order_relaxed);
+   syslog(LOG_NOTICE, "reloaded rules: %s (%u prefixes)", cnf.rules, rp->policies_len);
+
+   return(0);
+}
+
+
+#ifdef IORING_RECV_MULTISHOT
+// submit queued requests and optionally wait for a completion
+int my_uring_enter(struct my_uring * ur, int wait_ms)
+{
+   long                            rc;
+   unsigned                        flags;
+   unsigned                        submit;
+   struct __kernel_timespec        ts;
+   struct io_uring_getevents_arg   arg;
+
+   __atomic_store_n(ur->sq_tail, ur->sq_pending, __ATOMIC_RELEASE);
+   submit = ur->sq_pending - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE);
+
+   if (wait_ms < 0)
+   {
+      if (!(submit))
+         return(0);
+      rc = syscall(__NR_io_uring_enter, ur->fd, submit, 0, 0, NULL, 0);
+   } else
+   {
+      flags          = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+      ts.tv_sec      = wait_ms / 1000;
+      ts.tv_nsec     = (wait_ms % 1000) * 1000000;
+      memset(&arg, 0, sizeof(arg));
+      arg.ts         = (uint64_t)(uintptr_t)&ts;
+      rc = syscall(__NR_io_uring_enter, ur->fd, submit, 1, flags, &arg, sizeof(arg));
+   };
+
+   if ( (rc == -1) && (errno != ETIME) && (errno != EINTR) && (errno != EBUSY) )
+      return(-1);
+
+   return(0);
+}
+
+
+// release io_uring engine
+void my_uring_free(struct my_worker * wp)
+{
+   struct my_uring         * ur;
+
+   if ((ur = wp->uring) == NULL)
+      return;
+   wp->uring = NULL;
+
+   if (ur->fd != -1)
+      close(ur->fd);
+   if ( (ur->ring) && (ur->ring != MAP_FAILED) )
+      munmap(ur->ring, ur->ring_sz);
+   if ( (ur->sqes) && (ur->sqes != MAP_FAILED) )
+      munmap(ur->sqes, ur->sqes_sz);
+   if ( (ur->br) && (ur->br != MAP_FAILED) )
+      munmap(ur->br, ur->br_sz);
+   free(ur->bufs);
+   free(ur->sendmsgs);
+   free(ur->sendiovs);
+   free(ur->replies);
+   free(ur->delays);
+   free(ur->stamps);
+   free(ur->segs);
+   free(ur->fmts);
+   free(ur->socks);
+   free(ur->conns);
+   free(ur->dsts);
+   free(ur);
+
+   return;
+}
+
+
+// initialize io_uring engine
+int my_uring_init(struct my_worker * wp)
+{
+   unsigned                  pos;
+   uint8_t                 * ring;
+   struct my_uring         * ur;
+   struct io_uring_params    p;
+   struct io_uring_buf_reg   reg;
+
+   if ((ur = calloc(1, sizeof(struct my_uring))) == NULL)
+      return(-1);
+   ur->fd    = -1;
+   wp->uring = ur;
+
+   // create ring
+   memset(&p, 0, sizeof(p));
+   if ((ur->fd = (int)syscall(__NR_io_uring_setup, MY_URING_ENTRIES, &p)) == -1)
+   {
+      syslog(LOG_NOTICE, "worker %u: io_uring_setup(): %s", wp->id, strerror(errno));
+      my_uring_free(wp);
+      return(-1);
+   };
+   if ( (!(p.features & IORING_FEAT_SINGLE_MMAP)) || (!(p.features & IORING_FEAT_EXT_ARG)) )
+   {
+      syslog(LOG_NOTICE, "worker %u: kernel lacks required io_uring features", wp->id);
+      my_uring_free(wp);
+      return(-1);
+   };
+
+   // map submission and completion rings
+   ur->ring_sz = p.sq_off.array + (p.sq_entries * sizeof(unsigned));
+   if (ur->ring_sz < (p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe))))
+      ur->ring_sz = p.cq_off.cqes + (p.cq_entries * sizeof(struct io_uring_cqe));
+   ur->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+   ur->ring    = mmap(NULL, ur->ring_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+   ur->sqes    = mmap(NULL, ur->sqes_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+   if ( (ur->ring == MAP_FAILED) || (ur->sqes == MAP_FAILED) )
+   {
+      syslog(LOG_ERR, "worker %u: mmap(): %s", wp->id, strerror(errno));
+      my_uring_free(wp);
+      return(-1);
+   };
+   ring           = ur->ring;
+   ur->sq_entries = p.sq_entries;
+   ur->sq_head    = (unsigned *)&ring[p.sq_off.head];
+   ur->sq_tail    = (unsigned *)&ring[p.sq_off.tail];
+   ur->sq_mask    = *(unsigned *)&ring[p.sq_off.ring_mask];
+   ur->cq_head    = (unsigned *)&ring[p.cq_off.head];
+   ur->cq_tail    = (unsigned *)&ring[p.cq_off.tail];
+   ur->cq_mask    = *(unsigned *)&ring[p.cq_off.ring_mask];
+   ur->cqes       = (struct io_uring_cqe *)&ring[p.cq_off.cqes];
+   ur->sq_pending = *ur->sq_tail;
+   for(pos = 0; (pos < p.sq_entries); pos++)
+      ((unsigned *)&ring[p.sq_off.array])[pos] = pos;
+
+   // allocate provided buffers and per buffer transmit headers
+   ur->br_sz    = MY_URING_BUFFERS * sizeof(struct io_uring_buf);
+   ur->br       = mmap(NULL, ur->br_sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+   ur->bufs     = calloc(MY_URING_BUFFERS, MY_URING_BUFSZ);
+   ur->sendmsgs = calloc(MY_URING_BUFFERS, sizeof(struct msghdr));
+   ur->sendiovs = calloc(MY_URING_BUFFERS, sizeof(struct iovec));
+   ur->replies  = calloc(MY_URING_BUFFERS, sizeof(unsigned));
+   ur->delays   = calloc(MY_URING_BUFFERS, sizeof(useconds_t));
+   ur->stamps   = calloc(MY_URING_BUFFERS, sizeof(struct timespec));
+   ur->segs     = calloc(MY_URING_BUFFERS, sizeof(unsigned));
+   ur->fmts     = calloc(MY_URING_BUFFERS, MY_TRAIN_SEGS);
+   ur->socks    = calloc(MY_URING_BUFFERS, sizeof(unsigned));
+   ur->conns    = calloc(MY_URING_BUFFERS, sizeof(size_t));
+   ur->dsts     = calloc(MY_URING_BUFFERS, sizeof(struct my_pktinfo));
+   if ( (ur->br == MAP_FAILED) || (!(ur->bufs)) || (!(ur->sendmsgs)) ||
+        (!(ur->sendiovs)) || (!(ur->replies)) || (!(ur->delays)) || (!(ur->stamps)) ||
+        (!(ur->segs)) || (!(ur->fmts)) || (!(ur->socks)) || (!(ur->conns)) || (!(ur->dsts)) )
+   {
+      syslog(LOG_ERR, "worker %u: out of virtual memory", wp->id);
+      my_uring_free(wp);
+      return(-1);
+   };
+
+   // register provided buffer ring
+   memset(&reg, 0, sizeof(reg));
+   reg.ring_addr    = (uint64_t)(uintptr_t)ur->br;
+   reg.ring_entries = MY_URING_BUFFERS;
+   reg.bgid         = MY_URING_BGID;
+   if (syscall(__NR_io_uring_register, ur->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+   {
+      syslog(LOG_NOTICE, "worker %u: io_uring_register(PBUF_RING): %s", wp->id, strerror(errno));
+      my_uring_free(wp);
+      return(-1);
+   };
+   for(pos = 0; (pos < MY_URING_BUFFERS); pos++)
+      my_uring_recycle(ur, pos);
+
+   // multishot receive template, ancillary data and payload follow address in each buffer
+   ur->recvmsg.msg_namelen = sizeof(struct sockaddr_storage);
+   if ((my_cmsg_enabled()))
+      ur->recvmsg.msg_controllen = MY_CMSG_SIZE;
+
+   return(0);
+}
+
+
+// main loop using io_uring
+int my_loop_uring(struct my_worker * wp)
+{
+   int                        rc;
+   int                        res;
+   int                        timeout;
+   unsigned                   head;
+   unsigned                   tail;
+   unsigned                   flags;
+   unsigned                   bid;
+   unsigned                   count;
+   unsigned                   pos;
+   unsigned                   idx;
+   ssize_t                    len;
+   size_t                     seg;
+   size_t                     conn;
+   uint64_t                   tag;
+   useconds_t                 delay;
+   struct timespec            rts;
+   struct timespec            ts;
+   struct my_uring          * ur;
+   struct io_uring_sqe      * sqe;
+   struct io_uring_cqe      * cqe;
+   struct io_uring_recvmsg_out * out;
+   struct msghdr            * hdr;
+   struct msghdr              ctl;
+   union my_sa              * sap;
+   uint8_t                  * payload;
+   uint8_t                  * fmts;
+
+   ur = wp->uring;
+
+   // arm multishot receive on each socket, completions carry the socket
+   // index, receives are cancelled when stopping so sockets handed to a new
+   // instance are no longer read by this ring
+   for(idx = 0; (idx < listeners_len); idx++)
+   {
+      if ( ((should_stop)) && (wp->socks[idx].armed == 1) )
+      {
+         if ((sqe = my_uring_sqe(ur)) == NULL)
+            return(-1);
+         sqe->opcode           = IORING_OP_ASYNC_CANCEL;
+         sqe->fd               = -1;
+         sqe->addr             = MY_URING_RECV | idx;
+         sqe->user_data        = MY_URING_CANCEL;
+         wp->socks[idx].armed  = 2;
+      };
+      if ( ((should_stop)) || ((wp->socks[idx].armed)) )
+         continue;
+      if ((sqe = my_uring_sqe(ur)) == NULL)
+         return(-1);
+      sqe->opcode           = IORING_OP_RECVMSG;
+      sqe->fd               = wp->socks[idx].s;
+      sqe->addr             = (uint64_t)(uintptr_t)&ur->recvmsg;
+      sqe->len              = 1;
+      sqe->flags            = IOSQE_BUFFER_SELECT;
+      sqe->ioprio           = IORING_RECV_MULTISHOT;
+      sqe->buf_group        = MY_URING_BGID;
+      sqe->user_data        = MY_URING_RECV | idx;
+      wp->socks[idx].armed  = 1;
+   };
+
+   // submit queued replies and receive, then wait for completions
+   timeout = my_delay_run(wp, 5000);
+   my_worker_idle(wp);
+   MY_PROF_BEGIN(wp);
+   rc = my_uring_enter(ur, timeout);
+   MY_PROF(wp, MY_PROF_WAIT);
+   my_worker_quiesce(wp);
+   my_errqueue_drain(wp);
+   if (rc == -1)
+      return(-1);
+   clock_gettime(CLOCK_REALTIME, &rts);
+
+   // process completions, none means the wait timed out
+   count = 0;
+   head  = *ur->cq_head;
+   tail  = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+   if (head == tail)
+      my_shm_publish(wp, 1);
+   for(; (head != tail); head++)
+   {
+      cqe   = &ur->cqes[head & ur->cq_mask];
+      tag   = cqe->user_data & MY_URING_TAG_MASK;
+      res   = cqe->res;
+      flags = cqe->flags;
+      bid   = flags >> IORING_CQE_BUFFER_SHIFT;
+
+#ifdef IORING_CQE_F_NOTIF
+      // zero copy transmit completes twice, the buffer is returned once
+      // the notification reports the kernel released it
+      if (tag == MY_URING_SEND_ZC)
+      {
+         bid      = (unsigned)(cqe->user_data & ~MY_URING_TAG_MASK);
+         wp->sock = &wp->socks[ur->socks[bid]];
+         if ((flags & IORING_CQE_F_NOTIF))
+         {
+            if (((unsigned)res & IORING_NOTIF_USAGE_ZC_COPIED))
+               MY_STAT_INC(wp, MY_STAT_ZC_COPIED, 1);
+            my_uring_recycle(ur, bid);
+            continue;
+         };
+         my_stats_sent(wp, res, ur->segs[bid], &ur->stamps[bid]);
+         if (res >= 0)
+            MY_STAT_INC(wp, MY_STAT_ZC_PKTS, 1);
+         if ( (res == -EINVAL) && (!(ur->zc_unsupported)) )
+         {
+            syslog(LOG_NOTICE, "worker %u: zero copy transmit not supported by io_uring", wp->id);
+            ur->zc_unsupported = 1;
+         };
+         if (!(flags & IORING_CQE_F_MORE))
+            my_uring_recycle(ur, bid);
+         continue;
+      };
+#endif
+
+      if (tag == MY_URING_CANCEL)
+         continue;
+
+      // transmit completed, return buffer to kernel
+      if (tag == MY_URING_SEND)
+      {
+         bid      = (unsigned)(cqe->user_data & ~MY_URING_TAG_MASK);
+         wp->sock = &wp->socks[ur->socks[bid]];
+         my_stats_sent(wp, res, ur->segs[bid], &ur->stamps[bid]);
+         my_uring_recycle(ur, bid);
+         continue;
+      };
+
+      // receive completed
+      idx = (unsigned)(cqe->user_data & ~MY_URING_TAG_MASK);
+      if (idx >= listeners_len)
+         continue;
+      wp->sock = &wp->socks[idx];
+      if (!(flags & IORING_CQE_F_MORE))
+         wp->sock->armed = 0;
+      if (res < 0)
+      {
+         if ( (res == -EINVAL) && (!(wp->conn)) )
+            ur->unsupported = 1;
+         else if ( (res != -ENOBUFS) && (res != -ECANCELED) )
+         {
+            MY_STAT_INC(wp, MY_STAT_RX_ERRORS, 1);
+            syslog(LOG_ERR, "worker %u: recvmsg(): %s", wp->id, strerror(-res));
+         };
+         continue;
+      };
+      if (!(flags & IORING_CQE_F_BUFFER))
+         continue;
+      out     = (struct io_uring_recvmsg_out *)&ur->bufs[bid * MY_URING_BUFSZ];
+      sap     = (union my_sa *)&out[1];
+      payload = (uint8_t *)&out[1] + ur->recvmsg.msg_namelen + ur->recvmsg.msg_controllen;
+      len     = (ssize_t)out->payloadlen;
+      if ( (len > MY_BUFF_SIZE) || ((out->flags & MSG_TRUNC)) )
+         MY_STAT_INC(wp, MY_STAT_TRUNCATED, 1);
+      if (len > MY_BUFF_SIZE)
+         len = MY_BUFF_SIZE;
+
+      // kernel receive timestamp is carried in ancillary data after address
+      MY_PROF_BEGIN(wp);
+      memset(&ctl, 0, sizeof(ctl));
+      ctl.msg_control    = (uint8_t *)&out[1] + ur->recvmsg.msg_namelen;
+      ctl.msg_controllen = out->controllen;
+      ur->stamps[bid]    = rts;
+      wp->kstamp = (my_ts_rx(&ctl, &ur->stamps[bid]) == 0);
+      wp->ttl = my_ttl_rx(&ctl);
+      seg     = my_gro_rx(&ctl);
+      my_pktinfo_rx(&ctl, &wp->dst);
+      my_rxq_ovfl(wp, &ctl);
+      MY_PROF(wp, MY_PROF_STAMP);
+
+      // log, drop and delay request
+      wp->conn++;
+      if (my_echo_train(wp, sap, payload, &len, seg, &ur->stamps[bid], &ur->delays[count], &ur->fmts[bid * MY_TRAIN_SEGS]) != MY_SENT)
+      {
+         my_uring_recycle(ur, bid);
+         MY_PROF(wp, MY_PROF_IMPAIR);
+         continue;
+      };
+
+      // queue reply, submitted with the next wait
+      if ((sqe = my_uring_sqe(ur)) == NULL)
+      {
+         my_uring_recycle(ur, bid);
+         continue;
+      };
+      hdr                       = &ur->sendmsgs[bid];
+      hdr->msg_name             = sap;
+      hdr->msg_namelen          = out->namelen;
+      hdr->msg_iov              = &ur->sendiovs[bid];
+      hdr->msg_iovlen           = 1;
+      hdr->msg_iov->iov_base    = payload;
+      hdr->msg_iov->iov_len     = (size_t)len;
+      ur->segs[bid]             = (unsigned)seg;
+      ur->socks[bid]            = idx;
+      ur->conns[bid]            = wp->conn;
+      ur->dsts[bid]             = wp->dst;
+      my_reply_ctrl(hdr, ctl.msg_control, &wp->dst, seg, len);
+      sqe->opcode               = IORING_OP_SENDMSG;
+      sqe->fd                   = wp->sock->s;
+      sqe->addr                 = (uint64_t)(uintptr_t)hdr;
+      sqe->len                  = 1;
+      sqe->user_data            = MY_URING_SEND | bid;
+#ifdef IORING_CQE_F_NOTIF
+      // provided buffer stays pinned until the kernel releases the payload
+      if ( ((cnf.zerocopy)) && ((size_t)len >= cnf.zerocopy) && (!(ur->zc_unsupported)) )
+      {
+         sqe->opcode            = IORING_OP_SENDMSG_ZC;
+         sqe->ioprio            = IORING_SEND_ZC_REPORT_USAGE;
+         sqe->user_data         = MY_URING_SEND_ZC | bid;
+      };
+#endif
+      ur->replies[count++]      = bid;
+      MY_PROF(wp, MY_PROF_IMPAIR);
+   };
+   __atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+   if (!(count))
+      return(0);
+
+   // grab timestamp
+   clock_gettime(CLOCK_REALTIME, &ts);
+   ts.tv_nsec++;
+   my_hist_add(&wp->stats->hists[MY_HIST_SERVICE], &rts, &ts, count);
+
+   // update echo plus headers and log replies under the connection number
+   // and local address of their requests, transmit itself is profiled as
+   // part of the next wait
+   MY_PROF_BEGIN(wp);
+   conn = wp->conn;
+   for(pos = 0; (pos < count); pos++)
+   {
+      hdr      = &ur->sendmsgs[ur->replies[pos]];
+      delay    = ur->delays[pos];
+      seg      = ur->segs[ur->replies[pos]];
+      wp->sock = &wp->socks[ur->socks[ur->replies[pos]]];
+      wp->conn = ur->conns[ur->replies[pos]];
+      wp->dst  = ur->dsts[ur->replies[pos]];
+      fmts     = &ur->fmts[ur->replies[pos] * MY_TRAIN_SEGS];
+      my_echo_reply_time(hdr->msg_iov->iov_base, (ssize_t)hdr->msg_iov->iov_len, seg, fmts, &ts);
+      my_log_train(wp, MY_SENT, hdr->msg_name, hdr->msg_iov->iov_base, (ssize_t)hdr->msg_iov->iov_len, seg, fmts, &ts, delay);
+   };
+   wp->conn = conn;
+   MY_PROF(wp, MY_PROF_LOG_SENT);
+
+   return(0);
+}
+
+
+// return provided buffer to kernel
+void my_uring_recycle(struct my_uring * ur, unsigned bid)
+{
+   struct io_uring_buf     * buf;
+
+   buf       = &ur->br->bufs[ur->br_tail & (MY_URING_BUFFERS - 1)];
+   buf->addr = (uint64_t)(uintptr_t)&ur->bufs[bid * MY_URING_BUFSZ];
+   buf->len  = MY_URING_BUFSZ;
+   buf->bid  = (uint16_t)bid;
+   ur->br_tail++;
+   __atomic_store_n(&ur->br->tail, ur->br_tail, __ATOMIC_RELEASE);
+
+   return;
+}
+
+
+// retrieve next free submission queue entry
+struct io_uring_sqe * my_uring_sqe(struct my_uring * ur)
+{
+   struct io_uring_sqe     * sqe;
+
+   if ((ur->sq_pending - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE)) >= ur->sq_entries)
+      if (my_uring_enter(ur, -1) == -1)
+         return(NULL);
+   if ((ur->sq_pending - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE)) >= ur->sq_entries)
+      return(NULL);
+
+   sqe = &ur->sqes[ur->sq_pending & ur->sq_mask];
+   memset(sqe, 0, sizeof(struct io_uring_sqe));
+   ur->sq_pending++;
+
+   return(sqe);
+}
+#endif
+
+
+// signal handler
+void my_sighandler(int signum)
+{
+   signal(signum, my_sighandler);
+   if (signum == SIGHUP)
+   {
+      should_reload = 1;
+      return;
+   };
+   if (signum == SIGUSR2)
+   {
+      should_dump = 1;
+      return;
+   };
+#ifdef MY_PROFILE
+   if (signum == SIGUSR1)
+   {
+      should_profile = 1;
+      return;
+   };
+#endif
+   should_stop = 1;
+   return;
+}
+
+
+// account requests the kernel dropped from the socket receive queue
+void my_rxq_ovfl(struct my_worker * wp, struct msghdr * hdr)
+{
+#ifdef SO_RXQ_OVFL
+   uint32_t                  drops;
+   struct cmsghdr          * cmsg;
+
+   // counter is cumulative per socket and only present once nonzero
+   for(cmsg = CMSG_FIRSTHDR(hdr); (cmsg != NULL); cmsg = CMSG_NXTHDR(hdr, cmsg))
+   {
+      if ( (cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SO_RXQ_OVFL) &&
+           (cmsg->cmsg_len >= CMSG_LEN(sizeof(uint32_t))) )
+      {
+         memcpy(&drops, CMSG_DATA(cmsg), sizeof(uint32_t));
+         if (drops != wp->sock->rxq_ovfl)
+            MY_STAT_INC(wp, MY_STAT_RXQ_DROPS, drops - wp->sock->rxq_ovfl);
+         wp->sock->rxq_ovfl = drops;
+         return;
+      };
+   };
+#else
+   (void)wp;
+   (void)hdr;
+#endif
+   return;
+}
+
+
+// log growth of kernel receive queue drops of each listener
+void my_rxq_report(void)
+{
+   unsigned                  pos;
+   unsigned                  idx;
+   uint64_t                  drops;
+   struct my_listener      * lp;
+
+   for(idx = 0; (idx < listeners_len); idx++)
+   {
+      lp = &listeners[idx];
+      for(pos = 0, drops = 0; (pos < cnf.workers); pos++)
+         drops += atomic_load_explicit(&workers[pos].socks[idx].counters[MY_STAT_RXQ_DROPS], memory_order_relaxed);
+      if (drops == lp->reported)
+         continue;
+      syslog(LOG_WARNING, "%s: socket receive queues dropped %" PRIu64 " requests (%" PRIu64 " total), server is not keeping up", lp->name, drops - lp->reported, drops);
+      lp->reported = drops;
+   };
+
+   return;
+}
+
+
+// set socket buffer, exceeding system limits when privileged, returns size applied by kernel
+int my_sockbuf(int s, int opt, int opt_force, size_t size)
+{
+   int                       val;
+   socklen_t                 len;
+
+   val = (size > (INT_MAX / 2)) ? (INT_MAX / 2) : (int)size;
+   if ( (opt_force == -1) || (setsockopt(s, SOL_SOCKET, opt_force, (void *)&val, sizeof(int)) == -1) )
+   {
+      // unprivileged requests are silently capped by net.core.[rw]mem_max
+      if (setsockopt(s, SOL_SOCKET, opt, (void *)&val, sizeof(int)) == -1)
+      {
+         my_error("setsockopt(%s): %s", (opt == SO_RCVBUF) ? "SO_RCVBUF" : "SO_SNDBUF", strerror(errno));
+         return(-1);
+      };
+   };
+
+   // kernel doubles the request to allow for bookkeeping overhead
+   len = sizeof(int);
+   if (getsockopt(s, SOL_SOCKET, opt, (void *)&val, &len) == -1)
+      return(0);
+   if ((size_t)val < size)
+      my_debug("%s capped at %i bytes, %zu requested", (opt == SO_RCVBUF) ? "SO_RCVBUF" : "SO_SNDBUF", val, size);
+
+   return(val);
+}
+
+
+// compare socket addresses
+int my_sa_equal(const union my_sa * a, const union my_sa * b)
+{
+   if (a->sa.sa_family != b->sa.sa_family)
+      return(0);
+
+   switch(a->sa.sa_family)
+   {
+      case AF_INET:
+      return( (a->sin.sin_port == b->sin.sin_port) &&
+              (a->sin.sin_addr.s_addr == b->sin.sin_addr.s_addr) );
+
+      case AF_INET6:
+      return( (a->sin6.sin6_port == b->sin6.sin6_port) &&
+              (a->sin6.sin6_scope_id == b->sin6.sin6_scope_id) &&
+              (!(memcmp(&a->sin6.sin6_addr, &b->sin6.sin6_addr, sizeof(struct in6_addr)))) );
+
+      default:
+      break;
+   };
+
+   return(0);
+}
+
+
+// wait up to timeout milliseconds for metrics and control connections
+void my_service_poll(int timeout)
+{
+   nfds_t                    nfds;
+   nfds_t                    pos;
+   struct pollfd             fds[2];
+
+   nfds = 0;
+   if (metrics_s != -1)
+   {
+      fds[nfds].fd      = metrics_s;
+      fds[nfds].events  = POLLIN;
+      fds[nfds].revents = 0;
+      nfds++;
+   };
+   if (control_s != -1)
+   {
+      fds[nfds].fd      = control_s;
+      fds[nfds].events  = POLLIN;
+      fds[nfds].revents = 0;
+      nfds++;
+   };
+
+   if (poll(fds, nfds, timeout) < 1)
+      return;
+
+   for(pos = 0; (pos < nfds); pos++)
+   {
+      if (!(fds[pos].revents & POLLIN))
+         continue;
+      if (fds[pos].fd == metrics_s)
+         my_metrics_serve();
+      else
+         my_control_serve();
+   };
+
+   return;
+}
+
+
+// create shared memory statistics segment
+int my_shm_open(const char * path)
+{
+   int                       fd;
+   unsigned                  pos;
+   size_t                    size;
+   uint32_t                  magic;
+   uint64_t                  pid;
+   struct stat               sb;
+   void                    * ptr;
+
+   _Static_assert(MY_STAT_COUNTERS <= UDP_ECHO_STATS_COUNTERS, "statistics segment counter slots");
+   _Static_assert(MY_HIST_BUCKETS <= UDP_ECHO_STATS_BUCKETS, "statistics segment bucket slots");
+   _Static_assert(MY_HIST_COUNT <= UDP_ECHO_STATS_HISTS, "statistics segment histograms");
+
+   // only a statistics segment is replaced, and one of a running instance
+   // only when taking over, since its readers keep the segment mapped and
+   // just the path moves to this instance
+   if ((fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) != -1)
+   {
+      magic = 0;
+      pid   = 0;
+      if ( (fstat(fd, &sb) == 0) && (S_ISREG(sb.st_mode)) && ((size_t)sb.st_size >= sizeof(struct udp_echo_stats)) &&
+           ((ptr = mmap(NULL, sizeof(struct udp_echo_stats), PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED) )
+      {
+         magic = ((struct udp_echo_stats *)ptr)->magic;
+         pid   = ((struct udp_echo_stats *)ptr)->pid;
+         munmap(ptr, sizeof(struct udp_echo_stats));
+      };
+      close(fd);
+      if (magic != UDP_ECHO_STATS_MAGIC)
+      {
+         my_error("%s: exists and is not a statistics segment", path);
+         return(-1);
+      };
+      if ( (!(cnf.takeover)) && ((pid)) && (pid != (uint64_t)getpid()) && (kill((pid_t)pid, 0) == 0) )
+      {
+         my_error("%s: in use by process %" PRIu64, path, pid);
+         return(-1);
+      };
+      unlink(path);
+   };
+   if ((fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644)) == -1)
+   {
+      my_error("open(%s): %s", path, strerror(errno));
+      return(-1);
+   };
+   shm_path = path;
+   if ( ((cnf.uid != getuid()) || (cnf.gid != getgid())) && (fchown(fd, cnf.uid, cnf.gid) == -1) )
+   {
+      my_error("fchown(): %s", strerror(errno));
+      close(fd);
+      return(-1);
+   };
+
+   size = sizeof(struct udp_echo_stats) + (sizeof(struct udp_echo_stats_worker) * cnf.workers);
+   if (ftruncate(fd, (off_t)size) == -1)
+   {
+      my_error("ftruncate(): %s", strerror(errno));
+      close(fd);
+      return(-1);
+   };
+   if ((ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+   {
+      my_error("mmap(): %s", strerror(errno));
+      close(fd);
+      return(-1);
+   };
+   close(fd);
+
+   // magic is stored once the PID is known
+   shm                = ptr;
+   shm_size           = size;
+   shm->version       = UDP_ECHO_STATS_VERSION;
+   shm->hist_shift    = MY_HIST_SHIFT;
+   shm->workers       = cnf.workers;
+   shm->hist_buckets  = MY_HIST_BUCKETS;
+   shm->started       = (uint64_t)time(NULL);
+   for(pos = 0; (pos < cnf.workers); pos++)
+   {
+      shm->worker[pos].id = pos;
+      workers[pos].shm    = &shm->worker[pos];
+   };
+
+   return(0);
+}
+
+
+// copy worker statistics into its segment record, readers retry while
+// seq is odd or changes so the copy itself needs no ordering
+void my_shm_publish(struct my_worker * wp, int force)
+{
+   unsigned                  pos;
+   unsigned                  h;
+   uint32_t                  seq;
+   uint64_t                  now;
+   struct timespec           ts;
+   struct udp_echo_stats_worker * rec;
+
+   if ((rec = wp->shm) == NULL)
+      return;
+
+   clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+   now = ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+   if ( (!(force)) && ((now - wp->shm_last) < MY_SHM_INTERVAL) )
+      return;
+   wp->shm_last = now;
+
+   seq = rec->seq;
+   __atomic_store_n(&rec->seq, seq + 1, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+
+   __atomic_store_n(&rec->updated, now, __ATOMIC_RELAXED);
+   __atomic_store_n(&rec->delayed, (((wp->delayq)) ? wp->delayq->count : 0), __ATOMIC_RELAXED);
+   __atomic_store_n(&rec->flows,   (((wp->flows))  ? wp->flows->count  : 0), __ATOMIC_RELAXED);
+   for(pos = 0; (pos < MY_STAT_COUNTERS); pos++)
+      __atomic_store_n(&rec->counters[pos], atomic_load_explicit(&wp->stats->counters[pos], memory_order_relaxed), __ATOMIC_RELAXED);
+   for(h = 0; (h < MY_HIST_COUNT); h++)
+   {
+      __atomic_store_n(&rec->hist_count[h], atomic_load_explicit(&wp->stats->hists[h].count, memory_order_relaxed), __ATOMIC_RELAXED);
+      __atomic_store_n(&rec->hist_sum[h],   atomic_load_explicit(&wp->stats->hists[h].sum,   memory_order_relaxed), __ATOMIC_RELAXED);
+      for(pos = 0; (pos < MY_HIST_BUCKETS); pos++)
+         __atomic_store_n(&rec->hist[h][pos], atomic_load_explicit(&wp->stats->hists[h].buckets[pos], memory_order_relaxed), __ATOMIC_RELAXED);
+   };
+
+   __atomic_store_n(&rec->seq, seq + 2, __ATOMIC_RELEASE);
+
+   return;
+}
+
+
+// create and bind UDP socket
+int my_socket(union my_sa * sap, socklen_t socklen)
+{
+   int                       s;
+   int                       opt;
+
+   if ((s = socket(sap->sa.sa_family, SOCK_DGRAM, 0)) == -1)
+   {
+      my_error("socket(): %s", strerror(errno));
+      return(-1);
+   };
+
+   // set socket options
+   my_debug("setting socket options");
+   opt = 1;
+   if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (void *)&opt, sizeof(int)) == -1)
+   {
+      my_error("setsockopt(SO_REUSEADDR): %s", strerror(errno));
+      close(s);
+      return(-1);
+   };
+#ifdef SO_REUSEPORT
+   // set even for a single worker so an instance taking over with more
+   // workers can add sockets to the group
+   if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (void *)&opt, sizeof(int)) == -1)
+   {
+      my_error("setsockopt(SO_REUSEPORT): %s", strerror(errno));
+      close(s);
+      return(-1);
+   };
+#endif
+   if (my_socket_opts(s, sap->sa.sa_family) == -1)
+   {
+      close(s);
+      return(-1);
+   };
+
+   // bind socket to interface
+   my_debug("binding socket");
+   if (bind(s, &sap->sa, socklen) == -1)
+   {
+      my_error("bind(): %s", strerror(errno));
+      close(s);
+      return(-1);
+   };
+
+   return(s);
+}
+
+
+// apply configured socket options, disabled features are switched off
+// since sockets taken over from a previous instance carry its settings
+int my_socket_opts(int s, int family)
+{
+   int                       opt;
+   size_t                    size;
+
+   if (my_ts_enable(s) == -1)
+      return(-1);
+
+#ifdef UDP_GRO
+   // kernel coalesces trains of equally sized datagrams from the same flow
+   opt = ((cnf.gro)) ? 1 : 0;
+   if ( (setsockopt(s, SOL_UDP, UDP_GRO, (void *)&opt, sizeof(int)) == -1) && ((opt)) )
+   {
+      my_error("setsockopt(UDP_GRO): %s", strerror(errno));
+      return(-1);
+   };
+#endif
+
+#ifdef SO_ZEROCOPY
+   opt = ((cnf.zerocopy)) ? 1 : 0;
+   if ( (setsockopt(s, SOL_SOCKET, SO_ZEROCOPY, (void *)&opt, sizeof(int)) == -1) && ((opt)) )
+   {
+      my_error("setsockopt(SO_ZEROCOPY): %s", strerror(errno));
+      return(-1);
+   };
+#endif
+
+   opt = 1;
+#ifdef SO_RXQ_OVFL
+   // kernel reports its receive queue drop counter with each datagram
+   if (setsockopt(s, SOL_SOCKET, SO_RXQ_OVFL, (void *)&opt, sizeof(int)) == -1)
+   {
+      my_error("setsockopt(SO_RXQ_OVFL): %s", strerror(errno));
+      return(-1);
+   };
+#endif
+
+   // a single client flow lands on one socket regardless of the number of
+   // workers, so each socket is sized for the whole burst
+   if ((cnf.rate))
+   {
+      size = (size_t)((cnf.rate / 8) * cnf.burst / 1000000);
+      if ( (my_sockbuf(s, SO_RCVBUF, MY_SO_RCVBUFFORCE, size) == -1) ||
+           (my_sockbuf(s, SO_SNDBUF, MY_SO_SNDBUFFORCE, size) == -1) )
+         return(-1);
+   };
+
+#ifdef SO_BUSY_POLL
+   // driver queue is polled from the receive call instead of waiting for an interrupt
+   opt = (int)cnf.busy_poll;
+   if ( (setsockopt(s, SOL_SOCKET, SO_BUSY_POLL, (void *)&opt, sizeof(int)) == -1) && ((opt)) )
+   {
+      my_error("setsockopt(SO_BUSY_POLL): %s", strerror(errno));
+      return(-1);
+   };
+#ifdef SO_PREFER_BUSY_POLL
+   opt = ((cnf.busy_poll)) ? 1 : 0;
+   if ( (setsockopt(s, SOL_SOCKET, SO_PREFER_BUSY_POLL, (void *)&opt, sizeof(int)) == -1) && ((opt)) )
+      my_debug("setsockopt(SO_PREFER_BUSY_POLL): %s", strerror(errno));
+#endif
+#endif
+
+   // replies leave from the address each request arrived on, which matters
+   // when bound to a wildcard address on a host with several addresses
+   opt = 1;
+   if (family == AF_INET6)
+   {
+#ifdef IPV6_RECVPKTINFO
+      if (setsockopt(s, IPPROTO_IPV6, IPV6_RECVPKTINFO, (void *)&opt, sizeof(int)) == -1)
+      {
+         my_error("setsockopt(IPV6_RECVPKTINFO): %s", strerror(errno));
+         return(-1);
+      };
+#endif
+   }
+#ifdef IP_PKTINFO
+   else if (setsockopt(s, IPPROTO_IP, IP_PKTINFO, (void *)&opt, sizeof(int)) == -1)
+   {
+      my_error("setsockopt(IP_PKTINFO): %s", strerror(errno));
+      return(-1);
+   };
+#endif
+
+   // STAMP replies report the TTL of each test packet, IPv6 sockets also
+   // request IPv4 TTL for mapped addresses
+   opt = (cnf.mode == MY_MODE_STAMP) ? 1 : 0;
+   if (family == AF_INET6)
+   {
+      if ( (setsockopt(s, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, (void *)&opt, sizeof(int)) == -1) && ((opt)) )
+      {
+         my_error("setsockopt(IPV6_RECVHOPLIMIT): %s", strerror(errno));
+         return(-1);
+      };
+      setsockopt(s, IPPROTO_IP, IP_RECVTTL, (void *)&opt, sizeof(int));
+   }
+   else if ( (setsockopt(s, IPPROTO_IP, IP_RECVTTL, (void *)&opt, sizeof(int)) == -1) && ((opt)) )
+   {
+      my_error("setsockopt(IP_RECVTTL): %s", strerror(errno));
+      return(-1);
+   };
+
+   return(0);
+}
+
+
+// sum statistics of all workers
+void my_stats_merge(struct my_totals * tp)
+{
+   unsigned                  pos;
+   unsigned                  idx;
+   unsigned                  h;
+   unsigned                  l;
+   struct my_stats         * sp;
+
+   memset(tp, 0, sizeof(struct my_totals));
+   for(pos = 0; (pos < cnf.workers); pos++)
+   {
+      sp = workers[pos].stats;
+      for(idx = 0; (idx < MY_STAT_COUNTERS); idx++)
+         tp->counters[idx] += atomic_load_explicit(&sp->counters[idx], memory_order_relaxed);
+      for(h = 0; (h < MY_HIST_COUNT); h++)
+      {
+         for(idx = 0; (idx < MY_HIST_BUCKETS); idx++)
+            tp->hist[h][idx] += atomic_load_explicit(&sp->hists[h].buckets[idx], memory_order_relaxed);
+         tp->hist_count[h] += atomic_load_explicit(&sp->hists[h].count, memory_order_relaxed);
+         tp->hist_sum[h]   += atomic_load_explicit(&sp->hists[h].sum,   memory_order_relaxed);
+      };
+      tp->log_dropped += atomic_load_explicit(&workers[pos].log->dropped, memory_order_relaxed);
+      for(l = 0; (l < listeners_len); l++)
+         for(idx = 0; (idx < MY_STAT_COUNTERS); idx++)
+            tp->listeners[l][idx] += atomic_load_explicit(&workers[pos].socks[l].counters[idx], memory_order_relaxed);
+   };
+
+   return;
+}
+
+
+// account transmitted reply or send error
+void my_stats_sent(struct my_worker * wp, ssize_t ssize, size_t seg, const struct timespec * rxp)
+{
+   if (ssize < 0)
+   {
+      MY_STAT_INC(wp, MY_STAT_TX_ERRORS, 1);
+      return;
+   };
+   MY_STAT_INC(wp, MY_STAT_TX_PKTS,  ( ((seg)) && ((size_t)ssize > seg) ) ? ((size_t)ssize + seg - 1) / seg : 1);
+   MY_STAT_INC(wp, MY_STAT_TX_BYTES, ssize);
+   my_ts_sent(wp, rxp);
+   return;
+}
+
+
+// read transmit timestamps and zero copy completions from socket error queue
+void my_errqueue_drain(struct my_worker * wp)
+{
+#ifdef SO_TIMESTAMPING
+   int                       found;
+   unsigned                  idx;
+   uint32_t                  id;
+   struct my_sock          * sp;
+   struct my_tsq           * tq;
+   struct msghdr             hdr;
+   struct cmsghdr          * cmsg;
+   struct timespec         * txp;
+   struct sock_extended_err  serr;
+   struct scm_timestamping   stamps;
+   union
+   {
+      char                   bytes[MY_CMSG_SIZE];
+      struct cmsghdr         align;
+   } ctrl;
+
+#ifdef MSG_WAITFORONE
+   if ( (!(wp->socks[0].tsq)) && ( (!(wp->batch)) || (!(wp->batch->zc)) ) )
+      return;
+#else
+   if (!(wp->socks[0].tsq))
+      return;
+#endif
+
+   // identifiers are numbered per socket, so each queue is drained separately
+   for(idx = 0; (idx < listeners_len); idx++)
+   {
+      sp       = &wp->socks[idx];
+      tq       = sp->tsq;
+      wp->sock = sp;
+      while(1)
+      {
+         memset(&hdr, 0, sizeof(hdr));
+         hdr.msg_control    = ctrl.bytes;
+         hdr.msg_controllen = sizeof(ctrl);
+         if (recvmsg(sp->s, &hdr, MSG_ERRQUEUE|MSG_DONTWAIT) == -1)
+            break;
+
+         // each notification carries a timestamp and the identifier of its datagram
+         found = 0;
+         txp   = NULL;
+         for(cmsg = CMSG_FIRSTHDR(&hdr); (cmsg != NULL); cmsg = CMSG_NXTHDR(&hdr, cmsg))
+         {
+            if ( (cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPING) &&
+                 (cmsg->cmsg_len >= CMSG_LEN(sizeof(stamps))) )
+            {
+               memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+               txp = ( (stamps.ts[2].tv_sec) || (stamps.ts[2].tv_nsec) ) ? &stamps.ts[2] : &stamps.ts[0];
+            };
+            if ( ( ((cmsg->cmsg_level == SOL_IP)   && (cmsg->cmsg_type == IP_RECVERR)) ||
+                   ((cmsg->cmsg_level == SOL_IPV6) && (cmsg->cmsg_type == IPV6_RECVERR)) ) &&
+                 (cmsg->cmsg_len >= CMSG_LEN(sizeof(serr))) )
+            {
+               memcpy(&serr, CMSG_DATA(cmsg), sizeof(serr));
+               found = (serr.ee_errno == ENOMSG) && (serr.ee_origin == SO_EE_ORIGIN_TIMESTAMPING);
+#if defined(SO_EE_ORIGIN_ZEROCOPY) && defined(MSG_WAITFORONE)
+               // zero copy completions cover the identifier range ee_info to ee_data
+               if ( (serr.ee_errno == 0) && (serr.ee_origin == SO_EE_ORIGIN_ZEROCOPY) && ((wp->batch)) && ((wp->batch->zc)) )
+                  my_zc_complete(wp, sp, serr.ee_info, serr.ee_data, (serr.ee_code & SO_EE_CODE_ZEROCOPY_COPIED));
+#endif
+            };
+         };
+         if ( (!(found)) || (!(txp)) || (!(tq)) || (tq->tail == tq->head) )
+            continue;
+
+         // resynchronize identifiers when the kernel numbered a datagram the
+         // worker did not record, replies skipped over lost their timestamp
+         id = serr.ee_data - tq->skew;
+         if ((id - tq->tail) >= (tq->head - tq->tail))
+         {
+            tq->skew = serr.ee_data - tq->tail;
+            id       = tq->tail;
+         };
+         my_hist_add(&wp->stats->hists[MY_HIST_RESIDENCE], &tq->rx[id & (MY_TSQ - 1)], txp, 1);
+         tq->tail = id + 1;
+      };
+   };
+#else
+   (void)wp;
+#endif
+}
+
+
+// set receive and transmit timestamps on socket, disabled unless configured
+int my_ts_enable(int s)
+{
+   int                       opt;
+
+#ifdef SO_TIMESTAMPING
+   // software timestamps are still requested in hardware mode for
+   // interfaces which do not provide hardware timestamps
+   opt = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE |
+         SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+   if (cnf.timestamp == MY_TS_HARDWARE)
+      opt |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+   if (cnf.timestamp == MY_TS_NONE)
+      opt = 0;
+   if ( (setsockopt(s, SOL_SOCKET, SO_TIMESTAMPING, (void *)&opt, sizeof(int)) == -1) && ((opt)) )
+   {
+      my_error("setsockopt(SO_TIMESTAMPING): %s", strerror(errno));
+      return(-1);
+   };
+#elif defined(SO_TIMESTAMPNS)
+   opt = (cnf.timestamp != MY_TS_NONE) ? 1 : 0;
+   if ( (setsockopt(s, SOL_SOCKET, SO_TIMESTAMPNS, (void *)&opt, sizeof(int)) == -1) && ((opt)) )
+   {
+      my_error("setsockopt(SO_TIMESTAMPNS): %s", strerror(errno));
+      return(-1);
+   };
+#else
+   (void)s;
+   (void)opt;
+#endif
+
+   return(0);
+}
+
+
+// extract receive timestamp from ancillary data, returns -1 if none present
+int my_ts_rx(struct msghdr * hdr, struct timespec * tsp)
+{
+   struct cmsghdr          * cmsg;
+#ifdef SO_TIMESTAMPING
+   struct scm_timestamping   stamps;
+#endif
+
+   for(cmsg = CMSG_FIRSTHDR(hdr); (cmsg != NULL); cmsg = CMSG_NXTHDR(hdr, cmsg))
+   {
+      if (cmsg->cmsg_level != SOL_SOCKET)
+         continue;
+#ifdef SO_TIMESTAMPING
+      // hardware timestamp is zero when the interface did not provide one
+      if ( (cmsg->cmsg_type == SCM_TIMESTAMPING) && (cmsg->cmsg_len >= CMSG_LEN(sizeof(stamps))) )
+      {
+         memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+         if ( (cnf.timestamp == MY_TS_HARDWARE) && ( (stamps.ts[2].tv_sec) || (stamps.ts[2].tv_nsec) ) )
+            *tsp = stamps.ts[2];
+         else if ( (stamps.ts[0].tv_sec) || (stamps.ts[0].tv_nsec) )
+            *tsp = stamps.ts[0];
+         else
+            continue;
+         return(0);
+      };
+#endif
+#ifdef SO_TIMESTAMPNS
+      if ( (cmsg->cmsg_type == SCM_TIMESTAMPNS) && (cmsg->cmsg_len >= CMSG_LEN(sizeof(struct timespec))) )
+      {
+         memcpy(tsp, CMSG_DATA(cmsg), sizeof(struct timespec));
+         return(0);
+      };
+#endif
+   };
+
+   return(-1);
+}
+
+
+// extract TTL or hop limit from ancillary data, returns 0 if none present
+uint8_t my_ttl_rx(struct msghdr * hdr)
+{
+   int                       ttl;
+   struct cmsghdr          * cmsg;
+
+   for(cmsg = CMSG_FIRSTHDR(hdr); (cmsg != NULL); cmsg = CMSG_NXTHDR(hdr, cmsg))
+   {
+      if ( ( ((cmsg->cmsg_level == IPPROTO_IP)   && (cmsg->cmsg_type == IP_TTL)) ||
+             ((cmsg->cmsg_level == IPPROTO_IPV6) && (cmsg->cmsg_type == IPV6_HOPLIMIT)) ) &&
+           (cmsg->cmsg_len >= CMSG_LEN(sizeof(int))) )
+      {
+         memcpy(&ttl, CMSG_DATA(cmsg), sizeof(int));
+         return((uint8_t)ttl);
+      };
+   };
+
+   return(0);
+}
+
+
+// remember receive timestamp of reply until its transmit timestamp arrives
+void my_ts_sent(struct my_worker * wp, const struct timespec * rxp)
+{
+   struct my_tsq           * tq;
+
+   if ((tq = wp->sock->tsq) == NULL)
+      return;
+
+   // kernel numbers each transmitted datagram, oldest entries are overwritten
+   tq->rx[tq->head & (MY_TSQ - 1)] = *rxp;
+   tq->head++;
+   if ((tq->head - tq->tail) > MY_TSQ)
+      tq->tail = tq->head - MY_TSQ;
+
+   return;
+}
+
 
-   // bind socket to interface
-   my_debug("binding socket");
-   if ((rc = bind(s, &sa.sa, socklen)) == -1)
+// receive sockets from running instance, returns 1 if none is running
+int my_takeover(void)
+{
+   int                       s;
+   int                     * fds;
+   unsigned                  nfds;
+   uint32_t                  count;
+   ssize_t                   ssize;
+   struct timeval            tv;
+   struct iovec              iov;
+   struct msghdr             hdr;
+   struct cmsghdr          * cmsg;
+   struct sockaddr_un        sun;
+   union
    {
-      my_error("bind(): %s", strerror(errno));
-      close(s);
-      close(fd);
-      unlink(cnf.pidfile);
-      return(-1);
-   };
+      char                   bytes[CMSG_SPACE(sizeof(int) * MY_HANDOFF_FDS)];
+      struct cmsghdr         align;
+   } ctrl;
 
-   // log socket address
-   socklen = sizeof(struct sockaddr_storage);
-   if ((rc = getsockname(s, &sa.sa, &socklen)) == -1)
+   if (strlen(cnf.control) >= sizeof(sun.sun_path))
    {
-      my_error("getsockname(): %s", strerror(errno));
-      close(s);
-      close(fd);
-      unlink(cnf.pidfile);
+      my_error("control socket path too long");
       return(-1);
    };
-   switch(sa.ss.ss_family)
-   {
-      case AF_INET:
-      inet_ntop(sa.sin.sin_family, &sa.sin.sin_addr,  addr_str, sizeof(addr_str));
-      port = ntohs(sa.sin.sin_port);
-      break;
-
-      case AF_INET6:
-      inet_ntop(sa.sin6.sin6_family, &sa.sin6.sin6_addr, addr_str, sizeof(addr_str));
-      port = ntohs(sa.sin6.sin6_port);
-      break;
+   memset(&sun, 0, sizeof(sun));
+   sun.sun_family = AF_UNIX;
+   strncpy(sun.sun_path, cnf.control, sizeof(sun.sun_path)-1);
 
-      default:
-      my_error("listening socket has invalid address family: %i\n", sa.sa.sa_family);
-      close(s);
-      close(fd);
-      unlink(cnf.pidfile);
+   if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+   {
+      my_error("socket(): %s", strerror(errno));
       return(-1);
    };
-
-   // change ownership
-   if ( (getgid() != cnf.gid) && ((rc = setregid(cnf.gid, cnf.gid)) == -1) )
+   my_debug("connecting to running instance (%s)", cnf.control);
+   if (connect(s, (struct sockaddr *)&sun, sizeof(sun)) == -1)
    {
-      my_error("getgid(): %s", strerror(errno));
+      if ( (errno == ENOENT) || (errno == ECONNREFUSED) )
+      {
+         my_debug("no running instance, starting normally");
+         close(s);
+         return(1);
+      };
+      my_error("connect(%s): %s", cnf.control, strerror(errno));
       close(s);
-      close(fd);
-      unlink(cnf.pidfile);
       return(-1);
    };
-   if ( (getuid() != cnf.uid) && ((rc = setreuid(cnf.uid, cnf.uid)) == -1) )
+
+   // bound the wait on an instance which stops responding
+   tv.tv_sec  = MY_CONTROL_TIMEOUT / 1000;
+   tv.tv_usec = 0;
+   setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (void *)&tv, sizeof(tv));
+   if (send(s, "takeover\n", 9, MSG_NOSIGNAL) != 9)
    {
-      my_error("getuid(): %s", strerror(errno));
+      my_error("send(): %s", strerror(errno));
       close(s);
-      close(fd);
-      unlink(cnf.pidfile);
       return(-1);
    };
 
-   // fork process
-   if (!(cnf.dont_fork))
+   // collect sockets until the empty record
+   do
    {
-      my_debug("forking process");
-      switch(pid = fork())
+      iov.iov_base = &count;
+      iov.iov_len  = sizeof(count);
+      memset(&hdr, 0, sizeof(hdr));
+      hdr.msg_iov        = &iov;
+      hdr.msg_iovlen     = 1;
+      hdr.msg_control    = ctrl.bytes;
+      hdr.msg_controllen = sizeof(ctrl);
+      if ((ssize = recvmsg(s, &hdr, MSG_WAITALL)) != (ssize_t)sizeof(count))
       {
-         case -1:
-         my_error("fork(): %s", strerror(errno));
-         break;
-
-         case 0:
-         break;
-
-         default:
-         my_debug("forking to %i", pid);
-         closelog();
-         close(fd);
+         my_error("takeover: %s", (ssize == -1) ? strerror(errno) : "connection closed by running instance");
          close(s);
-         return(0);
+         return(-1);
       };
-   };
 
-   // record PID in pidfile
-   pid = getpid();
-   snprintf(buff, sizeof(buff), "%i", pid);
-   write(fd, buff, strlen(buff));
-   close(fd);
+      nfds = 0;
+      for(cmsg = CMSG_FIRSTHDR(&hdr); (cmsg != NULL); cmsg = CMSG_NXTHDR(&hdr, cmsg))
+      {
+         if ( (cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS) )
+            continue;
+         nfds = (unsigned)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+         if ((fds = realloc(handoff_fds, sizeof(int) * (handoff_len + nfds))) == NULL)
+         {
+            my_error("out of virtual memory");
+            close(s);
+            return(-1);
+         };
+         handoff_fds = fds;
+         memcpy(&handoff_fds[handoff_len], CMSG_DATA(cmsg), sizeof(int) * nfds);
+         handoff_len += nfds;
+      };
+      if ( (nfds != count) || ((hdr.msg_flags & MSG_CTRUNC)) )
+      {
+         my_error("takeover: incomplete socket record from running instance");
+         close(s);
+         return(-1);
+      };
+   } while((count));
 
-   // opens syslog
-   openlog(cnf.prog_name, LOG_PID | (((cnf.dont_fork)) ? LOG_PERROR : 0), cnf.facility);
-   syslog(LOG_NOTICE, "%s v%s", PROGRAM_NAME, PACKAGE_VERSION);
-   syslog(LOG_NOTICE, "echo plus enabled: %s", ((cnf.echoplus)) ? "yes" : "no");
-   syslog(LOG_NOTICE, "random delay: %u us", cnf.delay);
-   syslog(LOG_NOTICE, "drop probability: %u%%", cnf.drop_perct);
-   syslog(LOG_NOTICE, "running as UID: %u", getuid());
-   syslog(LOG_NOTICE, "running as GID: %u", getgid());
-   syslog(LOG_NOTICE, "listening on [%s]:%hu", addr_str, port);
+   // connection stays open until the new workers run
+   my_debug("received %u sockets from running instance", handoff_len);
+   takeover_s = s;
 
-   return(s);
+   return(0);
 }
 
 
-// display debug message
-void my_debug(const char * fmt, ...)
+// claim socket taken over from previous instance bound to address, returns -1 if none
+int my_takeover_claim(const union my_sa * sap)
 {
-   va_list args;
+   int                       s;
+   unsigned                  pos;
+   socklen_t                 socklen;
+   union my_sa               sa;
 
-   if (!(cnf.verbose))
+   for(pos = 0; (pos < handoff_len); pos++)
+   {
+      if ((s = handoff_fds[pos]) == -1)
+         continue;
+      socklen = sizeof(sa);
+      if (getsockname(s, &sa.sa, &socklen) == -1)
+         continue;
+      if (!(my_sa_equal(&sa, sap)))
+         continue;
+      handoff_fds[pos] = -1;
+      return(s);
+   };
+
+   return(-1);
+}
+
+
+// tell previous instance the new workers are running
+void my_takeover_ready(void)
+{
+   if (takeover_s == -1)
       return;
 
-   printf("%s: ", cnf.prog_name);
+   syslog(LOG_NOTICE, "takeover: workers running, previous instance draining");
+   send(takeover_s, "ready\n", 6, MSG_NOSIGNAL);
+   close(takeover_s);
+   takeover_s = -1;
 
-   va_start(args, fmt);
-   vprintf(fmt, args);
-   va_end(args);
+   return;
+}
 
-   printf("\n");
 
+// display program usage
+void my_usage(void)
+{
+   printf("Usage: %s [options]\n", cnf.prog_name);
+   printf("OPTIONS:\n");
+   printf("  -b num,  --batch=num      datagrams per recvmmsg()/sendmmsg() (default: %u)\n", cnf.batch);
+   printf("  -d num,  --drop=num       set packet drop probability in percent (default: %g)\n", MY_PERCT(cnf.drop));
+   printf("  -D usec, --delay=usec     set echo delay range, or mean with jitter, to microseconds (default: %u us)\n", cnf.delay);
+   printf("  -e,      --echoplus       enable echo plus v1 and v2, not RFC compliant%s\n", ((cnf.echoplus)) ? " (default)" : "");
+   printf("  -E name, --engine=name    event engine: poll, epoll, uring (default: %s)\n", engine_names[MY_ENGINE_DEFAULT]);
+   printf("  -f str,  --facility=str   set syslog facility (default: daemon)\n");
+   printf("  -g gid,  --group=gid      setgid to gid (default: none)\n");
+   printf("  -h,      --help           print this help and exit\n");
+   printf("  -j usec, --jitter=usec    set echo delay jitter to microseconds (default: %u us)\n", cnf.jitter);
+   printf("  -l addr, --listen=addr    bind to IP address, may be repeated (default: all)\n");
+   printf("  -L file, --logfile=file   write connection log to file (default: syslog)\n");
+   printf("  -n,      --foreground     do not fork\n");
+   printf("  -p port, --port=port      listen on port number, may be repeated (default: %u)\n", cnf.port);
+   printf("  -P file, --pidfile=file   PID file (default: %s)\n", cnf.pidfile);
+   printf("  -q num,  --delay-pool=num delayed replies queued per worker (default: %u)\n", cnf.delay_pool);
+   printf("  -r,      --rfc            RFC compliant echo protocol%s\n", (!(cnf.echoplus)) ? " (default)" : "");
+   printf("  -R file, --rules=file     per prefix policy rules, reloaded on SIGHUP (default: none)\n");
+   printf("  -t mode, --timestamp=mode kernel timestamps: none, software, hardware (default: %s)\n", ts_names[cnf.timestamp]);
+   printf("  -u uid,  --user=uid       setuid to uid (default: none)\n");
+   printf("  -v,      --verbose        enable verbose output\n");
+   printf("  -V,      --version        print version number and exit\n");
+   printf("  -w num,  --workers=num    number of worker threads and sockets (default: %u)\n", cnf.workers);
+   printf("           --delay-dist=name delay distribution: uniform, normal, pareto (default: %s)\n", dist_names[cnf.delay_dist]);
+   printf("           --loss-ge=p,r[,1-h[,1-k]]\n");
+   printf("                            Gilbert-Elliott burst loss, probabilities in percent\n");
+   printf("           --reorder=num[,usec]\n");
+   printf("                            reorder probability in percent and hold back (default: %u us)\n", cnf.reorder_gap);
+   printf("           --duplicate=num  duplicate probability in percent\n");
+   printf("           --corrupt=num    single bit corruption probability in percent\n");
+   printf("           --flows=num      flow table slots per worker, 0 disables (default: %u)\n", cnf.flows);
+   printf("           --metrics=addr:port|path\n");
+   printf("                            serve Prometheus metrics over TCP or UNIX socket\n");
+   printf("           --server-id=num  server identifier in echo plus v2 replies (default: %hu)\n", cnf.server_id);
+   printf("           --mode=name      reflector protocol: echo, stamp (default: %s)\n", mode_names[cnf.mode]);
+   printf("                            stamp reflects STAMP and TWAMP-Light on port %u unless -p is given\n", STAMP_PORT);
+   printf("           --gro            receive coalesced datagram trains and send replies with GSO\n");
+   printf("           --zerocopy=bytes send replies of at least bytes with MSG_ZEROCOPY\n");
+   printf("           --rate=bps       size socket buffers for rate in bits per second, k/M/G suffixes allowed\n");
+   printf("           --burst=usec     time at --rate socket buffers absorb (default: %u us)\n", cnf.burst);
+   printf("           --busy-poll=usec spin on sockets with SO_BUSY_POLL instead of sleeping\n");
+   printf("           --cpus=list      pin workers to CPUs, for example 2,4-7\n");
+   printf("           --fifo=prio      run workers with SCHED_FIFO priority\n");
+   printf("           --control=path   UNIX control socket for runtime settings, statistics and --takeover\n");
+   printf("           --takeover       take sockets over from the instance on --control, which then exits\n");
+   printf("           --shm=path       publish statistics in shared memory file, read by akcom-udpechostat\n");
+   printf("           --journal=path[,MB]\n");
+   printf("                            record packets in binary ring file instead of text log (default: %u MB)\n", cnf.journal_mb);
+   printf("           --capture=file   write sampled requests and replies with payloads to pcap file\n");
+   printf("           --capture-sample=1/N\n");
+   printf("                            capture one of every N requests and its replies (default: 1/%u)\n", cnf.capture_sample);
+   printf("\n");
    return;
 }
 
 
-// display error message
-void my_error(const char * fmt, ...)
+// display program usage error
+void my_usage_error(const char * fmt, ...)
 {
    va_list args;
 
-   fprintf(stderr, "%s: error: ", cnf.prog_name);
+   fprintf(stderr, "%s: ", cnf.prog_name);
 
    va_start(args, fmt);
    vfprintf(stderr, fmt, args);
    va_end(args);
 
-   fprintf(stderr, "\n");
+   fprintf(stderr, "\nTry `%s --help' for more information.\n", cnf.prog_name);
 
    return;
 }
 
 
-// log connection
-int my_log_conn(int mode, size_t * connp, union my_sa * sap,
-   struct udp_echo_plus * msgp, ssize_t ssize, struct timespec * tsp,
-   useconds_t delay)
+// mark worker idle while blocked waiting for events
+void my_worker_idle(struct my_worker * wp)
 {
-   const char               * mode_name;
-   char                       addr_str[INET6_ADDRSTRLEN];
-   unsigned short             port;
+   my_shm_publish(wp, 0);
+   atomic_store(&wp->qgen, UINT64_MAX);
+   return;
+}
 
-   // determine log entry type
-   switch(mode)
+
+// mark worker quiescent, no rules pointer is held across this call, and
+// service requests from the main thread
+void my_worker_quiesce(struct my_worker * wp)
+{
+   unsigned                  dump;
+
+   atomic_store(&wp->qgen, atomic_load(&rules_gen));
+   my_shm_publish(wp, 0);
+
+   if ((dump = atomic_load_explicit(&flows_dump, memory_order_relaxed)) != wp->dump_seen)
    {
-      case MY_SENT: mode_name = "sent"; break;
-      case MY_RECV: mode_name = "recv"; break;
-      case MY_DROP: mode_name = "drop"; break;
-      default: return(-1);
+      wp->dump_seen = dump;
+      my_flow_dump(wp);
    };
 
-   // convert address to presentation format
-   switch(sap->ss.ss_family)
-   {
-      case AF_INET:
-      inet_ntop(AF_INET, &sap->sin.sin_addr, addr_str, sizeof(addr_str));
-      port =        ntohs(sap->sin.sin_port);
-      break;
+   return;
+}
 
-      case AF_INET6:
-      inet_ntop(AF_INET6, &sap->sin6.sin6_addr, addr_str, sizeof(addr_str));
-      port =         ntohs(sap->sin6.sin6_port);
-      break;
 
-      default:
-      syslog(LOG_DEBUG, "conn %zu: ignoring request from unknown address family: %i", *connp, sap->ss.ss_family);
-      return(-1);
-   };
+// pin worker to its CPU and apply real time scheduling
+int my_worker_sched(struct my_worker * wp)
+{
+   cpu_set_t                 set;
+   struct sched_param        param;
 
-   // log connection
-   if ((cnf.echoplus))
-   {
-      syslog(LOG_INFO,
-         "conn %zu: client: [%s]:%hu; %s bytes: %zi; timestamp: %lu.%09lu; seq: %u; delta: %u us; delay: %u us;",
-         *connp,
-         addr_str,
-         port,
-         mode_name,
-         ssize,
-         tsp->tv_sec,
-         tsp->tv_nsec,
-         ntohl(msgp->req_sn),
-         ntohl(msgp->reply_time) - ntohl(msgp->recv_time),
-         delay
-      );
-   } else
+   if ((cnf.cpus_len))
    {
-      syslog(LOG_INFO,
-         "conn %zu: client: [%s]:%hu; %s bytes: %zi; timestamp: %lu.%09lu;",
-         *connp,
-         addr_str,
-         port,
-         mode_name,
-         ssize,
-         tsp->tv_sec,
-         tsp->tv_nsec
-      );
+      CPU_ZERO(&set);
+      CPU_SET(cnf.cpus[wp->id % cnf.cpus_len], &set);
+      if (sched_setaffinity(0, sizeof(set), &set) == -1)
+      {
+         syslog(LOG_ERR, "worker %u: sched_setaffinity(%u): %s", wp->id, cnf.cpus[wp->id % cnf.cpus_len], strerror(errno));
+         return(-1);
+      };
    };
 
-   // log if IPv4 address mapped to IPv6
-   if (sap->ss.ss_family == AF_INET6)
-      if (mode == MY_RECV)
-         if (IN6_IS_ADDR_V4MAPPED(&sap->sin6.sin6_addr) != 0)
-            syslog(LOG_INFO, "conn %zu: client: [%s]:%hu; IPv4 mapped address", *connp, addr_str, port);
+   // a spinning FIFO worker starves anything else on its CPU, including
+   // kernel threads, so it belongs on an isolated CPU
+   if ((cnf.fifo))
+   {
+      memset(&param, 0, sizeof(param));
+      param.sched_priority = cnf.fifo;
+      if ((errno = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0)
+      {
+         syslog(LOG_ERR, "worker %u: pthread_setschedparam(SCHED_FIFO): %s", wp->id, strerror(errno));
+         return(-1);
+      };
+   };
 
    return(0);
 }
 
 
-// main loop
-int my_loop(int s, size_t * connp)
+// worker thread
+void * my_worker_main(void * arg)
 {
-   socklen_t                  sinlen;
-   ssize_t                    ssize;
-   useconds_t                 delay;
-   struct timespec            ts;
-   uint64_t                   us;
-   struct pollfd              fds[2];
-   union my_sa                sa;
-   union
-   {
-      char                    bytes[MY_BUFF_SIZE];
-      struct udp_echo_plus    msg;
-   } udpbuff;
+   int                       done;
+   unsigned                  idx;
+   unsigned                  pos;
+   struct my_sock          * sp;
+   struct my_worker        * wp;
 
-   // setup poller
-   fds[0].fd      = s;
-   fds[0].events  = POLLIN;
-   fds[0].revents = 0;
-   if (cnf.verbose > 1)
-      syslog(LOG_DEBUG, "waiting for echo request");
-   if ((poll(fds, 1, 5000)) < 1)
-      return(0);
+   wp   = arg;
+   done = 0;
 
-   // increment connection counter
-   (*connp)++;
+   // delayed replies are held in a preallocated packet pool
+   if ( (my_delay_enabled()) && ((wp->delayq = my_delay_alloc(cnf.delay_pool)) == NULL) )
+      done = -1;
 
-   // read data
-   syslog(LOG_DEBUG, "conn %zu: reading data", *connp);
-   sinlen = sizeof(struct sockaddr_storage);
-   if ((ssize = recvfrom(s, udpbuff.bytes, sizeof(udpbuff), 0, &sa.sa, &sinlen)) == -1)
-      return(-1);
+   // per client statistics
+   if ( (!(done)) && (cnf.flows > 0) && ((wp->flows = my_flow_alloc(cnf.flows)) == NULL) )
+      done = -1;
 
-   // grab timestamp
-   syslog(LOG_DEBUG, "conn %zu: calculating recv timestamp", *connp);
-   clock_gettime(CLOCK_REALTIME, &ts);
-   us  = (uint64_t)(ts.tv_sec * 1000000);
-   us += (uint64_t)ts.tv_nsec / 1000;
+#ifdef MSG_WAITFORONE
+   // zero copy transmit needs the pooled buffers of the batched path
+   if ( (!(done)) && ( (cnf.batch > 1) || ((cnf.zerocopy)) ) && ((wp->batch = my_batch_alloc(cnf.batch)) == NULL) )
+      done = -1;
+#endif
 
-   // log connection
-   my_log_conn(MY_RECV, connp, &sa, &udpbuff.msg, ssize, &ts, 0);
+   // kernel numbers transmit timestamps and zero copy completions per socket
+   for(idx = 0; ( (!(done)) && (idx < listeners_len) ); idx++)
+   {
+      sp = &wp->socks[idx];
+#ifdef SO_TIMESTAMPING
+      if ( (cnf.timestamp != MY_TS_NONE) && ((sp->tsq = calloc(1, sizeof(struct my_tsq))) == NULL) )
+         done = -1;
+#endif
+#ifdef MSG_WAITFORONE
+      if ( (!(done)) && ((wp->batch)) && ((wp->batch->zc)) )
+      {
+         if ((sp->zcq = calloc(1, sizeof(struct my_zcq))) == NULL)
+            done = -1;
+         for(pos = 0; ( ((sp->zcq)) && (pos < MY_ZC_POOL) ); pos++)
+            sp->zcq->pending[pos] = MY_ZC_NONE;
+      };
+#endif
+   };
 
-   // process echo+ packet
-   if ((cnf.echoplus))
+   if (done == -1)
    {
-      syslog(LOG_DEBUG, "conn %zu: intializing echo plus header", *connp);
-      udpbuff.msg.res_sn    = udpbuff.msg.req_sn;
-      udpbuff.msg.recv_time = htonl(us & 0xFFFFFFFFLL);
-      udpbuff.msg.failures  = 0;
+      syslog(LOG_ERR, "worker %u: out of virtual memory", wp->id);
+      should_stop = 1;
    };
 
-   // randomly drop packets
-   if (cnf.drop_perct > 0)
+   if ( (!(done)) && (my_worker_sched(wp) == -1) )
+   {
+      should_stop = 1;
+      done        = -1;
+   };
+
+   // busy polling spins on the socket regardless of the configured engine
+   if ( (!(done)) && ((cnf.busy_poll)) )
+   {
+      my_loop_busy(wp);
+      done = 1;
+   };
+
+#ifdef IORING_RECV_MULTISHOT
+   // io_uring engine falls back to poll engine when kernel lacks support
+   if ( (!(done)) && (cnf.engine == MY_ENGINE_URING) )
    {
-      if ( (rand() % 100) < cnf.drop_perct)
+      if (my_uring_init(wp) == 0)
       {
-         my_log_conn(MY_DROP, connp, &sa, &udpbuff.msg, ssize, &ts, 0);
-         return(0);
+         while( (!(should_stop)) && (!(wp->uring->unsupported)) )
+            my_loop_uring(wp);
+         // queued replies are submitted while the receives are cancelled
+         for(idx = 0; ( ((handed_over)) && (idx < listeners_len) ); idx++)
+            while( ((wp->socks[idx].armed)) && (my_loop_uring(wp) == 0) );
+         done = !(wp->uring->unsupported);
+         my_uring_free(wp);
       };
+      if (!(done))
+         syslog(LOG_NOTICE, "worker %u: io_uring unavailable, using poll engine", wp->id);
    };
+#else
+   if (cnf.engine == MY_ENGINE_URING)
+      syslog(LOG_NOTICE, "worker %u: io_uring unavailable, using poll engine", wp->id);
+#endif
 
-   // insert random delay
-   delay = 0;
-   if (cnf.delay > 0)
+#ifdef EPOLLET
+   if ( (!(done)) && (cnf.engine == MY_ENGINE_EPOLL) && (my_epoll_init(wp) == 0) )
    {
-      delay = (useconds_t)rand() % cnf.delay;
-      syslog(LOG_DEBUG, "conn %zu: delaying response for %i us", *connp, delay);
-      usleep(delay);
+      while(!(should_stop))
+         my_loop_epoll(wp);
+      close(wp->epfd);
+      wp->epfd = -1;
    };
+#endif
 
-   // grab timestamp
-   syslog(LOG_DEBUG, "conn %zu: calculating sent timestamp", *connp);
-   clock_gettime(CLOCK_REALTIME, &ts);
-   ts.tv_nsec++;
-   us  = (uint64_t)(ts.tv_sec * 1000000);
-   us += (uint64_t)ts.tv_nsec / 1000;
+   while( (!(done)) && (!(should_stop)) )
+      my_loop(wp);
 
-   // send response
-   if ((cnf.echoplus))
+   // replies held for delay are sent before the sockets are left to the
+   // instance which took them over
+   while( ((handed_over)) && ((wp->delayq)) && ((wp->delayq->count)) )
+      poll(NULL, 0, my_delay_run(wp, 1000));
+
+#ifdef MSG_WAITFORONE
+   my_batch_free(wp->batch);
+   wp->batch = NULL;
+#endif
+   my_delay_free(wp->delayq);
+   wp->delayq = NULL;
+   my_flow_free(wp->flows);
+   wp->flows = NULL;
+   for(idx = 0; (idx < listeners_len); idx++)
    {
-      syslog(LOG_DEBUG, "conn %zu: updating echo plus header", *connp);
-      udpbuff.msg.reply_time = htonl(us & 0xFFFFFFFFLL);
+      free(wp->socks[idx].tsq);
+      free(wp->socks[idx].zcq);
+      wp->socks[idx].tsq = NULL;
+      wp->socks[idx].zcq = NULL;
    };
-   sendto(s, udpbuff.bytes, (size_t)ssize, 0, &sa.sa, sinlen);
-
-   // log response
-   my_log_conn(MY_SENT, connp, &sa, &udpbuff.msg, ssize, &ts, delay);
 
-   return(0);
+   return(NULL);
 }
 
 
-// signal handler
-void my_sighandler(int signum)
+#ifdef MSG_WAITFORONE
+// release buffer slots of completed zero copy transmits
+void my_zc_complete(struct my_worker * wp, struct my_sock * sp, uint32_t lo, uint32_t hi, int copied)
 {
-   signal(signum, my_sighandler);
-   should_stop = 1;
-   return;
-}
+   uint32_t                  id;
+   unsigned                * slotp;
+   struct my_zcpool        * zc;
+
+   zc = wp->batch->zc;
+   for(id = lo; ( (id - lo) <= (hi - lo) ); id++)
+   {
+      slotp = &sp->zcq->pending[id & (MY_ZC_POOL - 1)];
+      if (*slotp == MY_ZC_NONE)
+         continue;
+      zc->free[zc->nfree++] = *slotp;
+      *slotp                = MY_ZC_NONE;
+      if (id == hi)
+         break;
+   };
 
+   // loopback and devices without scatter gather copy the payload anyway
+   if ((copied))
+      MY_STAT_INC(wp, MY_STAT_ZC_COPIED, (hi - lo) + 1);
 
-// display program usage
-void my_usage(void)
-{
-   printf("Usage: %s [options]\n", cnf.prog_name);
-   printf("OPTIONS:\n");
-   printf("  -d num,  --drop=num       set packet drop probability [0-99] (default: %u)\n", cnf.drop_perct);
-   printf("  -D usec, --delay=usec     set echo delay range to microseconds (default: %u us)\n", cnf.delay);
-   printf("  -e,      --echoplus       enable echo plus, not RFC compliant%s\n", ((cnf.echoplus)) ? " (default)" : "");
-   printf("  -f str,  --facility=str   set syslog facility (default: daemon)\n");
-   printf("  -g gid,  --group=gid      setgid to gid (default: none)\n");
-   printf("  -h,      --help           print this help and exit\n");
-   printf("  -l addr, --listen=addr    bind to IP address (default: all)\n");
-   printf("  -n,      --foreground     do not fork\n");
-   printf("  -p port, --port=port      list on port number (default: %u)\n", cnf.port);
-   printf("  -P file, --pidfile=file   PID file (default: %s)\n", cnf.pidfile);
-   printf("  -r,      --rfc            RFC compliant echo protocol%s\n", (!(cnf.echoplus)) ? " (default)" : "");
-   printf("  -u uid,  --user=uid       setuid to uid (default: none)\n");
-   printf("  -v,      --verbose        enable verbose output\n");
-   printf("  -V,      --version        print version number and exit\n");
-   printf("\n");
    return;
 }
 
 
-// display program usage error
-void my_usage_error(const char * fmt, ...)
+// reserve slot replacing the buffer of a zero copy reply, returns MY_ZC_NONE if unavailable
+unsigned my_zc_reserve(struct my_zcpool * zc, struct my_zcq * zq, unsigned ahead)
 {
-   va_list args;
-
-   fprintf(stderr, "%s: ", cnf.prog_name);
-
-   va_start(args, fmt);
-   vfprintf(stderr, fmt, args);
-   va_end(args);
-
-   fprintf(stderr, "\nTry `%s --help' for more information.\n", cnf.prog_name);
-
-   return;
+   // identifier of this reply must not collide with a transmit still in flight
+   if ( (!(zc->nfree)) || (zq->pending[(zq->next + ahead) & (MY_ZC_POOL - 1)] != MY_ZC_NONE) )
+      return(MY_ZC_NONE);
+   return(zc->free[--zc->nfree]);
 }
+#endif
 
 
 /* end of source file */
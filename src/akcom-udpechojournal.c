@@ -0,0 +1,534 @@
+/*
+ *  Alaska Communications UDP Echo Tools
+ *  Copyright (C) 2020 Alaska Communications
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ *  @file akcom-udpechojournal.c UDP echo daemon packet journal decoder
+ */
+/*
+ *  Simple Build:
+ *     export CFLAGS='-Wall -Wno-unknown-pragmas'
+ *     gcc ${CFLAGS} -c akcom-udpechojournal.c
+ *     gcc ${CFLAGS} -o akcom-udpechojournal akcom-udpechojournal.o
+ *
+ *  Libtool Build:
+ *     export CFLAGS='-Wall -Wno-unknown-pragmas'
+ *     libtool --mode=compile --tag=CC gcc ${CFLAGS} -c akcom-udpechojournal.c
+ *     libtool --mode=link    --tag=CC gcc ${CFLAGS} -o akcom-udpechojournal \
+ *             akcom-udpechojournal.lo
+ *
+ *  Libtool Clean:
+ *     libtool --mode=clean rm -f akcom-udpechojournal.lo akcom-udpechojournal
+ */
+#define _AKCOM_UDP_ECHO_JOURNAL_C 1
+
+///////////////
+//           //
+//  Headers  //
+//           //
+///////////////
+#pragma mark - Headers
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <getopt.h>
+
+#include "akcom-udpecho.h"
+
+
+///////////////////
+//               //
+//  Definitions  //
+//               //
+///////////////////
+#pragma mark - Definitions
+
+#ifndef PROGRAM_NAME
+#define PROGRAM_NAME "akcom-udpechojournal"
+#endif
+#ifndef PACKAGE_NAME
+#define PACKAGE_NAME "akcom-udpecho"
+#endif
+#ifndef PACKAGE_VERSION
+#define PACKAGE_VERSION "0.0"
+#endif
+
+#define MY_CSV                   0
+#define MY_PCAP                  1
+
+
+/////////////////
+//             //
+//  Variables  //
+//             //
+/////////////////
+#pragma mark - Variables
+
+static const char        * prog_name        = PROGRAM_NAME;
+static int                 cnf_format       = MY_CSV;
+static const char        * cnf_output       = NULL;
+static const char        * action_names[]   = { "sent", "recv", "drop", "unknown", "deny" };
+static const char        * format_names[]   = { "none", "v1", "v2", "stamp" };
+
+
+//////////////////
+//              //
+//  Prototypes  //
+//              //
+//////////////////
+#pragma mark - Prototypes
+
+// main statement
+int main(int argc, char * argv[]);
+
+// order records by time, then by connection number
+int my_compare(const void * a, const void * b);
+
+// write record as CSV line
+void my_csv(FILE * fs, const struct udp_echo_journal * jp, const struct udp_echo_journal_rec * rec);
+
+// write record as pcap packet with synthesized IP and UDP headers
+void my_pcap(FILE * fs, const struct udp_echo_journal * jp, const struct udp_echo_journal_rec * rec);
+
+// one's complement checksum of IPv4 header
+uint16_t my_ip_sum(const uint8_t * hdr, size_t len);
+
+// display program usage
+void my_usage(void);
+
+// display program usage error
+void my_usage_error(const char * fmt, ...);
+
+
+/////////////////
+//             //
+//  Functions  //
+//             //
+/////////////////
+#pragma mark - Functions
+
+// main statement
+int main(int argc, char * argv[])
+{
+   int                           c;
+   int                           fd;
+   int                           opt_index;
+   uint64_t                      head;
+   uint64_t                      first;
+   uint64_t                      records;
+   uint64_t                      seq;
+   size_t                        count;
+   size_t                        lost;
+   size_t                        pos;
+   char                        * ptr;
+   FILE                        * fs;
+   struct stat                   sb;
+   struct udp_echo_journal     * jp;
+   struct udp_echo_journal_rec * recs;
+   struct pcap_file_hdr          fhdr;
+
+   // getopt options
+   static char   short_opt[] = "ho:pV";
+   static struct option long_opt[] =
+   {
+      {"help",          no_argument,       0, 'h'},
+      {"output",        required_argument, 0, 'o'},
+      {"pcap",          no_argument,       0, 'p'},
+      {"version",       no_argument,       0, 'V'},
+      {NULL,            0,                 0, 0  }
+   };
+
+   // determines program name
+   prog_name = argv[0];
+   if ((ptr = rindex(argv[0], '/')) != NULL)
+      prog_name = &ptr[1];
+
+   // process arguments
+   while((c = getopt_long(argc, argv, short_opt, long_opt, &opt_index)) != -1)
+   {
+      switch(c)
+      {
+         case -1:       // no more arguments
+         case 0:        // long options toggles
+         break;
+
+         case 'h':
+         my_usage();
+         return(0);
+
+         case 'o':
+         cnf_output = optarg;
+         break;
+
+         case 'p':
+         cnf_format = MY_PCAP;
+         break;
+
+         case 'V':
+         printf("%s (%s) %s\n", prog_name, PACKAGE_NAME, PACKAGE_VERSION);
+         return(0);
+
+         case '?':
+         fprintf(stderr, "Try `%s --help' for more information.\n", prog_name);
+         return(1);
+
+         default:
+         my_usage_error("unrecognized option `--%c'", c);
+         return(1);
+      };
+   };
+   if (optind >= argc)
+   {
+      my_usage_error("missing journal file");
+      return(1);
+   };
+   if ((optind + 1) < argc)
+   {
+      my_usage_error("unknown argument `%s'", argv[optind + 1]);
+      return(1);
+   };
+
+   // map journal, the daemon may still be appending to it
+   if ((fd = open(argv[optind], O_RDONLY)) == -1)
+   {
+      fprintf(stderr, "%s: open(%s): %s\n", prog_name, argv[optind], strerror(errno));
+      return(1);
+   };
+   if ( (fstat(fd, &sb) == -1) || ((size_t)sb.st_size < sizeof(struct udp_echo_journal)) )
+   {
+      fprintf(stderr, "%s: %s: not a packet journal\n", prog_name, argv[optind]);
+      close(fd);
+      return(1);
+   };
+   if ((jp = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+   {
+      fprintf(stderr, "%s: mmap(): %s\n", prog_name, strerror(errno));
+      close(fd);
+      return(1);
+   };
+   close(fd);
+   // ring size is taken once and bounded by the mapping, so neither a
+   // corrupt header nor a daemon reinitializing the file can index past it
+   records = jp->records;
+   if ( (jp->magic != UDP_ECHO_JOURNAL_MAGIC) ||
+        (jp->version != UDP_ECHO_JOURNAL_VERSION) ||
+        (jp->rec_size != sizeof(struct udp_echo_journal_rec)) ||
+        (jp->listeners > UDP_ECHO_JOURNAL_LISTENERS) ||
+        (records < 1) ||
+        (records > (((size_t)sb.st_size - sizeof(struct udp_echo_journal)) / sizeof(struct udp_echo_journal_rec))) )
+   {
+      fprintf(stderr, "%s: %s: not a packet journal or unsupported version\n", prog_name, argv[optind]);
+      munmap(jp, (size_t)sb.st_size);
+      return(1);
+   };
+
+   // copy ring, the writer fills slot head % records before advancing
+   // head, so the slot it fills next is skipped and records it lapped
+   // during the copy are discarded
+   head  = __atomic_load_n(&jp->head, __ATOMIC_ACQUIRE);
+   first = (head >= records) ? (head - records + 1) : 0;
+   if ((recs = calloc((size_t)(head - first) + 1, sizeof(struct udp_echo_journal_rec))) == NULL)
+   {
+      fprintf(stderr, "%s: out of virtual memory\n", prog_name);
+      munmap(jp, (size_t)sb.st_size);
+      return(1);
+   };
+   for(seq = first, count = 0; (seq < head); seq++)
+      recs[count++] = jp->rec[seq % records];
+   __atomic_thread_fence(__ATOMIC_ACQUIRE);
+   lost = 0;
+   seq  = __atomic_load_n(&jp->head, __ATOMIC_RELAXED);
+   if ((seq + 1) > (first + records))
+   {
+      lost = (size_t)((seq + 1) - (first + records));
+      lost = (lost < count) ? lost : count;
+      memmove(recs, &recs[lost], (count - lost) * sizeof(struct udp_echo_journal_rec));
+      count -= lost;
+   };
+
+   // workers are drained in turn, so records are only ordered per worker
+   qsort(recs, count, sizeof(struct udp_echo_journal_rec), my_compare);
+
+   fs = stdout;
+   if ( (cnf_output) && ((fs = fopen(cnf_output, "w")) == NULL) )
+   {
+      fprintf(stderr, "%s: fopen(%s): %s\n", prog_name, cnf_output, strerror(errno));
+      free(recs);
+      munmap(jp, (size_t)sb.st_size);
+      return(1);
+   };
+
+   if (cnf_format == MY_PCAP)
+   {
+      memset(&fhdr, 0, sizeof(fhdr));
+      fhdr.magic         = PCAP_MAGIC_NSEC;
+      fhdr.version_major = 2;
+      fhdr.version_minor = 4;
+      fhdr.snaplen       = 65535;
+      fhdr.linktype      = PCAP_LINKTYPE_RAW;
+      fwrite(&fhdr, sizeof(fhdr), 1, fs);
+      for(pos = 0; (pos < count); pos++)
+         my_pcap(fs, jp, &recs[pos]);
+   } else
+   {
+      fprintf(fs, "time,worker,conn,action,client,client_port,server,server_port,format,bytes,seq,delta_us,delay_us\n");
+      for(pos = 0; (pos < count); pos++)
+         my_csv(fs, jp, &recs[pos]);
+   };
+
+   fprintf(stderr, "%s: %zu records", prog_name, count);
+   if ((jp->dropped))
+      fprintf(stderr, "; %" PRIu64 " dropped by daemon", jp->dropped);
+   if ((lost))
+      fprintf(stderr, "; %zu overwritten while reading", lost);
+   fprintf(stderr, "\n");
+
+   if (fs != stdout)
+      fclose(fs);
+   free(recs);
+   munmap(jp, (size_t)sb.st_size);
+
+   return(0);
+}
+
+
+// order records by time, then by connection number
+int my_compare(const void * a, const void * b)
+{
+   const struct udp_echo_journal_rec * ra = a;
+   const struct udp_echo_journal_rec * rb = b;
+
+   if (ra->time != rb->time)
+      return((ra->time < rb->time) ? -1 : 1);
+   if (ra->conn != rb->conn)
+      return((ra->conn < rb->conn) ? -1 : 1);
+   return((int)ra->action - (int)rb->action);
+}
+
+
+// write record as CSV line
+void my_csv(FILE * fs, const struct udp_echo_journal * jp, const struct udp_echo_journal_rec * rec)
+{
+   char                      client[INET6_ADDRSTRLEN];
+   char                      server[INET6_ADDRSTRLEN];
+   const struct udp_echo_journal_listener * lp;
+
+   inet_ntop((rec->family == 4) ? AF_INET : AF_INET6, rec->addr, client, sizeof(client));
+   server[0] = '\0';
+   lp        = NULL;
+   if (rec->listener < jp->listeners)
+   {
+      lp = &jp->listener[rec->listener];
+      inet_ntop((lp->family == 4) ? AF_INET : AF_INET6, lp->addr, server, sizeof(server));
+   };
+
+   fprintf(fs, "%" PRIu64 ".%09" PRIu64 ",%u,%" PRIu64 ",%s,%s,%u,%s,%u,%s,%u,%u,%u,%u\n",
+      rec->time / 1000000000,
+      rec->time % 1000000000,
+      rec->worker,
+      rec->conn,
+      (rec->action < 5) ? action_names[rec->action] : "unknown",
+      client,
+      rec->port,
+      server,
+      ((lp)) ? lp->port : 0,
+      (rec->format < 4) ? format_names[rec->format] : "unknown",
+      rec->size,
+      rec->seq,
+      rec->delta,
+      rec->delay);
+
+   return;
+}
+
+
+// one's complement checksum of IPv4 header
+uint16_t my_ip_sum(const uint8_t * hdr, size_t len)
+{
+   size_t                    pos;
+   uint32_t                  sum;
+
+   for(pos = 0, sum = 0; ((pos + 1) < len); pos += 2)
+      sum += ((uint32_t)hdr[pos] << 8) | hdr[pos + 1];
+   while((sum >> 16))
+      sum = (sum & 0xffff) + (sum >> 16);
+
+   return((uint16_t)~sum);
+}
+
+
+// write record as pcap packet with synthesized IP and UDP headers, only
+// headers are captured since the journal does not keep payloads
+void my_pcap(FILE * fs, const struct udp_echo_journal * jp, const struct udp_echo_journal_rec * rec)
+{
+   int                       v4;
+   size_t                    len;
+   uint16_t                  u16;
+   uint16_t                  client_port;
+   uint16_t                  server_port;
+   uint8_t                   client[16];
+   uint8_t                   server[16];
+   uint8_t                   pkt[48];
+   const uint8_t           * src;
+   const uint8_t           * dst;
+   struct pcap_rec_hdr       rhdr;
+   const struct udp_echo_journal_listener * lp;
+
+   static const uint8_t      mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+   // only requests and replies were on the wire
+   if ( (rec->action != UDP_ECHO_JOURNAL_RECV) && (rec->action != UDP_ECHO_JOURNAL_SENT) )
+      return;
+
+   memset(client, 0, sizeof(client));
+   memset(server, 0, sizeof(server));
+   lp          = (rec->listener < jp->listeners) ? &jp->listener[rec->listener] : NULL;
+   server_port = ((lp)) ? lp->port : 0;
+   client_port = rec->port;
+
+   // dual stack sockets see IPv4 clients as mapped IPv6 addresses
+   v4 = (rec->family == 4);
+   if ( (!(v4)) && (!(memcmp(rec->addr, mapped, 12))) )
+   {
+      v4 = 1;
+      memcpy(client, &rec->addr[12], 4);
+      if ( ((lp)) && (lp->family == 6) && (!(memcmp(lp->addr, mapped, 12))) )
+         memcpy(server, &lp->addr[12], 4);
+   } else
+   {
+      memcpy(client, rec->addr, 16);
+      if ( ((lp)) && (lp->family == rec->family) )
+         memcpy(server, lp->addr, 16);
+   };
+   if ( (v4) && ((lp)) && (lp->family == 4) )
+      memcpy(server, lp->addr, 4);
+
+   src = (rec->action == UDP_ECHO_JOURNAL_RECV) ? client : server;
+   dst = (rec->action == UDP_ECHO_JOURNAL_RECV) ? server : client;
+   memset(pkt, 0, sizeof(pkt));
+   if ((v4))
+   {
+      len    = 20;
+      pkt[0] = 0x45;
+      u16    = htons((uint16_t)(((rec->size + 28) > 0xffff) ? 0xffff : (rec->size + 28)));
+      memcpy(&pkt[2], &u16, 2);
+      u16    = htons((uint16_t)rec->conn);
+      memcpy(&pkt[4], &u16, 2);
+      pkt[6] = 0x40;       // don't fragment
+      pkt[8] = 64;
+      pkt[9] = IPPROTO_UDP;
+      memcpy(&pkt[12], src, 4);
+      memcpy(&pkt[16], dst, 4);
+      u16    = htons(my_ip_sum(pkt, 20));
+      memcpy(&pkt[10], &u16, 2);
+   } else
+   {
+      len    = 40;
+      pkt[0] = 0x60;
+      u16    = htons((uint16_t)(((rec->size + 8) > 0xffff) ? 0xffff : (rec->size + 8)));
+      memcpy(&pkt[4], &u16, 2);
+      pkt[6] = IPPROTO_UDP;
+      pkt[7] = 64;
+      memcpy(&pkt[8],  src, 16);
+      memcpy(&pkt[24], dst, 16);
+   };
+
+   // UDP header, checksum is left zero since the payload is not captured
+   u16 = htons((rec->action == UDP_ECHO_JOURNAL_RECV) ? client_port : server_port);
+   memcpy(&pkt[len], &u16, 2);
+   u16 = htons((rec->action == UDP_ECHO_JOURNAL_RECV) ? server_port : client_port);
+   memcpy(&pkt[len + 2], &u16, 2);
+   u16 = htons((uint16_t)(((rec->size + 8) > 0xffff) ? 0xffff : (rec->size + 8)));
+   memcpy(&pkt[len + 4], &u16, 2);
+   len += 8;
+
+   rhdr.ts_sec   = (uint32_t)(rec->time / 1000000000);
+   rhdr.ts_nsec  = (uint32_t)(rec->time % 1000000000);
+   rhdr.incl_len = (uint32_t)len;
+   rhdr.orig_len = (uint32_t)len + rec->size;
+   fwrite(&rhdr, sizeof(rhdr), 1, fs);
+   fwrite(pkt, len, 1, fs);
+
+   return;
+}
+
+
+// display program usage
+void my_usage(void)
+{
+   printf("Usage: %s [options] file\n", prog_name);
+   printf("OPTIONS:\n");
+   printf("  -h, --help                print this help and exit\n");
+   printf("  -o file, --output=file    write to file instead of standard output\n");
+   printf("  -p, --pcap                write pcap with IP and UDP headers of requests and replies instead of CSV\n");
+   printf("  -V, --version             print version number and exit\n");
+   printf("\n");
+   printf("Decodes a packet journal written by akcom-udpechod --journal, oldest record first.\n");
+   printf("\n");
+   return;
+}
+
+
+// display program usage error
+void my_usage_error(const char * fmt, ...)
+{
+   va_list args;
+
+   fprintf(stderr, "%s: ", prog_name);
+
+   va_start(args, fmt);
+   vfprintf(stderr, fmt, args);
+   va_end(args);
+
+   fprintf(stderr, "\nTry `%s --help' for more information.\n", prog_name);
+
+   return;
+}
+
+
+/* end of source file */
@@ -0,0 +1,633 @@
+/*
+ *  Alaska Communications UDP Echo Tools
+ *  Copyright (C) 2020 Alaska Communications
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *     1. Redistributions of source code must retain the above copyright
+ *        notice, this list of conditions and the following disclaimer.
+ *
+ *     2. Redistributions in binary form must reproduce the above copyright
+ *        notice, this list of conditions and the following disclaimer in the
+ *        documentation and/or other materials provided with the distribution.
+ *
+ *     3. Neither the name of the copyright holder nor the names of its
+ *        contributors may be used to endorse or promote products derived from
+ *        this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+ *  IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ *  THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ *  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ *  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ *  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ *  @file akcom-udpechostat.c UDP echo daemon statistics monitor
+ */
+/*
+ *  Simple Build:
+ *     export CFLAGS='-Wall -Wno-unknown-pragmas'
+ *     gcc ${CFLAGS} -c akcom-udpechostat.c
+ *     gcc ${CFLAGS} -o akcom-udpechostat akcom-udpechostat.o
+ *
+ *  Libtool Build:
+ *     export CFLAGS='-Wall -Wno-unknown-pragmas'
+ *     libtool --mode=compile --tag=CC gcc ${CFLAGS} -c akcom-udpechostat.c
+ *     libtool --mode=link    --tag=CC gcc ${CFLAGS} -o akcom-udpechostat \
+ *             akcom-udpechostat.lo
+ *
+ *  Libtool Clean:
+ *     libtool --mode=clean rm -f akcom-udpechostat.lo akcom-udpechostat
+ */
+#define _AKCOM_UDP_ECHO_STAT_C 1
+
+///////////////
+//           //
+//  Headers  //
+//           //
+///////////////
+#pragma mark - Headers
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <getopt.h>
+#include <signal.h>
+#include <poll.h>
+#include <sched.h>
+
+#include "akcom-udpecho.h"
+
+
+///////////////////
+//               //
+//  Definitions  //
+//               //
+///////////////////
+#pragma mark - Definitions
+
+#ifndef PROGRAM_NAME
+#define PROGRAM_NAME "akcom-udpechostat"
+#endif
+#ifndef PACKAGE_NAME
+#define PACKAGE_NAME "akcom-udpecho"
+#endif
+#ifndef PACKAGE_VERSION
+#define PACKAGE_VERSION "0.0"
+#endif
+
+#define MY_SHM_PATH              "/dev/shm/akcom-udpechod"
+#define MY_HEADER_ROWS           20      // samples between repeated column headers
+#define MY_SNAPSHOT_WAIT         5000000 // nanoseconds to wait for a worker to finish an update
+#define MY_NS(ts)                (((uint64_t)(ts).tv_sec * 1000000000) + (uint64_t)(ts).tv_nsec)
+#define MY_US(ns)                ((double)(ns) / 1000.0)
+
+
+/////////////////
+//             //
+//  Datatypes  //
+//             //
+/////////////////
+#pragma mark - Datatypes
+
+// mapped statistics segment of one daemon instance
+struct my_seg
+{
+   struct udp_echo_stats        * stats;
+   size_t                         size;
+   dev_t                          dev;
+   ino_t                          ino;
+   struct udp_echo_stats_worker * cur;     // snapshot per worker
+   struct udp_echo_stats_worker * prev;    // previous snapshot per worker
+};
+
+
+/////////////////
+//             //
+//  Variables  //
+//             //
+/////////////////
+#pragma mark - Variables
+
+static const char        * prog_name        = PROGRAM_NAME;
+static const char        * cnf_path         = MY_SHM_PATH;
+static unsigned long       cnf_interval     = 1;
+static unsigned long       cnf_count        = 0;
+static int                 cnf_workers      = 0;
+static volatile int        should_stop      = 0;
+
+
+//////////////////
+//              //
+//  Prototypes  //
+//              //
+//////////////////
+#pragma mark - Prototypes
+
+// main statement
+int main(int argc, char * argv[]);
+
+// print column headers
+void my_header(void);
+
+// map statistics segment, returns -1 if absent or not ready
+int my_map(const char * path, struct my_seg * segp, int quiet);
+
+// print rates of one sample row
+void my_row(const char * label, const struct udp_echo_stats * sp,
+   const struct udp_echo_stats_worker * cur, const struct udp_echo_stats_worker * prev, double secs);
+
+// service time quantile in nanoseconds from histogram bucket deltas
+uint64_t my_quantile(const struct udp_echo_stats * sp,
+   const struct udp_echo_stats_worker * cur, const struct udp_echo_stats_worker * prev, double q);
+
+// copy consistent snapshot of worker record, returns -1 and leaves dst unchanged if the record is stale
+int my_snapshot(const struct udp_echo_stats_worker * rec, struct udp_echo_stats_worker * dst);
+
+// signal system stop
+void my_stop(int signum);
+
+// add worker record to totals
+void my_sum(struct udp_echo_stats_worker * dst, const struct udp_echo_stats_worker * src);
+
+// release mapped statistics segment
+void my_unmap(struct my_seg * segp);
+
+// display program usage
+void my_usage(void);
+
+// display program usage error
+void my_usage_error(const char * fmt, ...);
+
+
+/////////////////
+//             //
+//  Functions  //
+//             //
+/////////////////
+#pragma mark - Functions
+
+// main statement
+int main(int argc, char * argv[])
+{
+   int                       c;
+   int                       opt_index;
+   unsigned                  pos;
+   unsigned long             samples;
+   unsigned long             rows;
+   double                    secs;
+   char                      label[16];
+   char                    * ptr;
+   struct my_seg             seg;
+   struct my_seg             next;
+   struct udp_echo_stats_worker total;
+   struct udp_echo_stats_worker total_prev;
+   struct timespec           now;
+   struct timespec           last;
+
+   // getopt options
+   static char   short_opt[] = "f:hVw";
+   static struct option long_opt[] =
+   {
+      {"file",          required_argument, 0, 'f'},
+      {"help",          no_argument,       0, 'h'},
+      {"version",       no_argument,       0, 'V'},
+      {"workers",       no_argument,       0, 'w'},
+      {NULL,            0,                 0, 0  }
+   };
+
+   // determines program name
+   prog_name = argv[0];
+   if ((ptr = rindex(argv[0], '/')) != NULL)
+      prog_name = &ptr[1];
+
+   // process arguments
+   while((c = getopt_long(argc, argv, short_opt, long_opt, &opt_index)) != -1)
+   {
+      switch(c)
+      {
+         case -1:       // no more arguments
+         case 0:        // long options toggles
+         break;
+
+         case 'f':
+         cnf_path = optarg;
+         break;
+
+         case 'h':
+         my_usage();
+         return(0);
+
+         case 'V':
+         printf("%s (%s) %s\n", prog_name, PACKAGE_NAME, PACKAGE_VERSION);
+         return(0);
+
+         case 'w':
+         cnf_workers = 1;
+         break;
+
+         case '?':
+         fprintf(stderr, "Try `%s --help' for more information.\n", prog_name);
+         return(1);
+
+         default:
+         my_usage_error("unrecognized option `--%c'", c);
+         return(1);
+      };
+   };
+   if (optind < argc)
+   {
+      cnf_interval = strtoul(argv[optind], &ptr, 10);
+      if ( ((ptr[0])) || (!(cnf_interval)) )
+      {
+         my_usage_error("invalid interval `%s'", argv[optind]);
+         return(1);
+      };
+      optind++;
+   };
+   if (optind < argc)
+   {
+      cnf_count = strtoul(argv[optind], &ptr, 10);
+      if ( ((ptr[0])) || (!(cnf_count)) )
+      {
+         my_usage_error("invalid count `%s'", argv[optind]);
+         return(1);
+      };
+      optind++;
+   };
+   if (optind < argc)
+   {
+      my_usage_error("unknown argument `%s'", argv[optind++]);
+      return(1);
+   };
+
+   signal(SIGINT,  my_stop);
+   signal(SIGTERM, my_stop);
+
+   memset(&seg, 0, sizeof(seg));
+   if (my_map(cnf_path, &seg, 0) == -1)
+      return(1);
+
+   // first sample reports averages since the daemon started, like vmstat
+   clock_gettime(CLOCK_MONOTONIC, &last);
+   secs = difftime(time(NULL), (time_t)seg.stats->started);
+   rows = 0;
+   for(samples = 0; (!(should_stop)); samples++)
+   {
+      if ((rows++ % MY_HEADER_ROWS) == 0)
+         my_header();
+
+      memset(&total,      0, sizeof(total));
+      memset(&total_prev, 0, sizeof(total_prev));
+      for(pos = 0; (pos < seg.stats->workers); pos++)
+      {
+         if (my_snapshot(&seg.stats->worker[pos], &seg.cur[pos]) == -1)
+            fprintf(stderr, "%s: worker %u: statistics record stale, worker stopped during update\n", prog_name, seg.stats->worker[pos].id);
+         my_sum(&total,      &seg.cur[pos]);
+         my_sum(&total_prev, &seg.prev[pos]);
+      };
+      if (secs < 1.0)
+         secs = 1.0;
+      my_row("all", seg.stats, &total, &total_prev, secs);
+      for(pos = 0; ( (cnf_workers) && (pos < seg.stats->workers) ); pos++)
+      {
+         snprintf(label, sizeof(label), "%u", seg.cur[pos].id);
+         my_row(label, seg.stats, &seg.cur[pos], &seg.prev[pos], secs);
+      };
+      fflush(stdout);
+      memcpy(seg.prev, seg.cur, sizeof(struct udp_echo_stats_worker) * seg.stats->workers);
+
+      if ( ((cnf_count)) && ((samples + 1) >= cnf_count) )
+         break;
+      poll(NULL, 0, (int)(cnf_interval * 1000));
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      secs = (double)(MY_NS(now) - MY_NS(last)) / 1e9;
+      last = now;
+
+      // follow a restarted or replacing instance, the previous instance
+      // keeps its unlinked segment while it drains
+      memset(&next, 0, sizeof(next));
+      if (my_map(cnf_path, &next, 1) == 0)
+      {
+         if ( (next.dev == seg.dev) && (next.ino == seg.ino) )
+         {
+            my_unmap(&next);
+         } else
+         {
+            my_unmap(&seg);
+            seg  = next;
+            secs = difftime(time(NULL), (time_t)seg.stats->started);
+            rows = 0;
+            printf("%s: following instance %" PRIu64 "\n", prog_name, seg.stats->pid);
+         };
+      };
+      if ( (kill((pid_t)seg.stats->pid, 0) == -1) && (errno == ESRCH) )
+      {
+         fprintf(stderr, "%s: daemon %" PRIu64 " exited\n", prog_name, seg.stats->pid);
+         my_unmap(&seg);
+         return(1);
+      };
+   };
+
+   my_unmap(&seg);
+
+   return(0);
+}
+
+
+// print column headers
+void my_header(void)
+{
+   printf("%-6s %9s %9s %9s %7s %7s %7s %7s %7s %7s %7s %8s %8s %8s\n",
+      "worker", "rx/s", "tx/s", "rxMbit/s", "drop/s", "deny/s", "trunc/s", "err/s", "rxq/s",
+      "delayed", "flows", "svc_avg", "svc_p50", "svc_p99");
+   return;
+}
+
+
+// map statistics segment, returns -1 if absent or not ready
+int my_map(const char * path, struct my_seg * segp, int quiet)
+{
+   int                       fd;
+   size_t                    size;
+   struct stat               sb;
+   struct udp_echo_stats   * sp;
+
+   if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+   {
+      if (!(quiet))
+         fprintf(stderr, "%s: open(%s): %s\n", prog_name, path, strerror(errno));
+      return(-1);
+   };
+   if ( (fstat(fd, &sb) == -1) || ((size_t)sb.st_size < sizeof(struct udp_echo_stats)) )
+   {
+      if (!(quiet))
+         fprintf(stderr, "%s: %s: not a statistics segment\n", prog_name, path);
+      close(fd);
+      return(-1);
+   };
+   size = (size_t)sb.st_size;
+   if ((sp = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+   {
+      if (!(quiet))
+         fprintf(stderr, "%s: mmap(): %s\n", prog_name, strerror(errno));
+      close(fd);
+      return(-1);
+   };
+   close(fd);
+
+   // magic is written last once the daemon has filled in the header
+   if (__atomic_load_n(&sp->magic, __ATOMIC_ACQUIRE) != UDP_ECHO_STATS_MAGIC)
+   {
+      if (!(quiet))
+         fprintf(stderr, "%s: %s: not a statistics segment or daemon still starting\n", prog_name, path);
+      munmap(sp, size);
+      return(-1);
+   };
+   if ( (sp->version != UDP_ECHO_STATS_VERSION) ||
+        (sp->hist_buckets > UDP_ECHO_STATS_BUCKETS) ||
+        (size < (sizeof(struct udp_echo_stats) + (sizeof(struct udp_echo_stats_worker) * sp->workers))) )
+   {
+      if (!(quiet))
+         fprintf(stderr, "%s: %s: unsupported statistics segment version %u\n", prog_name, path, sp->version);
+      munmap(sp, size);
+      return(-1);
+   };
+
+   segp->stats = sp;
+   segp->size  = size;
+   segp->dev   = sb.st_dev;
+   segp->ino   = sb.st_ino;
+   segp->cur   = calloc(sp->workers + 1, sizeof(struct udp_echo_stats_worker));
+   segp->prev  = calloc(sp->workers + 1, sizeof(struct udp_echo_stats_worker));
+   if ( (segp->cur == NULL) || (segp->prev == NULL) )
+   {
+      fprintf(stderr, "%s: out of virtual memory\n", prog_name);
+      my_unmap(segp);
+      return(-1);
+   };
+
+   return(0);
+}
+
+
+// service time quantile in nanoseconds from histogram bucket deltas,
+// reported as the upper bound of the bucket holding the quantile
+uint64_t my_quantile(const struct udp_echo_stats * sp,
+   const struct udp_echo_stats_worker * cur, const struct udp_echo_stats_worker * prev, double q)
+{
+   unsigned                  idx;
+   uint64_t                  count;
+   uint64_t                  cumulative;
+   uint64_t                  target;
+
+   count = 0;
+   for(idx = 0; (idx < sp->hist_buckets); idx++)
+      count += cur->hist[UDP_ECHO_HIST_SERVICE][idx] - prev->hist[UDP_ECHO_HIST_SERVICE][idx];
+   if (!(count))
+      return(0);
+
+   target = (uint64_t)((double)count * q);
+   if (target < 1)
+      target = 1;
+   for(idx = 0, cumulative = 0; (idx < (sp->hist_buckets - 1)); idx++)
+   {
+      cumulative += cur->hist[UDP_ECHO_HIST_SERVICE][idx] - prev->hist[UDP_ECHO_HIST_SERVICE][idx];
+      if (cumulative >= target)
+         break;
+   };
+
+   return(1ULL << (idx + sp->hist_shift));
+}
+
+
+// print rates of one sample row
+void my_row(const char * label, const struct udp_echo_stats * sp,
+   const struct udp_echo_stats_worker * cur, const struct udp_echo_stats_worker * prev, double secs)
+{
+   uint64_t                  count;
+   uint64_t                  sum;
+   char                      avg[16];
+   char                      p50[16];
+   char                      p99[16];
+
+   #define MY_RATE(idx)      ((double)(cur->counters[idx] - prev->counters[idx]) / secs)
+
+   count = cur->hist_count[UDP_ECHO_HIST_SERVICE] - prev->hist_count[UDP_ECHO_HIST_SERVICE];
+   sum   = cur->hist_sum[UDP_ECHO_HIST_SERVICE]   - prev->hist_sum[UDP_ECHO_HIST_SERVICE];
+   if ((count))
+   {
+      snprintf(avg, sizeof(avg), "%.1f", MY_US(sum / count));
+      snprintf(p50, sizeof(p50), "%.1f", MY_US(my_quantile(sp, cur, prev, 0.50)));
+      snprintf(p99, sizeof(p99), "%.1f", MY_US(my_quantile(sp, cur, prev, 0.99)));
+   } else
+   {
+      strcpy(avg, "-");
+      strcpy(p50, "-");
+      strcpy(p99, "-");
+   };
+
+   printf("%-6s %9.0f %9.0f %9.2f %7.0f %7.0f %7.0f %7.0f %7.0f %7" PRIu64 " %7" PRIu64 " %8s %8s %8s\n",
+      label,
+      MY_RATE(UDP_ECHO_STAT_RX_PKTS),
+      MY_RATE(UDP_ECHO_STAT_TX_PKTS),
+      MY_RATE(UDP_ECHO_STAT_RX_BYTES) * 8.0 / 1e6,
+      MY_RATE(UDP_ECHO_STAT_DROPS),
+      MY_RATE(UDP_ECHO_STAT_DENIES),
+      MY_RATE(UDP_ECHO_STAT_TRUNCATED),
+      MY_RATE(UDP_ECHO_STAT_RX_ERRORS) + MY_RATE(UDP_ECHO_STAT_TX_ERRORS),
+      MY_RATE(UDP_ECHO_STAT_RXQ_DROPS),
+      cur->delayed,
+      cur->flows,
+      avg, p50, p99);
+
+   #undef MY_RATE
+
+   return;
+}
+
+
+// copy consistent snapshot of worker record, retrying while the worker
+// is updating it, returns -1 and leaves dst unchanged if the record is stale
+int my_snapshot(const struct udp_echo_stats_worker * rec, struct udp_echo_stats_worker * dst)
+{
+   size_t                    pos;
+   size_t                    len;
+   uint32_t                  seq;
+   uint64_t                  deadline;
+   struct timespec           ts;
+   const uint64_t          * src;
+   struct udp_echo_stats_worker snap;
+   uint64_t                * out;
+
+   // every field after seq and id is a 64 bit value
+   src = &rec->updated;
+   out = &snap.updated;
+   len = (sizeof(struct udp_echo_stats_worker) - offsetof(struct udp_echo_stats_worker, updated)) / sizeof(uint64_t);
+
+   // a worker killed or stopped between the two seq increments leaves the
+   // record odd forever, so give up after a few milliseconds
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   deadline = MY_NS(ts) + MY_SNAPSHOT_WAIT;
+   while(1)
+   {
+      if (!((seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE)) & 1))
+      {
+         for(pos = 0; (pos < len); pos++)
+            out[pos] = __atomic_load_n(&src[pos], __ATOMIC_RELAXED);
+         __atomic_thread_fence(__ATOMIC_ACQUIRE);
+         if (__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) == seq)
+            break;
+      };
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      if (MY_NS(ts) >= deadline)
+         return(-1);
+      sched_yield();
+   };
+   memcpy(dst, &snap, sizeof(snap));
+   dst->seq = seq;
+   dst->id  = rec->id;
+
+   return(0);
+}
+
+
+// signal system stop
+void my_stop(int signum)
+{
+   should_stop = 1;
+   signal(signum, my_stop);
+   return;
+}
+
+
+// add worker record to totals
+void my_sum(struct udp_echo_stats_worker * dst, const struct udp_echo_stats_worker * src)
+{
+   size_t                    pos;
+   size_t                    len;
+   const uint64_t          * in;
+   uint64_t                * out;
+
+   in  = &src->updated;
+   out = &dst->updated;
+   len = (sizeof(struct udp_echo_stats_worker) - offsetof(struct udp_echo_stats_worker, updated)) / sizeof(uint64_t);
+   for(pos = 0; (pos < len); pos++)
+      out[pos] += in[pos];
+
+   return;
+}
+
+
+// release mapped statistics segment
+void my_unmap(struct my_seg * segp)
+{
+   if ((segp->stats))
+      munmap(segp->stats, segp->size);
+   free(segp->cur);
+   free(segp->prev);
+   memset(segp, 0, sizeof(struct my_seg));
+   return;
+}
+
+
+// display program usage
+void my_usage(void)
+{
+   printf("Usage: %s [options] [interval [count]]\n", prog_name);
+   printf("OPTIONS:\n");
+   printf("  -f path, --file=path      statistics segment given to akcom-udpechod --shm (default: %s)\n", MY_SHM_PATH);
+   printf("  -h, --help                print this help and exit\n");
+   printf("  -V, --version             print version number and exit\n");
+   printf("  -w, --workers             print a row for each worker after the totals\n");
+   printf("\n");
+   printf("The first row reports averages since the daemon started, each following row\n");
+   printf("the rates over the last interval (default: %lu sec). Service times are in\n", cnf_interval);
+   printf("microseconds, quantiles are histogram bucket upper bounds.\n");
+   printf("\n");
+   return;
+}
+
+
+// display program usage error
+void my_usage_error(const char * fmt, ...)
+{
+   va_list args;
+
+   fprintf(stderr, "%s: ", prog_name);
+
+   va_start(args, fmt);
+   vfprintf(stderr, fmt, args);
+   va_end(args);
+
+   fprintf(stderr, "\nTry `%s --help' for more information.\n", prog_name);
+
+   return;
+}
+
+
+/* end of source file */